@@ -1,4 +1,5 @@
 #include "adjacenttriangles.h"
+#include "parallel.h"
 
 void buildEdgeAdjacentTrianglesTable(const MatrixXu &F, EdgeToAdjacentTrianglesMap &adjacentMap) {
 	std::cout << "--Build edge adjacent triangles lookup table..." << std::endl;
@@ -65,3 +66,220 @@ int lookupEdgeAdjacentTriangle(uint32_t triangle, uint32_t p0, uint32_t p1, cons
 	}
 }
 
+
+namespace {
+	struct HalfEdge {
+		uint64_t key;		// min(p0, p1) << 32 | max(p0, p1)
+		uint32_t index;		// 3 * f + i
+	};
+
+	/* Stable LSD radix sort on the key bytes selected by 'bytes', one parallel pass per byte.
+	   Every pass splits the input into fixed blocks, so the result does not depend on the thread count. */
+	void parallelRadixSort(std::vector<HalfEdge> &data, const std::vector<int> &bytes) {
+		const uint32_t size = (uint32_t) data.size();
+		const uint32_t blockSize = std::max(1u << 16, (size + 255) / 256);
+		const uint32_t blockCount = (size + blockSize - 1) / blockSize;
+
+		std::vector<HalfEdge> temp(size);
+		std::vector<uint32_t> offsets(256 * (size_t) blockCount);
+
+		for (int byte : bytes) {
+			const int shift = 8 * byte;
+
+			parallel_for(0u, blockCount, 1, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t block = begin; block < end; ++block) {
+					uint32_t *histogram = &offsets[256 * (size_t) block];
+					std::fill(histogram, histogram + 256, 0u);
+					for (uint32_t i = block * blockSize, last = std::min(size, i + blockSize); i < last; ++i)
+						histogram[(data[i].key >> shift) & 0xFF]++;
+				}
+			});
+
+			uint32_t sum = 0;
+			for (uint32_t digit = 0; digit < 256; ++digit) {
+				for (uint32_t block = 0; block < blockCount; ++block) {
+					uint32_t count = offsets[256 * (size_t) block + digit];
+					offsets[256 * (size_t) block + digit] = sum;
+					sum += count;
+				}
+			}
+
+			parallel_for(0u, blockCount, 1, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t block = begin; block < end; ++block) {
+					uint32_t *offset = &offsets[256 * (size_t) block];
+					for (uint32_t i = block * blockSize, last = std::min(size, i + blockSize); i < last; ++i)
+						temp[offset[(data[i].key >> shift) & 0xFF]++] = data[i];
+				}
+			});
+
+			data.swap(temp);
+		}
+	}
+}
+
+void buildEdgeTopology(const MatrixXu &F, EdgeTopology &topology) {
+	std::cout << "--Build edge topology ..." << std::endl;
+	Timer<> timer;
+
+	const uint32_t trianglesCount = F.cols();
+	const uint32_t halfEdgesCount = 3 * trianglesCount;
+
+	std::vector<HalfEdge> halfEdges(halfEdgesCount);
+	parallel_for(0u, trianglesCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t f = begin; f < end; ++f) {
+			for (int i = 0; i < 3; ++i) {
+				uint64_t p0 = F(i, f), p1 = F(i == 2 ? 0 : i + 1, f);
+				if (p0 > p1) std::swap(p0, p1);
+				halfEdges[3 * f + i].key = (p0 << 32) | p1;
+				halfEdges[3 * f + i].index = 3 * f + i;
+			}
+		}
+	});
+
+	/* Only sort on the bytes which can be nonzero */
+	uint32_t maxIndex = F.size() > 0 ? F.maxCoeff() : 0;
+	int indexBytes = 1;
+	while (indexBytes < 4 && (maxIndex >> (8 * indexBytes)) != 0)
+		++indexBytes;
+	std::vector<int> bytes;
+	for (int byte = 0; byte < indexBytes; ++byte) bytes.push_back(byte);
+	for (int byte = 0; byte < indexBytes; ++byte) bytes.push_back(4 + byte);
+	parallelRadixSort(halfEdges, bytes);
+
+	/* Each run of equal keys is one edge, number the runs */
+	std::vector<uint32_t> edgeIds(halfEdgesCount);
+	uint32_t edgeCount = 0;
+	for (uint32_t i = 0; i < halfEdgesCount; ++i) {
+		if (i > 0 && halfEdges[i].key != halfEdges[i - 1].key) ++edgeCount;
+		edgeIds[i] = edgeCount;
+	}
+	if (halfEdgesCount > 0) ++edgeCount;
+
+	topology.E.resize(2, edgeCount);
+	topology.FE.resize(3, trianglesCount);
+	topology.EF.resize(2, edgeCount);
+	topology.EF.setConstant(-1);
+	topology.nonManifoldEdges.clear();
+
+	parallel_for(0u, halfEdgesCount, GRAIN_SIZE * 16, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			const HalfEdge &h = halfEdges[i];
+			uint32_t e = edgeIds[i];
+			topology.FE(h.index % 3, h.index / 3) = e;
+
+			if (i == 0 || edgeIds[i - 1] != e) {
+				topology.E(0, e) = (uint32_t) (h.key >> 32);
+				topology.E(1, e) = (uint32_t) h.key;
+				topology.EF(0, e) = h.index / 3;
+			}
+			else if (edgeIds[i - 1] == e && (i < 2 || edgeIds[i - 2] != e)) {
+				topology.EF(1, e) = h.index / 3;
+			}
+		}
+	});
+
+	/* Runs with more than two half-edges are non-manifold edges */
+	for (uint32_t i = 2; i < halfEdgesCount; ++i) {
+		if (edgeIds[i] == edgeIds[i - 2] && (i < 3 || edgeIds[i - 3] != edgeIds[i])) {
+			NonManifoldEdge edge;
+			edge.edge = edgeIds[i];
+			for (uint32_t j = i - 2; j < halfEdgesCount && edgeIds[j] == edge.edge; ++j)
+				edge.triangles.push_back(halfEdges[j].index / 3);
+			topology.nonManifoldEdges.push_back(std::move(edge));
+		}
+	}
+
+	std::cout << "++Build edge topology done. (E=" << edgeCount;
+	if (!topology.nonManifoldEdges.empty())
+		std::cout << ", " << topology.nonManifoldEdges.size() << " non-manifold edges";
+	std::cout << ", took " << timeString(timer.value()) << ")" << std::endl;
+}
+
+int lookupEdge(uint32_t p0, uint32_t p1, const EdgeTopology &topology) {
+	if (p0 > p1) std::swap(p0, p1);
+
+	int low = 0, high = (int) topology.edgeCount() - 1;
+	while (low <= high) {
+		int mid = low + (high - low) / 2;
+		uint32_t e0 = topology.E(0, mid), e1 = topology.E(1, mid);
+		if (e0 == p0 && e1 == p1) return mid;
+		if (e0 < p0 || (e0 == p0 && e1 < p1)) low = mid + 1;
+		else high = mid - 1;
+	}
+	return -1;
+}
+
+int lookupEdgeAdjacentTriangle(uint32_t triangle, uint32_t p0, uint32_t p1, const EdgeTopology &topology) {
+	int e = lookupEdge(p0, p1, topology);
+
+	if (e != -1) {
+		int tri0 = topology.EF(0, e), tri1 = topology.EF(1, e);
+
+		if (tri0 != -1 && static_cast<uint32_t>(tri0) != triangle) return tri0;
+		if (tri1 != -1 && static_cast<uint32_t>(tri1) != triangle) return tri1;
+
+		return -1;
+	}
+	else {
+		std::cerr << "The edge topology does not have the query edge!" << std::endl;
+		return -1;
+	}
+}
+
+void buildFaceAdjacencyTable(const MatrixXu &F, MatrixXi &A, MatrixXu8 &AE) {
+	EdgeTopology topology;
+	buildEdgeTopology(F, topology);
+	buildFaceAdjacencyTable(F, topology, A, AE);
+}
+
+void buildFaceAdjacencyTable(const MatrixXu &F, const EdgeTopology &topology, MatrixXi &A, MatrixXu8 &AE) {
+	std::cout << "--Build face adjacency table ..." << std::endl;
+	uint32_t trianglesCount = F.cols();
+	A.resize(3, trianglesCount);
+	AE.resize(3, trianglesCount);
+
+	const MatrixXu &FE = topology.FE;
+	const MatrixXi &EF = topology.EF;
+
+	parallel_for(0u, trianglesCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t f = begin; f < end; ++f) {
+			for (int i = 0; i < 3; ++i) {
+				uint32_t e = FE(i, f);
+				int adjacent = -1;
+				if (EF(0, e) == (int) f) adjacent = EF(1, e);
+				else if (EF(1, e) == (int) f) adjacent = EF(0, e);	// else: third triangle on a non-manifold edge
+
+				A(i, f) = -1;
+				AE(i, f) = 0;
+				if (adjacent == -1)
+					continue;
+
+				for (int k = 0; k < 3; ++k) {
+					if (FE(k, adjacent) == e) {
+						A(i, f) = adjacent;
+						AE(i, f) = (uint8_t) k;
+						break;
+					}
+				}
+			}
+		}
+	});
+	std::cout << "++Build face adjacency table done." << std::endl;
+}
+
+void buildVertexCornerTable(const MatrixXu &F, uint32_t vertexCount, std::vector<uint32_t> &offsets, std::vector<uint32_t> &corners) {
+	const uint32_t cornersCount = (uint32_t) F.size();
+	const uint32_t *indices = F.data();	// column major, indices[3 * f + i] == F(i, f)
+
+	offsets.assign(vertexCount + 1, 0);
+	for (uint32_t c = 0; c < cornersCount; ++c)
+		offsets[indices[c] + 1]++;
+	for (uint32_t v = 0; v < vertexCount; ++v)
+		offsets[v + 1] += offsets[v];
+
+	/* Counting sort, corners are visited in ascending order */
+	std::vector<uint32_t> position(offsets.begin(), offsets.end() - 1);
+	corners.resize(cornersCount);
+	for (uint32_t c = 0; c < cornersCount; ++c)
+		corners[position[indices[c]]++] = c;
+}
@@ -2,9 +2,11 @@
 
 #include "mycommon.h"
 #include <unordered_map>
+#include <vector>
 
 using nanogui::MatrixXf;
 using nanogui::MatrixXu;
+using Eigen::MatrixXi;
 
 struct Edge {
 	uint32_t p0 = (uint32_t) -1;
@@ -38,4 +40,45 @@ typedef std::unordered_map<Edge, std::pair<int, int>, EdgeHash> EdgeToAdjacentTr
 extern void buildEdgeAdjacentTrianglesTable(const MatrixXu &F, EdgeToAdjacentTrianglesMap &adjacentMap);
 
 /* Lookup the adjacent triangle with given current triangle id and the edge. Return adjancent triangle id if exists, or return -1. */
-extern int lookupEdgeAdjacentTriangle(uint32_t triangle, uint32_t p0, uint32_t p1, const EdgeToAdjacentTrianglesMap &adjacentMap);
\ No newline at end of file
+extern int lookupEdgeAdjacentTriangle(uint32_t triangle, uint32_t p0, uint32_t p1, const EdgeToAdjacentTrianglesMap &adjacentMap);
+
+/* An edge shared by more than two triangles */
+struct NonManifoldEdge {
+	uint32_t edge;					// index into EdgeTopology::E
+	std::vector<uint32_t> triangles;	// all triangles containing the edge, in ascending order
+};
+
+/*
+   Flat edge table of a triangle mesh, built by sorting packed 64 bit edge keys (min(p0, p1) << 32 | max(p0, p1))
+   instead of inserting half-edges into a hash map.
+   E(:, e) holds the end points of undirected edge e (E(0, e) <= E(1, e)), edges are sorted by these keys.
+   FE(i, f) is the edge index of edge i (F(i, f) -> F(i + 1, f)) of triangle f.
+   EF(:, e) holds the (first) two triangles sharing edge e in ascending order, EF(1, e) is -1 for boundary edges.
+*/
+struct EdgeTopology {
+	MatrixXu E;
+	MatrixXu FE;
+	MatrixXi EF;
+	std::vector<NonManifoldEdge> nonManifoldEdges;
+
+	inline uint32_t edgeCount() const { return (uint32_t) E.cols(); }
+};
+
+extern void buildEdgeTopology(const MatrixXu &F, EdgeTopology &topology);
+
+/* Binary search for the edge (p0, p1) in either orientation. Return the edge index if exists, or return -1. */
+extern int lookupEdge(uint32_t p0, uint32_t p1, const EdgeTopology &topology);
+
+/* Same as the map based version above. */
+extern int lookupEdgeAdjacentTriangle(uint32_t triangle, uint32_t p0, uint32_t p1, const EdgeTopology &topology);
+
+/* Build the per-face adjacency of a triangle mesh once, for constant time lookups afterwards.
+   A(i, f) is the triangle sharing edge i (F(i, f) -> F(i + 1, f)) with triangle f, or -1 if edge i is a boundary edge.
+   AE(i, f) is the index of the same edge inside triangle A(i, f), i.e. P(AE(i, f), A(i, f)) is the neighbour's pattern
+   of the shared edge. Edges shared by more than 2 triangles only link the first two of them. */
+extern void buildFaceAdjacencyTable(const MatrixXu &F, MatrixXi &A, MatrixXu8 &AE);
+extern void buildFaceAdjacencyTable(const MatrixXu &F, const EdgeTopology &topology, MatrixXi &A, MatrixXu8 &AE);
+
+/* Vertex to incident corner table in CSR layout: corners[offsets[v]] .. corners[offsets[v + 1] - 1] are the corners
+   3 * f + i with F(i, f) == v, in ascending order. */
+extern void buildVertexCornerTable(const MatrixXu &F, uint32_t vertexCount, std::vector<uint32_t> &offsets, std::vector<uint32_t> &corners);
\ No newline at end of file
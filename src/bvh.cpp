@@ -0,0 +1,276 @@
+#include "bvh.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+/* Subtrees below this many primitives are built by one thread */
+#define BVH_MIN_SUBTREE_SIZE 4096
+
+/* Number of centroid bins evaluated by the SAH split */
+#define BVH_SAH_BINS 16
+
+/* Ranges of at least this many primitives are binned in parallel when splitting the top of the tree */
+#define BVH_PARALLEL_BIN_SIZE 65536
+
+/* Below this depth splits minimize the SAH, further down they split at the median, which bounds the depth */
+#define BVH_SAH_MAX_DEPTH (BVH_MAX_DEPTH - 32)
+
+struct BVHBins {
+	AABB bounds[BVH_SAH_BINS];
+	uint32_t counts[BVH_SAH_BINS];
+
+	BVHBins() { std::fill(counts, counts + BVH_SAH_BINS, 0u); }
+
+	void merge(const BVHBins &bins) {
+		for (int b = 0; b < BVH_SAH_BINS; ++b) {
+			bounds[b].expandBy(bins.bounds[b]);
+			counts[b] += bins.counts[b];
+		}
+	}
+};
+
+struct BVHBuilder {
+	const std::vector<AABB> &bounds;
+	std::vector<Vector3f> centroids;
+	std::vector<uint32_t> &indices;
+	uint32_t maxLeafSize;
+
+	BVHBuilder(const std::vector<AABB> &bounds, std::vector<uint32_t> &indices, uint32_t maxLeafSize)
+		: bounds(bounds), indices(indices), maxLeafSize(maxLeafSize) { }
+
+	static void setBounds(BVHNode &node, const AABB &aabb) {
+		for (int i = 0; i < 3; ++i) {
+			node.min[i] = aabb.min[i];
+			node.max[i] = aabb.max[i];
+		}
+	}
+
+	inline int bin(uint32_t primitive, int axis, float lower, float scale) const {
+		return std::min((int)((centroids[primitive][axis] - lower) * scale), BVH_SAH_BINS - 1);
+	}
+
+	AABB centroidBounds(uint32_t begin, uint32_t end, bool parallel) const {
+		if (!parallel || end - begin < BVH_PARALLEL_BIN_SIZE) {
+			AABB result;
+			for (uint32_t i = begin; i < end; ++i)
+				result.expandBy(centroids[indices[i]]);
+			return result;
+		}
+		uint32_t blockCount = (end - begin + GRAIN_SIZE - 1) / GRAIN_SIZE;
+		std::vector<AABB> blockBounds(blockCount);
+		parallel_for(begin, end, GRAIN_SIZE, [&](uint32_t blockBegin, uint32_t blockEnd) {
+			AABB &aabb = blockBounds[(blockBegin - begin) / GRAIN_SIZE];
+			for (uint32_t i = blockBegin; i < blockEnd; ++i)
+				aabb.expandBy(centroids[indices[i]]);
+		});
+		AABB result;
+		for (const AABB &aabb : blockBounds)
+			result.expandBy(aabb);
+		return result;
+	}
+
+	void binRange(uint32_t begin, uint32_t end, int axis, float lower, float scale, bool parallel, BVHBins &bins) const {
+		if (!parallel || end - begin < BVH_PARALLEL_BIN_SIZE) {
+			for (uint32_t i = begin; i < end; ++i) {
+				int b = bin(indices[i], axis, lower, scale);
+				bins.bounds[b].expandBy(bounds[indices[i]]);
+				bins.counts[b]++;
+			}
+			return;
+		}
+		uint32_t blockCount = (end - begin + GRAIN_SIZE - 1) / GRAIN_SIZE;
+		std::vector<BVHBins> blockBins(blockCount);
+		parallel_for(begin, end, GRAIN_SIZE, [&](uint32_t blockBegin, uint32_t blockEnd) {
+			binRange(blockBegin, blockEnd, axis, lower, scale, false, blockBins[(blockBegin - begin) / GRAIN_SIZE]);
+		});
+		for (const BVHBins &block : blockBins)
+			bins.merge(block);
+	}
+
+	/* Reorder indices[begin, end) around the returned split position, returns end if the range is a leaf.
+	   parallel bins large ranges on all threads, it is only set outside of the parallel subtree builds. */
+	uint32_t split(uint32_t begin, uint32_t end, uint32_t depth, bool parallel = false) const {
+		if (end - begin <= maxLeafSize)
+			return end;
+		AABB centroidBox = centroidBounds(begin, end, parallel);
+		int axis = centroidBox.largestAxis();
+		float lower = centroidBox.min[axis], extent = centroidBox.max[axis] - lower;
+		uint32_t middle = begin + (end - begin) / 2;
+		if (!(extent > 0.0f))
+			return middle;
+
+		if (depth < BVH_SAH_MAX_DEPTH) {
+			/* Binned SAH: minimize the summed surface area times primitive count of the two children */
+			float scale = BVH_SAH_BINS / extent;
+			BVHBins bins;
+			binRange(begin, end, axis, lower, scale, parallel, bins);
+			float rightArea[BVH_SAH_BINS];
+			uint32_t rightCount[BVH_SAH_BINS];
+			AABB aabb;
+			uint32_t count = 0;
+			for (int b = BVH_SAH_BINS - 1; b > 0; --b) {
+				aabb.expandBy(bins.bounds[b]);
+				count += bins.counts[b];
+				rightArea[b] = count > 0 ? aabb.surfaceArea() : 0.0f;
+				rightCount[b] = count;
+			}
+			aabb.clear();
+			count = 0;
+			float bestCost = std::numeric_limits<float>::infinity();
+			int bestBin = -1;
+			for (int b = 1; b < BVH_SAH_BINS; ++b) {
+				aabb.expandBy(bins.bounds[b - 1]);
+				count += bins.counts[b - 1];
+				if (count == 0 || rightCount[b] == 0)
+					continue;
+				float cost = count * aabb.surfaceArea() + rightCount[b] * rightArea[b];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestBin = b;
+				}
+			}
+			if (bestBin > 0)
+				return (uint32_t)(std::partition(indices.begin() + begin, indices.begin() + end, [&](uint32_t primitive) {
+					return bin(primitive, axis, lower, scale) < bestBin;
+				}) - indices.begin());
+		}
+
+		std::nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end, [&](uint32_t a, uint32_t b) {
+			return centroids[a][axis] < centroids[b][axis];
+		});
+		return middle;
+	}
+
+	/* Append the subtree over indices[begin, end) to nodes, returns its bounds */
+	AABB buildSubtree(uint32_t begin, uint32_t end, uint32_t depth, std::vector<BVHNode> &nodes) const {
+		uint32_t index = (uint32_t)nodes.size();
+		nodes.emplace_back();
+		AABB aabb;
+		uint32_t middle = split(begin, end, depth);
+		if (middle == end) {
+			for (uint32_t i = begin; i < end; ++i)
+				aabb.expandBy(bounds[indices[i]]);
+			nodes[index].offset = begin;
+			nodes[index].count = end - begin;
+		}
+		else {
+			aabb = buildSubtree(begin, middle, depth + 1, nodes);
+			nodes[index].offset = (uint32_t)nodes.size();
+			nodes[index].count = 0;
+			aabb.expandBy(buildSubtree(middle, end, depth + 1, nodes));
+		}
+		setBounds(nodes[index], aabb);
+		return aabb;
+	}
+};
+
+/* Node of the serially split top of the tree, either inner node or a subtree built by one task */
+struct BVHTopNode {
+	uint32_t begin, end, depth;
+	int32_t children[2];
+	int32_t task;
+};
+
+void BVH::build(const std::vector<AABB> &bounds, uint32_t maxLeafSize) {
+	clear();
+	uint32_t primitiveCount = (uint32_t)bounds.size();
+	BVHBuilder builder(bounds, mIndices, std::max(maxLeafSize, 1u));
+
+	/* Centroids and the primitives with non-empty bounds */
+	builder.centroids.resize(primitiveCount);
+	uint32_t blockCount = (primitiveCount + GRAIN_SIZE - 1) / GRAIN_SIZE;
+	std::vector<uint32_t> blockOffsets(blockCount + 1, 0);
+	parallel_for(0u, primitiveCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		uint32_t valid = 0;
+		for (uint32_t i = begin; i < end; ++i) {
+			builder.centroids[i] = bounds[i].center();
+			valid += (bounds[i].min.array() <= bounds[i].max.array()).all() ? 1 : 0;
+		}
+		blockOffsets[begin / GRAIN_SIZE + 1] = valid;
+	});
+	for (uint32_t block = 0; block < blockCount; ++block)
+		blockOffsets[block + 1] += blockOffsets[block];
+	mIndices.resize(blockOffsets[blockCount]);
+	parallel_for(0u, primitiveCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		uint32_t offset = blockOffsets[begin / GRAIN_SIZE];
+		for (uint32_t i = begin; i < end; ++i)
+			if ((bounds[i].min.array() <= bounds[i].max.array()).all())
+				mIndices[offset++] = i;
+	});
+
+	uint32_t count = (uint32_t)mIndices.size();
+	if (count == 0)
+		return;
+
+	/* Split the top serially into subtrees of about count / (8 * threads) primitives */
+	uint32_t subtreeSize = std::max<uint32_t>(BVH_MIN_SUBTREE_SIZE, count / (8 * getThreadCount()));
+	std::vector<BVHTopNode> top;
+	std::vector<uint32_t> tasks;
+	std::vector<uint32_t> stack(1, 0);
+	top.push_back({ 0, count, 0, { -1, -1 }, -1 });
+	while (!stack.empty()) {
+		uint32_t index = stack.back();
+		stack.pop_back();
+		uint32_t begin = top[index].begin, end = top[index].end, depth = top[index].depth;
+		uint32_t middle = end - begin > subtreeSize ? builder.split(begin, end, depth, true) : end;
+		if (middle == end) {
+			top[index].task = (int32_t)tasks.size();
+			tasks.push_back(index);
+			continue;
+		}
+		for (int i = 0; i < 2; ++i) {
+			top[index].children[i] = (int32_t)top.size();
+			stack.push_back((uint32_t)top.size());
+			top.push_back({ i == 0 ? begin : middle, i == 0 ? middle : end, depth + 1, { -1, -1 }, -1 });
+		}
+	}
+
+	/* Subtrees in parallel, with node indices relative to the subtree */
+	std::vector<std::vector<BVHNode>> subtrees(tasks.size());
+	parallel_for(0u, (uint32_t)tasks.size(), 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t task = begin; task < end; ++task) {
+			const BVHTopNode &node = top[tasks[task]];
+			subtrees[task].reserve(2 * (node.end - node.begin) / builder.maxLeafSize + 1);
+			builder.buildSubtree(node.begin, node.end, node.depth, subtrees[task]);
+		}
+	});
+
+	/* Emit the top nodes depth first and append the subtrees, offsetting their child indices */
+	size_t nodeCount = 2 * tasks.size() - 1;
+	for (const std::vector<BVHNode> &subtree : subtrees)
+		nodeCount += subtree.size() - 1;
+	mNodes.reserve(nodeCount);
+	struct Emit {
+		static AABB node(BVH &bvh, const std::vector<BVHTopNode> &top, const std::vector<std::vector<BVHNode>> &subtrees, uint32_t index) {
+			const BVHTopNode &topNode = top[index];
+			if (topNode.task >= 0) {
+				const std::vector<BVHNode> &subtree = subtrees[topNode.task];
+				uint32_t base = (uint32_t)bvh.mNodes.size();
+				for (BVHNode node : subtree) {
+					if (!node.isLeaf())
+						node.offset += base;
+					bvh.mNodes.push_back(node);
+				}
+				return subtree[0].bounds();
+			}
+			uint32_t nodeIndex = (uint32_t)bvh.mNodes.size();
+			bvh.mNodes.emplace_back();
+			AABB aabb = Emit::node(bvh, top, subtrees, topNode.children[0]);
+			bvh.mNodes[nodeIndex].offset = (uint32_t)bvh.mNodes.size();
+			bvh.mNodes[nodeIndex].count = 0;
+			aabb.expandBy(Emit::node(bvh, top, subtrees, topNode.children[1]));
+			BVHBuilder::setBounds(bvh.mNodes[nodeIndex], aabb);
+			return aabb;
+		}
+	};
+	Emit::node(*this, top, subtrees, 0);
+}
+
+void BVH::clear() {
+	mNodes.clear();
+	mIndices.clear();
+}
+
+size_t BVH::memoryUsage() const {
+	return sizeof(BVHNode) * mNodes.size() + sizeof(uint32_t) * mIndices.size();
+}
@@ -0,0 +1,230 @@
+/*
+	bvh.h: Bounding volume hierarchy over primitive bounding boxes
+
+	The nodes are stored depth first in one array of 32 byte nodes: the first child of an inner
+	node directly follows it, the index of the second child is stored in the node. A leaf refers to
+	the range [offset, offset + count) of indices(), which lists the primitives in leaf order, so
+	per primitive data can be reordered once to be read sequentially during traversal.
+
+	The build bins the primitive centroids along the largest axis and splits where the surface area
+	heuristic (SAH) is minimal; deep in degenerate trees it falls back to the median, which bounds
+	the depth. The top of the tree is split one node at a time with the binning spread over all
+	threads until there are enough subtrees for all threads, the subtrees are then built in
+	parallel and appended in order.
+*/
+
+#pragma once
+
+#include "mycommon.h"
+#include "aabb.h"
+
+#include <vector>
+
+/* Default maximum number of primitives per leaf */
+#define BVH_LEAF_SIZE 4
+
+/* Maximum depth of a tree built by BVH::build(), bounds the traversal stacks */
+#define BVH_MAX_DEPTH 64
+
+struct BVHNode {
+	float min[3];
+	uint32_t offset;		// inner node: index of the second child, leaf: first entry of indices()
+	float max[3];
+	uint32_t count;			// leaf: number of primitives, 0 for inner nodes
+
+	inline bool isLeaf() const { return count > 0; }
+	inline bool contains(const float *p) const {
+		return p[0] >= min[0] && p[0] <= max[0] && p[1] >= min[1] && p[1] <= max[1] && p[2] >= min[2] && p[2] <= max[2];
+	}
+	inline AABB bounds() const { return AABB(Vector3f(min[0], min[1], min[2]), Vector3f(max[0], max[1], max[2])); }
+};
+
+class BVH {
+public:
+	BVH() { }
+
+	/* Build over the given primitive bounds, primitives with empty bounds (min > max) are left out */
+	void build(const std::vector<AABB> &bounds, uint32_t maxLeafSize = BVH_LEAF_SIZE);
+	void clear();
+
+	inline bool isEmpty() const { return mNodes.empty(); }
+	inline const std::vector<BVHNode> &nodes() const { return mNodes; }
+	inline const std::vector<uint32_t> &indices() const { return mIndices; }
+	inline AABB bounds() const { return mNodes.empty() ? AABB() : mNodes[0].bounds(); }
+
+	size_t memoryUsage() const;
+
+	/* Call leaf(begin, end) for the index ranges of all leaves whose bounds contain p, until it returns true */
+	template <typename Leaf> bool traversePoint(const Vector3f &p, const Leaf &leaf) const {
+		if (mNodes.empty() || !mNodes[0].contains(p.data()))
+			return false;
+		uint32_t stack[BVH_MAX_DEPTH], stackSize = 0, index = 0;
+		while (true) {
+			const BVHNode &node = mNodes[index];
+			if (node.isLeaf()) {
+				if (leaf(node.offset, node.offset + node.count))
+					return true;
+			}
+			else {
+				bool first = mNodes[index + 1].contains(p.data()), second = mNodes[node.offset].contains(p.data());
+				if (first) {
+					if (second)
+						stack[stackSize++] = node.offset;
+					index = index + 1;
+					continue;
+				}
+				if (second) {
+					index = node.offset;
+					continue;
+				}
+			}
+			if (stackSize == 0)
+				return false;
+			index = stack[--stackSize];
+		}
+	}
+
+	/* Call leaf(begin, end) for the index ranges of all leaves whose bounds overlap box, until it returns true */
+	template <typename Leaf> bool traverseBox(const AABB &box, const Leaf &leaf) const {
+		if (mNodes.empty() || !overlaps(mNodes[0], box))
+			return false;
+		uint32_t stack[BVH_MAX_DEPTH], stackSize = 0, index = 0;
+		while (true) {
+			const BVHNode &node = mNodes[index];
+			if (node.isLeaf()) {
+				if (leaf(node.offset, node.offset + node.count))
+					return true;
+			}
+			else {
+				bool first = overlaps(mNodes[index + 1], box), second = overlaps(mNodes[node.offset], box);
+				if (first) {
+					if (second)
+						stack[stackSize++] = node.offset;
+					index = index + 1;
+					continue;
+				}
+				if (second) {
+					index = node.offset;
+					continue;
+				}
+			}
+			if (stackSize == 0)
+				return false;
+			index = stack[--stackSize];
+		}
+	}
+
+	/* Call leaf(begin, end, maxt) for the index ranges of all leaves whose bounds the ray hits within [ray.mint, maxt],
+	   nearer child first, until it returns true; leaf may lower maxt to the distance of a hit to prune the remaining nodes */
+	template <typename Leaf> bool traverseRay(const Ray &ray, float maxt, const Leaf &leaf) const {
+		if (mNodes.empty())
+			return false;
+		float invDir[3];
+		for (int i = 0; i < 3; ++i)
+			invDir[i] = 1.0f / ray.d[i];
+		float nearT;
+		if (!intersectNode(mNodes[0], ray, invDir, maxt, nearT))
+			return false;
+		uint32_t stack[BVH_MAX_DEPTH], stackSize = 0, index = 0;
+		float stackT[BVH_MAX_DEPTH];
+		while (true) {
+			const BVHNode &node = mNodes[index];
+			if (node.isLeaf()) {
+				if (leaf(node.offset, node.offset + node.count, maxt))
+					return true;
+			}
+			else {
+				float firstT, secondT;
+				bool first = intersectNode(mNodes[index + 1], ray, invDir, maxt, firstT);
+				bool second = intersectNode(mNodes[node.offset], ray, invDir, maxt, secondT);
+				if (first && second) {
+					bool swap = secondT < firstT;
+					stackT[stackSize] = swap ? firstT : secondT;
+					stack[stackSize++] = swap ? index + 1 : node.offset;
+					index = swap ? node.offset : index + 1;
+					continue;
+				}
+				if (first || second) {
+					index = first ? index + 1 : node.offset;
+					continue;
+				}
+			}
+			/* Skip nodes behind a hit found in the meantime */
+			do {
+				if (stackSize == 0)
+					return false;
+				--stackSize;
+			} while (stackT[stackSize] > maxt);
+			index = stack[stackSize];
+		}
+	}
+
+	/* Call leaf(begin, end, maxDistance2) for the index ranges of all leaves within squared distance maxDistance2 of p,
+	   nearer child first; leaf may lower maxDistance2 to the squared distance of a closer primitive */
+	template <typename Leaf> void traverseNearest(const Vector3f &p, float maxDistance2, const Leaf &leaf) const {
+		if (mNodes.empty() || !(nodeDistance2(mNodes[0], p) <= maxDistance2))
+			return;
+		uint32_t stack[BVH_MAX_DEPTH], stackSize = 0, index = 0;
+		float stackDistance2[BVH_MAX_DEPTH];
+		while (true) {
+			const BVHNode &node = mNodes[index];
+			if (node.isLeaf()) {
+				leaf(node.offset, node.offset + node.count, maxDistance2);
+			}
+			else {
+				float firstDistance2 = nodeDistance2(mNodes[index + 1], p), secondDistance2 = nodeDistance2(mNodes[node.offset], p);
+				bool first = firstDistance2 <= maxDistance2, second = secondDistance2 <= maxDistance2;
+				if (first && second) {
+					bool swap = secondDistance2 < firstDistance2;
+					stackDistance2[stackSize] = swap ? firstDistance2 : secondDistance2;
+					stack[stackSize++] = swap ? index + 1 : node.offset;
+					index = swap ? node.offset : index + 1;
+					continue;
+				}
+				if (first || second) {
+					index = first ? index + 1 : node.offset;
+					continue;
+				}
+			}
+			do {
+				if (stackSize == 0)
+					return;
+				--stackSize;
+			} while (stackDistance2[stackSize] > maxDistance2);
+			index = stack[stackSize];
+		}
+	}
+
+private:
+	/* Slab test of the ray against the node bounds within [ray.mint, maxt], nearT is the entry distance */
+	static inline bool intersectNode(const BVHNode &node, const Ray &ray, const float *invDir, float maxt, float &nearT) {
+		float farT = maxt;
+		nearT = ray.mint;
+		for (int i = 0; i < 3; ++i) {
+			float t0 = (node.min[i] - ray.o[i]) * invDir[i], t1 = (node.max[i] - ray.o[i]) * invDir[i];
+			if (t0 > t1)
+				std::swap(t0, t1);
+			/* NaN (zero direction on a slab boundary) keeps the previous interval */
+			nearT = t0 > nearT ? t0 : nearT;
+			farT = t1 < farT ? t1 : farT;
+		}
+		return nearT <= farT;
+	}
+
+	static inline bool overlaps(const BVHNode &node, const AABB &box) {
+		return node.min[0] <= box.max[0] && node.max[0] >= box.min[0] && node.min[1] <= box.max[1] && node.max[1] >= box.min[1] &&
+			node.min[2] <= box.max[2] && node.max[2] >= box.min[2];
+	}
+
+	static inline float nodeDistance2(const BVHNode &node, const Vector3f &p) {
+		float result = 0.0f;
+		for (int i = 0; i < 3; ++i) {
+			float d = std::max(std::max(node.min[i] - p[i], p[i] - node.max[i]), 0.0f);
+			result += d * d;
+		}
+		return result;
+	}
+
+	std::vector<BVHNode> mNodes;
+	std::vector<uint32_t> mIndices;
+};
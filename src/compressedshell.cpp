@@ -0,0 +1,391 @@
+#include "compressedshell.h"
+#include "simd.h"
+#include "parallel.h"
+
+#include <cstring>
+#include <algorithm>
+
+uint16_t floatToHalf(float value) {
+	uint32_t x;
+	memcpy(&x, &value, sizeof(float));
+	uint16_t sign = (uint16_t)((x >> 16) & 0x8000u);
+	x &= 0x7FFFFFFFu;
+
+	if (x >= 0x7F800000u)			// inf, nan
+		return sign | 0x7C00u | (x > 0x7F800000u ? 0x200u : 0u);
+	if (x >= 0x477FF000u)			// rounds to a value above 65504
+		return sign | 0x7C00u;
+	if (x < 0x38800000u) {			// below 2^-14: subnormal half, in units of 2^-24
+		float magnitude;
+		memcpy(&magnitude, &x, sizeof(float));
+		return sign | (uint16_t)lrintf(magnitude * 16777216.0f);
+	}
+
+	uint32_t half = ((((x >> 23) - 127 + 15) << 10) | ((x & 0x7FFFFFu) >> 13));
+	uint32_t rest = x & 0x1FFFu;
+	if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+		half++;						// a carry into the exponent is still correct
+	return sign | (uint16_t)half;
+}
+
+float halfToFloat(uint16_t value) {
+	uint32_t sign = (uint32_t)(value & 0x8000u) << 16;
+	uint32_t exponent = (value >> 10) & 0x1Fu, mantissa = value & 0x3FFu;
+	if (exponent == 0) {
+		float magnitude = mantissa * (1.0f / 16777216.0f);
+		return sign ? -magnitude : magnitude;
+	}
+	uint32_t bits = sign | (exponent == 31 ? 0x7F800000u : (exponent - 15 + 127) << 23) | (mantissa << 13);
+	float result;
+	memcpy(&result, &bits, sizeof(float));
+	return result;
+}
+
+void packQuantization(const ShellQuantization &quantization, float *values) {
+	for (int c = 0; c < 3; ++c) {
+		values[c] = quantization.positionMin[c];
+		values[3 + c] = quantization.positionExtent[c];
+		values[6 + c] = quantization.texcoordMin[c];
+		values[9 + c] = quantization.texcoordExtent[c];
+		values[12 + c] = 0.0f;
+	}
+	values[12] = quantization.tangentScale;
+}
+
+ShellQuantization unpackQuantization(const float *values) {
+	ShellQuantization quantization;
+	for (int c = 0; c < 3; ++c) {
+		quantization.positionMin[c] = values[c];
+		quantization.positionExtent[c] = values[3 + c];
+		quantization.texcoordMin[c] = values[6 + c];
+		quantization.texcoordExtent[c] = values[9 + c];
+	}
+	quantization.tangentScale = values[12];
+	return quantization;
+}
+
+static inline uint16_t quantizeUnsigned(float value) {
+	return (uint16_t)std::min(std::max(lrintf(value), 0L), 65535L);
+}
+
+static inline int16_t quantizeSigned(float value) {
+	return (int16_t)std::min(std::max(lrintf(value * 32767.0f), -32767L), 32767L);
+}
+
+struct EncodeArgs {
+	const float *V, *UV, *N, *DPDU, *DPDV;
+	float positionMin[3], positionScale[3], texcoordMin[3], texcoordScale[3], invTangentScale;
+	uint16_t *QV, *QUV, *L;
+	int16_t *QT;
+};
+
+template <typename P> static inline void gather3(const float *base, const uint32_t *index, P *out) {
+	for (int c = 0; c < 3; ++c)
+		out[c] = P::gather(base, index, 3, c);
+}
+
+template <typename P> static inline P dot3(const P *a, const P *b) {
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+/* Encode the P::Width vertices starting at 'first' */
+template <typename P> static void encodePacket(const EncodeArgs &args, uint32_t first) {
+	const int W = P::Width;
+	uint32_t index[W];
+	for (int k = 0; k < W; ++k)
+		index[k] = first + k;
+	float out[4][W];
+
+	/* Positions and texcoords */
+	P p[3], uv[3];
+	gather3(args.V, index, p);
+	gather3(args.UV, index, uv);
+	for (int c = 0; c < 3; ++c) {
+		((p[c] - P(args.positionMin[c])) * P(args.positionScale[c])).store(out[0]);
+		((uv[c] - P(args.texcoordMin[c])) * P(args.texcoordScale[c])).store(out[1]);
+		for (int k = 0; k < W; ++k) {
+			args.QV[3 * (first + k) + c] = quantizeUnsigned(out[0][k]);
+			args.QUV[3 * (first + k) + c] = quantizeUnsigned(out[1][k]);
+		}
+	}
+
+	/* Orthonormal frame (t, b, n) */
+	P n[3], dpdu[3], dpdv[3], t[3], b[3];
+	gather3(args.N, index, n);
+	gather3(args.DPDU, index, dpdu);
+	gather3(args.DPDV, index, dpdv);
+
+	P zero(0.0f), one(1.0f);
+	P length = sqrt(dot3(n, n));
+	typename P::Mask valid = lt(zero, length);
+	for (int c = 0; c < 3; ++c)
+		n[c] = select(valid, n[c] / select(valid, length, one), P(c == 2 ? 1.0f : 0.0f));
+
+	P projection = dot3(n, dpdu);
+	for (int c = 0; c < 3; ++c)
+		t[c] = dpdu[c] - n[c] * projection;
+	length = sqrt(dot3(t, t));
+	valid = lt(P(1e-20f), length);
+
+	/* Fallback tangent for a vanishing DPDU (Duff et al., "Building an orthonormal basis, revisited") */
+	P sign = select(lt(n[2], zero), P(-1.0f), one);
+	P a = -one / (sign + n[2]);
+	P fallback[3] = { one + sign * n[0] * n[0] * a, sign * n[0] * n[1] * a, -sign * n[0] };
+	for (int c = 0; c < 3; ++c)
+		t[c] = select(valid, t[c] / select(valid, length, one), fallback[c]);
+
+	b[0] = n[1] * t[2] - n[2] * t[1];
+	b[1] = n[2] * t[0] - n[0] * t[2];
+	b[2] = n[0] * t[1] - n[1] * t[0];
+
+	/* Quaternion of the rotation matrix with the columns t, b, n (Shepperd's method, branch free) */
+	P m00 = t[0], m10 = t[1], m20 = t[2], m01 = b[0], m11 = b[1], m21 = b[2], m02 = n[0], m12 = n[1], m22 = n[2];
+	P trace = m00 + m11 + m22, half(0.5f);
+
+	P sw = sqrt(max(one + trace, P(1e-12f))), iw = half / sw;
+	P qw[4] = { (m21 - m12) * iw, (m02 - m20) * iw, (m10 - m01) * iw, half * sw };
+	P sx = sqrt(max(one + m00 - m11 - m22, P(1e-12f))), ix = half / sx;
+	P qx[4] = { half * sx, (m01 + m10) * ix, (m02 + m20) * ix, (m21 - m12) * ix };
+	P sy = sqrt(max(one - m00 + m11 - m22, P(1e-12f))), iy = half / sy;
+	P qy[4] = { (m01 + m10) * iy, half * sy, (m12 + m21) * iy, (m02 - m20) * iy };
+	P sz = sqrt(max(one - m00 - m11 + m22, P(1e-12f))), iz = half / sz;
+	P qz[4] = { (m02 + m20) * iz, (m12 + m21) * iz, half * sz, (m10 - m01) * iz };
+
+	typename P::Mask xLargest = lt(trace, m00), yLargest = lt(max(trace, m00), m11), zLargest = lt(max(max(trace, m00), m11), m22);
+	P q[4];
+	for (int c = 0; c < 4; ++c)
+		q[c] = select(zLargest, qz[c], select(yLargest, qy[c], select(xLargest, qx[c], qw[c])));
+	length = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	P scale = select(lt(q[3], zero), -one, one) / length;
+	for (int c = 0; c < 4; ++c)
+		(q[c] * scale).store(out[c]);
+	for (int k = 0; k < W; ++k)
+		for (int c = 0; c < 4; ++c)
+			args.QT[4 * (first + k) + c] = quantizeSigned(out[c][k]);
+
+	/* Tangents in the frame: DPDU in the (t, n) plane by construction of t, DPDV in all three directions */
+	P component[TANGENT_COMPONENT_COUNT] = { dot3(t, dpdu), dot3(n, dpdu), dot3(t, dpdv), dot3(b, dpdv), dot3(n, dpdv) };
+	for (int i = 0; i < TANGENT_COMPONENT_COUNT; ++i) {
+		(component[i] * P(args.invTangentScale)).store(out[0]);
+		for (int k = 0; k < W; ++k)
+			args.L[TANGENT_COMPONENT_COUNT * (first + k) + i] = floatToHalf(out[0][k]);
+	}
+}
+
+template <typename P> static void encodeVertices(const EncodeArgs &args, uint32_t begin, uint32_t end) {
+	uint32_t v = begin;
+	for (; v + P::Width <= end; v += P::Width)
+		encodePacket<P>(args, v);
+	for (; v < end; ++v)
+		encodePacket<PacketScalar>(args, v);
+}
+
+void compressShellAttributes(const TetrahedronMesh &shell, CompressedShellAttributes &compressed) {
+	uint32_t vertexCount = shell.getVertexCount();
+	const MatrixXf &V = shell.V(), &UV = shell.UV(), &DPDU = shell.DPDU(), &DPDV = shell.DPDV();
+
+	/* Ranges */
+	ShellQuantization &quantization = compressed.quantization;
+	if (vertexCount > 0) {
+		Vector3f positionMin = V.rowwise().minCoeff(), texcoordMin = UV.rowwise().minCoeff();
+		quantization.positionMin = positionMin;
+		quantization.positionExtent = Vector3f(V.rowwise().maxCoeff()) - positionMin;
+		quantization.texcoordMin = texcoordMin;
+		quantization.texcoordExtent = Vector3f(UV.rowwise().maxCoeff()) - texcoordMin;
+		quantization.tangentScale = std::sqrt(std::max(DPDU.colwise().squaredNorm().maxCoeff(), DPDV.colwise().squaredNorm().maxCoeff()));
+	}
+	else {
+		quantization.positionMin = quantization.positionExtent = Vector3f::Zero();
+		quantization.texcoordMin = quantization.texcoordExtent = Vector3f::Zero();
+		quantization.tangentScale = 0.0f;
+	}
+
+	EncodeArgs args;
+	args.V = V.data(), args.UV = UV.data(), args.N = shell.N().data();
+	args.DPDU = DPDU.data(), args.DPDV = DPDV.data();
+	for (int c = 0; c < 3; ++c) {
+		args.positionMin[c] = quantization.positionMin[c];
+		args.positionScale[c] = quantization.positionExtent[c] > 0.0f ? 65535.0f / quantization.positionExtent[c] : 0.0f;
+		args.texcoordMin[c] = quantization.texcoordMin[c];
+		args.texcoordScale[c] = quantization.texcoordExtent[c] > 0.0f ? 65535.0f / quantization.texcoordExtent[c] : 0.0f;
+	}
+	args.invTangentScale = quantization.tangentScale > 0.0f ? 1.0f / quantization.tangentScale : 0.0f;
+
+	compressed.QV.resize(3, vertexCount);
+	compressed.QUV.resize(3, vertexCount);
+	compressed.QT.resize(4, vertexCount);
+	compressed.L.resize(TANGENT_COMPONENT_COUNT, vertexCount);
+	args.QV = compressed.QV.data(), args.QUV = compressed.QUV.data();
+	args.QT = compressed.QT.data(), args.L = compressed.L.data();
+
+	parallel_for(0u, vertexCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		encodeVertices<PacketDefault>(args, begin, end);
+	});
+}
+
+CompressedShellView compressedShellView(const CompressedShellAttributes &compressed) {
+	CompressedShellView view;
+	view.quantization = compressed.quantization;
+	view.QV = compressed.QV.data(), view.QUV = compressed.QUV.data();
+	view.QT = compressed.QT.data(), view.L = compressed.L.data();
+	view.vertexCount = compressed.getVertexCount();
+	return view;
+}
+
+struct DecodeArgs {
+	const uint16_t *QV, *QUV, *L;
+	const int16_t *QT;
+	float positionMin[3], positionStep[3], texcoordMin[3], texcoordStep[3], tangentScale;
+	float *V, *UV, *N, *DPDU, *DPDV;
+};
+
+/* Decode the P::Width vertices starting at 'first' */
+template <typename P> static void decodePacket(const DecodeArgs &args, uint32_t first) {
+	const int W = P::Width;
+	float in[4][W], out[3][W];
+
+	auto scatter3 = [&](P *value, float *base) {
+		for (int c = 0; c < 3; ++c)
+			value[c].store(out[c]);
+		for (int k = 0; k < W; ++k)
+			for (int c = 0; c < 3; ++c)
+				base[3 * (first + k) + c] = out[c][k];
+	};
+
+	/* Positions and texcoords */
+	P p[3], uv[3];
+	for (int c = 0; c < 3; ++c) {
+		for (int k = 0; k < W; ++k) {
+			in[0][k] = (float)args.QV[3 * (first + k) + c];
+			in[1][k] = (float)args.QUV[3 * (first + k) + c];
+		}
+		p[c] = P(args.positionMin[c]) + P::load(in[0]) * P(args.positionStep[c]);
+		uv[c] = P(args.texcoordMin[c]) + P::load(in[1]) * P(args.texcoordStep[c]);
+	}
+	scatter3(p, args.V);
+	scatter3(uv, args.UV);
+
+	/* Frame */
+	P q[4];
+	for (int c = 0; c < 4; ++c) {
+		for (int k = 0; k < W; ++k)
+			in[c][k] = (float)args.QT[4 * (first + k) + c];
+		q[c] = P::load(in[c]);
+	}
+	P length = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	P zero(0.0f), one(1.0f), two(2.0f);
+	P scale = select(lt(zero, length), one / select(lt(zero, length), length, one), zero);
+	P x = q[0] * scale, y = q[1] * scale, z = q[2] * scale, w = q[3] * scale;
+
+	P t[3] = { one - two * (y * y + z * z), two * (x * y + w * z), two * (x * z - w * y) };
+	P b[3] = { two * (x * y - w * z), one - two * (x * x + z * z), two * (y * z + w * x) };
+	P n[3] = { two * (x * z + w * y), two * (y * z - w * x), one - two * (x * x + y * y) };
+	scatter3(n, args.N);
+
+	P component[TANGENT_COMPONENT_COUNT];
+	for (int i = 0; i < TANGENT_COMPONENT_COUNT; ++i) {
+		for (int k = 0; k < W; ++k)
+			in[0][k] = halfToFloat(args.L[TANGENT_COMPONENT_COUNT * (first + k) + i]);
+		component[i] = P::load(in[0]) * P(args.tangentScale);
+	}
+	P dpdu[3], dpdv[3];
+	for (int c = 0; c < 3; ++c) {
+		dpdu[c] = t[c] * component[0] + n[c] * component[1];
+		dpdv[c] = t[c] * component[2] + b[c] * component[3] + n[c] * component[4];
+	}
+	scatter3(dpdu, args.DPDU);
+	scatter3(dpdv, args.DPDV);
+}
+
+template <typename P> static void decodeVertices(const DecodeArgs &args, uint32_t begin, uint32_t end) {
+	uint32_t v = begin;
+	for (; v + P::Width <= end; v += P::Width)
+		decodePacket<P>(args, v);
+	for (; v < end; ++v)
+		decodePacket<PacketScalar>(args, v);
+}
+
+void decompressShellAttributes(const CompressedShellView &compressed, TetrahedronMesh &shell) {
+	uint32_t vertexCount = compressed.vertexCount;
+	MatrixXf &V = shell.V(), &UV = shell.UV(), &N = shell.N(), &DPDU = shell.DPDU(), &DPDV = shell.DPDV();
+	V.resize(3, vertexCount), UV.resize(3, vertexCount), N.resize(3, vertexCount);
+	DPDU.resize(3, vertexCount), DPDV.resize(3, vertexCount);
+
+	const ShellQuantization &quantization = compressed.quantization;
+	DecodeArgs args;
+	args.QV = compressed.QV, args.QUV = compressed.QUV, args.QT = compressed.QT, args.L = compressed.L;
+	for (int c = 0; c < 3; ++c) {
+		args.positionMin[c] = quantization.positionMin[c];
+		args.positionStep[c] = quantization.positionExtent[c] / 65535.0f;
+		args.texcoordMin[c] = quantization.texcoordMin[c];
+		args.texcoordStep[c] = quantization.texcoordExtent[c] / 65535.0f;
+	}
+	args.tangentScale = quantization.tangentScale;
+	args.V = V.data(), args.UV = UV.data(), args.N = N.data(), args.DPDU = DPDU.data(), args.DPDV = DPDV.data();
+
+	parallel_for(0u, vertexCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		decodeVertices<PacketDefault>(args, begin, end);
+	});
+}
+
+ShellCompressionError measureCompressionError(const TetrahedronMesh &shell, const CompressedShellAttributes &compressed) {
+	TetrahedronMesh decoded;
+	decompressShellAttributes(compressedShellView(compressed), decoded);
+
+	uint32_t vertexCount = shell.getVertexCount();
+	uint32_t blockCount = (vertexCount + GRAIN_SIZE - 1) / GRAIN_SIZE;
+	struct Partial {
+		double maxPosition, sumPosition2, maxTexcoord, maxAngle, sumAngle, maxDpdu, maxDpdv;
+	};
+	std::vector<Partial> partials(blockCount);
+
+	/* Relative tangent errors are measured against at least 1e-3 of the largest tangent */
+	double minTangent = 1e-3 * compressed.quantization.tangentScale;
+
+	parallel_for(0u, vertexCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		Partial partial = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+		for (uint32_t v = begin; v < end; ++v) {
+			double position = (shell.V().col(v) - decoded.V().col(v)).norm();
+			partial.maxPosition = std::max(partial.maxPosition, position);
+			partial.sumPosition2 += position * position;
+			partial.maxTexcoord = std::max(partial.maxTexcoord, (double)(shell.UV().col(v) - decoded.UV().col(v)).cwiseAbs().maxCoeff());
+
+			Vector3f n = shell.N().col(v);
+			if (n.squaredNorm() > 0.0f) {
+				double cosine = std::min(1.0, std::max(-1.0, (double)n.normalized().dot(decoded.N().col(v))));
+				double angle = std::acos(cosine) * 180.0 / M_PI;
+				partial.maxAngle = std::max(partial.maxAngle, angle);
+				partial.sumAngle += angle;
+			}
+			partial.maxDpdu = std::max(partial.maxDpdu, (shell.DPDU().col(v) - decoded.DPDU().col(v)).norm() /
+				std::max((double)shell.DPDU().col(v).norm(), minTangent));
+			partial.maxDpdv = std::max(partial.maxDpdv, (shell.DPDV().col(v) - decoded.DPDV().col(v)).norm() /
+				std::max((double)shell.DPDV().col(v).norm(), minTangent));
+		}
+		partials[begin / GRAIN_SIZE] = partial;
+	});
+
+	ShellCompressionError error = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+	double sumPosition2 = 0.0, sumAngle = 0.0;
+	for (const Partial &partial : partials) {
+		error.maxPosition = std::max(error.maxPosition, partial.maxPosition);
+		error.maxTexcoord = std::max(error.maxTexcoord, partial.maxTexcoord);
+		error.maxNormalAngle = std::max(error.maxNormalAngle, partial.maxAngle);
+		error.maxDpduRelative = std::max(error.maxDpduRelative, partial.maxDpdu);
+		error.maxDpdvRelative = std::max(error.maxDpdvRelative, partial.maxDpdv);
+		sumPosition2 += partial.sumPosition2;
+		sumAngle += partial.sumAngle;
+	}
+	if (vertexCount > 0) {
+		error.rmsPosition = std::sqrt(sumPosition2 / vertexCount);
+		error.meanNormalAngle = sumAngle / vertexCount;
+	}
+	return error;
+}
+
+void printCompressionError(const ShellCompressionError &error) {
+	std::cout << "Compression error: position max " << error.maxPosition << " (rms " << error.rmsPosition
+		<< "), texcoord max " << error.maxTexcoord << ", normal max " << error.maxNormalAngle << " deg (mean "
+		<< error.meanNormalAngle << " deg), dpdu max " << error.maxDpduRelative * 100.0 << "%, dpdv max "
+		<< error.maxDpdvRelative * 100.0 << "%" << std::endl;
+}
@@ -0,0 +1,78 @@
+/*
+	compressedshell.h: Quantized shell vertex attributes
+
+	Per shell vertex 30 instead of 60 bytes:
+		position	3 x uint16, quantized in the bounding box of the shell
+		texcoord	3 x uint16, quantized in the bounding box of the texcoords
+		frame		4 x int16, "QTangent": unit quaternion (w >= 0) rotating (x, y, z) onto (t, b, n),
+					n = N / |N|, t = DPDU orthogonalized against n, b = n x t
+		tangents	5 x float16, the components of DPDU along t and n and of DPDV along t, b and n, divided
+					by tangentScale, the largest tangent length
+
+	Non-orthogonal parameterizations and tangents leaving the tangent plane, e.g. near the poles of a
+	UV sphere, keep their shape up to the half float precision. measureCompressionError() reports
+	the deviation.
+*/
+
+#pragma once
+
+#include "mycommon.h"
+#include "tetra.h"
+
+using nanogui::MatrixXf;
+using nanogui::Vector3f;
+
+/* Rows of CompressedShellAttributes::L */
+#define TANGENT_COMPONENT_COUNT 5
+
+/* Dequantization parameters, stored as the 3 x 5 float matrix [positionMin positionExtent texcoordMin texcoordExtent
+   (tangentScale, 0, 0)] */
+struct ShellQuantization {
+	Vector3f positionMin, positionExtent;
+	Vector3f texcoordMin, texcoordExtent;
+	float tangentScale;
+};
+
+struct CompressedShellAttributes {
+	ShellQuantization quantization;
+	MatrixXu16 QV;			// 3 x V
+	MatrixXu16 QUV;			// 3 x V
+	MatrixXi16 QT;			// 4 x V
+	MatrixXu16 L;			// 5 x V, half float tangent components
+
+	inline uint32_t getVertexCount() const { return (uint32_t)QV.cols(); }
+};
+
+/* Compressed attributes as pointers, e.g. into a mapped shell file */
+struct CompressedShellView {
+	ShellQuantization quantization;
+	const uint16_t *QV, *QUV;
+	const int16_t *QT;
+	const uint16_t *L;
+	uint32_t vertexCount;
+};
+
+struct ShellCompressionError {
+	double maxPosition, rmsPosition;			// absolute
+	double maxTexcoord;
+	double maxNormalAngle, meanNormalAngle;		// degrees
+	double maxDpduRelative, maxDpdvRelative;	// |error| / |DPDU| resp. |DPDV|
+};
+
+extern void compressShellAttributes(const TetrahedronMesh &shell, CompressedShellAttributes &compressed);
+
+extern CompressedShellView compressedShellView(const CompressedShellAttributes &compressed);
+
+/* Decode into V, UV, N, DPDU and DPDV of the shell, T is left untouched */
+extern void decompressShellAttributes(const CompressedShellView &compressed, TetrahedronMesh &shell);
+
+/* Decode the compressed attributes and compare them with the original */
+extern ShellCompressionError measureCompressionError(const TetrahedronMesh &shell, const CompressedShellAttributes &compressed);
+extern void printCompressionError(const ShellCompressionError &error);
+
+extern void packQuantization(const ShellQuantization &quantization, float *values);	// 15 floats
+extern ShellQuantization unpackQuantization(const float *values);
+
+/* IEEE 754 half precision conversions, rounding to nearest even */
+extern uint16_t floatToHalf(float value);
+extern float halfToFloat(uint16_t value);
@@ -0,0 +1,245 @@
+#include "cornerkernel.h"
+#include "cornerkernel.inl"
+#include "adjacenttriangles.h"
+#include "parallel.h"
+
+#if defined(SHELLMAPS_USE_AVX2) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(SHELLMAPS_USE_AVX2)
+/* Defined in cornerkernel_avx2.cpp */
+extern void cornerKernelAVX2(const CornerKernelArgs &args, uint32_t begin, uint32_t end, CornerKernelStats &stats);
+#endif
+
+static void cornerKernelDefault(const CornerKernelArgs &args, uint32_t begin, uint32_t end, CornerKernelStats &stats) {
+#if defined(SHELLMAPS_HAS_SSE2)
+	runCornerKernel<PacketSSE>(args, begin, end, stats);
+#else
+	runCornerKernel<PacketScalar>(args, begin, end, stats);
+#endif
+}
+
+#if defined(SHELLMAPS_USE_AVX2)
+static bool cpuSupportsAVX2() {
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	/* AVX has to be enabled by the OS (OSXSAVE and the YMM state in XCR0) */
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+#endif
+
+static CornerKernelFunction selectCornerKernel() {
+#if defined(SHELLMAPS_USE_AVX2)
+	static const bool avx2 = cpuSupportsAVX2();
+	if (avx2)
+		return cornerKernelAVX2;
+#endif
+	return cornerKernelDefault;
+}
+
+const char *cornerKernelInstructionSet() {
+	if (selectCornerKernel() != cornerKernelDefault)
+		return "AVX2";
+#if defined(SHELLMAPS_HAS_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
+
+void computeCornerAttributes(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV, CornerAttributes &attributes, bool angleWeight) {
+	uint32_t trianglesCount = F.cols();
+	bool tangents = UV.cols() > 0;
+
+	attributes.faceNormals.resize(3, trianglesCount);
+	attributes.cornerAngles.resize(3, trianglesCount);
+	attributes.normalWeights.resize(3, 3 * trianglesCount);
+	attributes.dpduWeights.resize(3, tangents ? 3 * trianglesCount : 0);
+	attributes.dpdvWeights.resize(3, tangents ? 3 * trianglesCount : 0);
+
+	CornerKernelArgs args;
+	args.F = F.data();
+	args.V = V.data();
+	args.UV = tangents ? UV.data() : nullptr;
+	args.faceNormals = attributes.faceNormals.data();
+	args.cornerAngles = attributes.cornerAngles.data();
+	args.normalWeights = attributes.normalWeights.data();
+	args.dpduWeights = attributes.dpduWeights.data();
+	args.dpdvWeights = attributes.dpdvWeights.data();
+	args.angleWeight = angleWeight;
+
+	CornerKernelFunction kernel = selectCornerKernel();
+	std::vector<CornerKernelStats> blockStats((trianglesCount + GRAIN_SIZE - 1) / GRAIN_SIZE);
+
+	parallel_for(0u, trianglesCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		CornerKernelStats &stats = blockStats[begin / GRAIN_SIZE];
+		stats.clear();
+		kernel(args, begin, end, stats);
+	});
+
+	/* Merge the statistics in block order, so they do not depend on the number of threads */
+	CornerKernelStats total;
+	total.clear();
+	for (const CornerKernelStats &stats : blockStats) {
+		for (int c = 0; c < 3; ++c) {
+			total.aabbMin[c] = std::min(total.aabbMin[c], stats.aabbMin[c]);
+			total.aabbMax[c] = std::max(total.aabbMax[c], stats.aabbMax[c]);
+			total.weightedCenter[c] += stats.weightedCenter[c];
+		}
+		total.edgeLengthSum += stats.edgeLengthSum;
+		total.minEdgeLength = std::min(total.minEdgeLength, stats.minEdgeLength);
+		total.maxEdgeLength = std::max(total.maxEdgeLength, stats.maxEdgeLength);
+		total.surfaceArea += stats.surfaceArea;
+		total.badFaces += stats.badFaces;
+	}
+
+	MeshStats &meshStats = attributes.stats;
+	meshStats = MeshStats();
+	meshStats.mAABB = AABB(Vector3f(total.aabbMin[0], total.aabbMin[1], total.aabbMin[2]),
+		Vector3f(total.aabbMax[0], total.aabbMax[1], total.aabbMax[2]));
+	meshStats.mSurfaceArea = total.surfaceArea;
+	meshStats.mWeightedCenter = Vector3f(
+		(float)(total.weightedCenter[0] / total.surfaceArea),
+		(float)(total.weightedCenter[1] / total.surfaceArea),
+		(float)(total.weightedCenter[2] / total.surfaceArea));
+	meshStats.mMinimumEdgeLength = total.minEdgeLength;
+	meshStats.mMaximumEdgeLength = total.maxEdgeLength;
+	meshStats.mAverageEdgeLength = total.edgeLengthSum / ((double)trianglesCount * 3);
+	attributes.badFaces = total.badFaces;
+}
+
+void computeVertexAttributes(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV,
+	MatrixXf &N, MatrixXf &DPDU, MatrixXf &DPDV, MeshStats &stats, bool angleWeight) {
+	std::cout << "--Computing vertex attributes (" << cornerKernelInstructionSet() << ") ..." << std::endl;
+
+	const float RCPOVERFLOW_FLT = 2.93873587705571876e-39f;
+
+	CornerAttributes attributes;
+	computeCornerAttributes(F, V, UV, attributes, angleWeight);
+	stats = attributes.stats;
+
+	/* Gather per vertex in ascending corner order, as in computeVertexNormals() and computeVertexTangents() */
+	uint32_t vertexCount = V.cols();
+	bool tangents = UV.cols() > 0;
+	std::vector<uint32_t> offsets, corners;
+	buildVertexCornerTable(F, vertexCount, offsets, corners);
+	N.resize(3, vertexCount);
+	DPDU.resize(3, tangents ? vertexCount : 0);
+	DPDV.resize(3, tangents ? vertexCount : 0);
+	std::atomic<uint32_t> unhandled(0);
+
+	parallel_for(0u, vertexCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		uint32_t localUnhandled = 0;
+		for (uint32_t v = begin; v < end; ++v) {
+			N.col(v).setZero();
+			for (uint32_t k = offsets[v]; k < offsets[v + 1]; ++k)
+				N.col(v) += attributes.normalWeights.col(corners[k]);
+
+			float norm = N.col(v).norm();
+			if (norm < RCPOVERFLOW_FLT)
+				N.col(v) = Vector3f::UnitX();
+			else
+				N.col(v) /= norm;
+
+			if (!tangents)
+				continue;
+
+			DPDU.col(v).setZero();
+			DPDV.col(v).setZero();
+			for (uint32_t k = offsets[v]; k < offsets[v + 1]; ++k) {
+				DPDU.col(v) += attributes.dpduWeights.col(corners[k]);
+				DPDV.col(v) += attributes.dpdvWeights.col(corners[k]);
+			}
+
+			norm = DPDU.col(v).norm();
+			if (norm < RCPOVERFLOW_FLT)
+				localUnhandled++;
+			else
+				DPDU.col(v) /= norm;
+
+			norm = DPDV.col(v).norm();
+			if (norm < RCPOVERFLOW_FLT)
+				localUnhandled++;
+			else
+				DPDV.col(v) /= norm;
+		}
+		unhandled += localUnhandled;
+	});
+
+	if (unhandled > 0)
+		std::cout << "unhandle case in computing tangent. (" << unhandled << " degenerate tangents)" << std::endl;
+	std::cout << "++Computing vertex attributes done. (";
+	if (attributes.badFaces > 0)
+		std::cout << attributes.badFaces << " degenerate faces.";
+	std::cout << ")" << std::endl;
+}
+
+#if !defined(NDEBUG)
+#include "normal.h"
+#include "tangent.h"
+
+/* Grid mesh of 6 x 6 vertices and 50 faces, i.e. whole packets and a remainder for every packet width, with
+	two coincident vertices collapsing two faces in whole packets, one face collapsing into a single point in
+	the remainder and a vertex whose texcoords make the UVs of its faces degenerate */
+static void degenerateTestMesh(MatrixXu &F, MatrixXf &V, MatrixXf &UV) {
+	using nanogui::Vector2f;
+	const uint32_t n = 6;
+	V.resize(3, n * n);
+	UV.resize(2, n * n);
+	for (uint32_t y = 0; y < n; ++y) {
+		for (uint32_t x = 0; x < n; ++x) {
+			V.col(y * n + x) = Vector3f((float)x, (float)y, 0.1f * (float)(x * y));
+			UV.col(y * n + x) = Vector2f(x / (float)(n - 1), y / (float)(n - 1));
+		}
+	}
+	F.resize(3, 2 * (n - 1) * (n - 1));
+	for (uint32_t y = 0, f = 0; y + 1 < n; ++y) {
+		for (uint32_t x = 0; x + 1 < n; ++x) {
+			uint32_t v = y * n + x;
+			F.col(f++) << v, v + 1, v + n + 1;
+			F.col(f++) << v, v + n + 1, v + n;
+		}
+	}
+	V.col(n + 2) = V.col(n + 1);
+	uint32_t last = (uint32_t)F.cols() - 1;
+	V.col(F(1, last)) = V.col(F(2, last)) = V.col(F(0, last));
+	UV.col(2 * n + 2) = UV.col(2 * n + 3);
+}
+
+bool checkCornerKernel() {
+	std::cout << "--Check corner kernel (" << cornerKernelInstructionSet() << ") against the serial passes ..." << std::endl;
+	MatrixXu F;
+	MatrixXf V, UV;
+	degenerateTestMesh(F, V, UV);
+
+	MatrixXf N, DPDU, DPDV, serialN, serialDPDU, serialDPDV;
+	MeshStats stats;
+	computeVertexAttributes(F, V, UV, N, DPDU, DPDV, stats, true);
+	computeVertexNormals(F, V, serialN, true);
+	computeVertexTangents(F, V, UV, serialDPDU, serialDPDV, true);
+
+	/* The serial tangents of the vertices of degenerate faces are NaN, the kernel leaves those faces out */
+	uint32_t mismatches = 0, nonFinite = 0;
+	for (uint32_t v = 0; v < (uint32_t)V.cols(); ++v) {
+		nonFinite += N.col(v).allFinite() && DPDU.col(v).allFinite() && DPDV.col(v).allFinite() ? 0 : 1;
+		mismatches += N.col(v) == serialN.col(v) ? 0 : 1;
+		if (serialDPDU.col(v).allFinite() && serialDPDV.col(v).allFinite())
+			mismatches += DPDU.col(v) == serialDPDU.col(v) && DPDV.col(v) == serialDPDV.col(v) ? 0 : 1;
+	}
+	bool passed = mismatches == 0 && nonFinite == 0;
+	std::cout << "++Check corner kernel " << (passed ? "passed" : "FAILED") << " (" << mismatches << " mismatching and "
+		<< nonFinite << " non-finite vertices)." << std::endl;
+	return passed;
+}
+#endif
@@ -0,0 +1,45 @@
+/*
+	cornerkernel.h: Fused per-corner pass computing normals, tangents and mesh statistics
+
+	The face normal, the corner angles, the angle weighted normal/tangent contributions and the
+	edge length, area and bounding box statistics all derive from the same three edge vectors per
+	face. The fused kernel reads F, V and UV once and processes 8 (AVX2), 4 (SSE2) or 1 face per
+	iteration. The AVX2 variant is only used if the CPU supports it.
+*/
+
+#pragma once
+
+#include "mycommon.h"
+#include "meshstats.h"
+
+using nanogui::MatrixXu;
+using nanogui::MatrixXf;
+
+struct CornerAttributes {
+	MatrixXf faceNormals;		// 3 x F, unit face normals (zero for degenerate faces)
+	MatrixXf cornerAngles;		// 3 x F, interior angle at corner i of face f (zero for degenerate faces)
+	MatrixXf normalWeights;		// 3 x 3F, normal contribution of corner i of face f in column 3 * f + i
+	MatrixXf dpduWeights;		// 3 x 3F, tangent contributions (empty without texture coordinates)
+	MatrixXf dpdvWeights;
+	MeshStats stats;
+	uint32_t badFaces;
+
+	CornerAttributes() : badFaces(0) { }
+};
+
+/* Run the fused kernel over all faces, UV may be empty */
+extern void computeCornerAttributes(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV, CornerAttributes &attributes, bool angleWeight = true);
+
+/* Vertex normals, tangents (only if UV is not empty) and mesh statistics in one pass over the faces,
+   matching computeVertexNormals(), computeVertexTangents() and computeMeshStats() */
+extern void computeVertexAttributes(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV,
+	MatrixXf &N, MatrixXf &DPDU, MatrixXf &DPDV, MeshStats &stats, bool angleWeight = true);
+
+/* Instruction set used by the fused kernel on this machine: "AVX2", "SSE2" or "scalar" */
+extern const char *cornerKernelInstructionSet();
+
+#if !defined(NDEBUG)
+/* Compare the kernel selected on this machine with computeVertexNormals() and computeVertexTangents() on a small mesh
+   with degenerate faces and texcoords, returns whether all results are finite and match. Debug builds only. */
+extern bool checkCornerKernel();
+#endif
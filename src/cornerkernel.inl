@@ -0,0 +1,236 @@
+/*
+	cornerkernel.inl: Fused per-corner kernel, written once over the packet types of simd.h
+
+	Included by cornerkernel.cpp (SSE2 / scalar) and cornerkernel_avx2.cpp (compiled with AVX2
+	enabled). Everything except the two plain structs below has internal linkage, including the
+	packets of simd.h, so the differently compiled instantiations can never be mixed up by the
+	linker. Do not include Eigen or other headers with inline functions here for the same reason.
+*/
+
+#pragma once
+
+#include "simd.h"
+
+/* Raw buffers of one fused pass, all matrices are column-major as in Eigen */
+struct CornerKernelArgs {
+	const uint32_t *F;		// 3 x F
+	const float *V;			// 3 x V
+	const float *UV;		// 2 x V, nullptr to skip the tangents
+	float *faceNormals;		// 3 x F
+	float *cornerAngles;	// 3 x F
+	float *normalWeights;	// 3 x 3F, column 3 * f + i belongs to vertex F(i, f)
+	float *dpduWeights;		// 3 x 3F, only written with UV
+	float *dpdvWeights;		// 3 x 3F, only written with UV
+	bool angleWeight;
+};
+
+/* Statistics of a range of faces, accumulated in face order */
+struct CornerKernelStats {
+	float aabbMin[3], aabbMax[3];
+	double edgeLengthSum, minEdgeLength, maxEdgeLength;
+	double surfaceArea, weightedCenter[3];
+	uint32_t badFaces;
+
+	void clear() {
+		const float inf = HUGE_VALF;
+		for (int c = 0; c < 3; ++c) {
+			aabbMin[c] = inf;
+			aabbMax[c] = -inf;
+			weightedCenter[c] = 0.0;
+		}
+		edgeLengthSum = surfaceArea = 0.0;
+		minEdgeLength = inf;
+		maxEdgeLength = 0.0;
+		badFaces = 0;
+	}
+};
+
+typedef void (*CornerKernelFunction)(const CornerKernelArgs &args, uint32_t begin, uint32_t end, CornerKernelStats &stats);
+
+namespace {
+
+/* Same summation order as Eigen's unrolled reduction of a 3-vector, x + (y + z) */
+template <typename P> inline P dot3(const P *a, const P *b) {
+	return a[0] * b[0] + (a[1] * b[1] + a[2] * b[2]);
+}
+
+template <typename P> inline void cross3(const P *a, const P *b, P *r) {
+	r[0] = a[1] * b[2] - a[2] * b[1];
+	r[1] = a[2] * b[0] - a[0] * b[2];
+	r[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+/* coordinate_system() of mycommon.h on plain floats, for the rare corners with degenerate UVs */
+inline void coordinateSystem(const float *a, float *b, float *c) {
+	if (fabsf(a[0]) > fabsf(a[1])) {
+		float invLen = 1.0f / sqrtf(a[0] * a[0] + a[2] * a[2]);
+		c[0] = a[2] * invLen; c[1] = 0.0f; c[2] = -a[0] * invLen;
+	}
+	else {
+		float invLen = 1.0f / sqrtf(a[1] * a[1] + a[2] * a[2]);
+		c[0] = 0.0f; c[1] = a[2] * invLen; c[2] = -a[1] * invLen;
+	}
+	b[0] = c[1] * a[2] - c[2] * a[1];
+	b[1] = c[2] * a[0] - c[0] * a[2];
+	b[2] = c[0] * a[1] - c[1] * a[0];
+}
+
+/* Process the P::Width faces starting at f. The vertex data of a face is read once, the three edge
+vectors are shared by the face normal, the corner angles, the tangents and the statistics. */
+template <typename P> inline void processCornerPacket(const CornerKernelArgs &args, uint32_t f, CornerKernelStats &stats) {
+	const int W = P::Width;
+	const float RCPOVERFLOW_FLT = 2.93873587705571876e-39f;
+
+	uint32_t index[3][W];
+	for (int k = 0; k < W; ++k)
+		for (int i = 0; i < 3; ++i)
+			index[i][k] = args.F[3 * (f + k) + i];
+
+	P v[3][3], e[3][3], ne[3][3], sq[3];
+	for (int i = 0; i < 3; ++i)
+		for (int c = 0; c < 3; ++c)
+			v[i][c] = P::gather(args.V, index[i], 3, c);
+
+	/* e[i] = v[i + 1] - v[i]; corner i spans d0 = e[i] and d1 = v[i + 2] - v[i] = -e[i + 2] */
+	for (int i = 0; i < 3; ++i) {
+		for (int c = 0; c < 3; ++c) {
+			e[i][c] = v[(i + 1) % 3][c] - v[i][c];
+			ne[i][c] = -e[i][c];
+		}
+		sq[i] = dot3(e[i], e[i]);
+	}
+
+	P fn[3], fnUnit[3];
+	cross3(e[0], ne[2], fn);
+	P fnNorm = sqrt(dot3(fn, fn));
+	typename P::Mask bad = lt(fnNorm, P(RCPOVERFLOW_FLT));
+	for (int c = 0; c < 3; ++c)
+		fnUnit[c] = select(bad, P(0.0f), fn[c] / fnNorm);
+
+	float buffer[3][W];
+	for (int c = 0; c < 3; ++c)
+		fnUnit[c].store(buffer[c]);
+	for (int k = 0; k < W; ++k)
+		for (int c = 0; c < 3; ++c)
+			args.faceNormals[3 * (f + k) + c] = buffer[c][k];
+
+	P uv[3][2], uve[3][2];
+	if (args.UV) {
+		for (int i = 0; i < 3; ++i)
+			for (int c = 0; c < 2; ++c)
+				uv[i][c] = P::gather(args.UV, index[i], 2, c);
+		for (int i = 0; i < 3; ++i)
+			for (int c = 0; c < 2; ++c)
+				uve[i][c] = uv[(i + 1) % 3][c] - uv[i][c];
+	}
+
+	for (int i = 0; i < 3; ++i) {
+		const P *d0 = e[i], *d1 = ne[(i + 2) % 3];
+
+		/* "Computing Vertex Normals from Polygonal Facets"
+		by Grit Thuermer and Charles A. Wuethrich, JGT 1998, Vol 3 */
+		P angle = packetFastAcos(dot3(d0, d1) / sqrt(sq[i] * sq[(i + 2) % 3]));
+		/* Degenerate faces contribute nothing, as in computeVertexNormals(); their angles may be NaN (0 / 0) and
+		0 * NaN would still be NaN */
+		angle = select(bad, P(0.0f), angle);
+		P weight = select(bad, P(0.0f), args.angleWeight ? angle : P(1.0f));
+
+		angle.store(buffer[0]);
+		for (int k = 0; k < W; ++k)
+			args.cornerAngles[3 * (f + k) + i] = buffer[0][k];
+
+		for (int c = 0; c < 3; ++c)
+			(fnUnit[c] * weight).store(buffer[c]);
+		for (int k = 0; k < W; ++k)
+			for (int c = 0; c < 3; ++c)
+				args.normalWeights[9 * (f + k) + 3 * i + c] = buffer[c][k];
+
+		if (!args.UV)
+			continue;
+
+		const P *dUV1 = uve[i];
+		P dUV2[2] = { -uve[(i + 2) % 3][0], -uve[(i + 2) % 3][1] };
+		P determinant = dUV1[0] * dUV2[1] - dUV1[1] * dUV2[0];
+		P invDet = P(1.0f) / determinant;
+
+		float dpdu[3][W], dpdv[3][W];
+		for (int c = 0; c < 3; ++c) {
+			(( dUV2[1] * d0[c] - dUV1[1] * d1[c]) * invDet).store(dpdu[c]);
+			((-dUV2[0] * d0[c] + dUV1[0] * d1[c]) * invDet).store(dpdv[c]);
+		}
+
+		/* Degenerate parameterization: tangents perpendicular to the geometric normal, crossed from the edges of
+		this corner as in computeVertexTangents() (the face normal of corner 0 may differ in the last bit) */
+		int degenerate = maskBits(eq(determinant, P(0.0f)));
+		if (degenerate) {
+			P cn[3];
+			cross3(d0, d1, cn);
+			float n[3][W], length[W];
+			for (int c = 0; c < 3; ++c)
+				cn[c].store(n[c]);
+			sqrt(dot3(cn, cn)).store(length);
+			for (int k = 0; k < W; ++k) {
+				if (!(degenerate & (1 << k)))
+					continue;
+				float a[3] = { n[0][k] / length[k], n[1][k] / length[k], n[2][k] / length[k] }, b[3], t[3];
+				coordinateSystem(a, b, t);
+				for (int c = 0; c < 3; ++c) {
+					dpdu[c][k] = b[c];
+					dpdv[c][k] = t[c];
+				}
+			}
+		}
+
+		/* The tangents of a degenerate face are NaN as well (zero edges or normal), so select instead of scaling */
+		for (int c = 0; c < 3; ++c) {
+			select(bad, P(0.0f), P::load(dpdu[c]) * weight).store(dpdu[c]);
+			select(bad, P(0.0f), P::load(dpdv[c]) * weight).store(dpdv[c]);
+		}
+		for (int k = 0; k < W; ++k) {
+			for (int c = 0; c < 3; ++c) {
+				args.dpduWeights[9 * (f + k) + 3 * i + c] = dpdu[c][k];
+				args.dpdvWeights[9 * (f + k) + 3 * i + c] = dpdv[c][k];
+			}
+		}
+	}
+
+	/* Statistics, folded lane by lane to keep the face order of a serial loop */
+	float edgeLength[3][W], area[W], center[3][W], lower[3][W], upper[3][W];
+	for (int i = 0; i < 3; ++i)
+		sqrt(sq[i]).store(edgeLength[i]);
+	(P(0.5f) * fnNorm).store(area);
+	for (int c = 0; c < 3; ++c) {
+		((v[0][c] + v[1][c] + v[2][c]) * P(1.0f / 3.0f)).store(center[c]);
+		min(min(v[0][c], v[1][c]), v[2][c]).store(lower[c]);
+		max(max(v[0][c], v[1][c]), v[2][c]).store(upper[c]);
+	}
+	for (int bits = maskBits(bad); bits; bits &= bits - 1)
+		stats.badFaces++;
+
+	for (int k = 0; k < W; ++k) {
+		for (int i = 0; i < 3; ++i) {
+			double length = edgeLength[i][k];
+			stats.edgeLengthSum += length;
+			if (length < stats.minEdgeLength) stats.minEdgeLength = length;
+			if (length > stats.maxEdgeLength) stats.maxEdgeLength = length;
+		}
+		double faceArea = area[k];
+		stats.surfaceArea += faceArea;
+		for (int c = 0; c < 3; ++c) {
+			stats.weightedCenter[c] += faceArea * center[c][k];
+			if (lower[c][k] < stats.aabbMin[c]) stats.aabbMin[c] = lower[c][k];
+			if (upper[c][k] > stats.aabbMax[c]) stats.aabbMax[c] = upper[c][k];
+		}
+	}
+}
+
+/* Whole packets of the range, the remaining faces one by one */
+template <typename P> void runCornerKernel(const CornerKernelArgs &args, uint32_t begin, uint32_t end, CornerKernelStats &stats) {
+	uint32_t f = begin;
+	for (; f + P::Width <= end; f += P::Width)
+		processCornerPacket<P>(args, f, stats);
+	for (; f < end; ++f)
+		processCornerPacket<PacketScalar>(args, f, stats);
+}
+
+}
@@ -0,0 +1,14 @@
+/*
+	cornerkernel_avx2.cpp: AVX2 instantiation of the fused per-corner kernel
+
+	This is the only file compiled with AVX2 enabled (SHELLMAPS_USE_AVX2), it must not include
+	anything but cornerkernel.inl. cornerkernel.cpp only calls it after checking the CPU.
+*/
+
+#include "cornerkernel.inl"
+
+#if defined(SHELLMAPS_HAS_AVX2)
+void cornerKernelAVX2(const CornerKernelArgs &args, uint32_t begin, uint32_t end, CornerKernelStats &stats) {
+	runCornerKernel<PacketAVX2>(args, begin, end, stats);
+}
+#endif
@@ -0,0 +1,396 @@
+/*
+	floatformat.cpp: Shortest round-trip float formatting
+
+	The digit generation follows Ryu (Ulf Adams, "Ryu: fast float-to-string conversion", PLDI 2018)
+	for 32 bit floats. The tables hold 5^-i and 5^i scaled to 59/61 significant bits and were
+	generated with Python from their definition:
+		FLOAT_POW5_INV_SPLIT[i] = floor(2^(pow5bits(i) - 1 + 59) / 5^i) + 1
+		FLOAT_POW5_SPLIT[i] = floor(5^i / 2^(pow5bits(i) - 61))
+
+	Parsing uses the classic fast path (Clinger): a decimal mantissa below 2^53 and a power of ten
+	up to 10^22 are both exact doubles, so one multiplication or division rounds correctly. Rounding
+	that double to float is exact unless it lands on the midpoint of two floats, these cases and all
+	longer numbers go through strtof.
+*/
+
+#include "floatformat.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#define FLOAT_MANTISSA_BITS 23
+#define FLOAT_EXPONENT_BITS 8
+#define FLOAT_BIAS 127
+#define FLOAT_POW5_INV_BITCOUNT 59
+#define FLOAT_POW5_BITCOUNT 61
+
+static const uint64_t FLOAT_POW5_INV_SPLIT[31] = {
+	576460752303423489ull, 461168601842738791ull, 368934881474191033ull,
+	295147905179352826ull, 472236648286964522ull, 377789318629571618ull,
+	302231454903657294ull, 483570327845851670ull, 386856262276681336ull,
+	309485009821345069ull, 495176015714152110ull, 396140812571321688ull,
+	316912650057057351ull, 507060240091291761ull, 405648192073033409ull,
+	324518553658426727ull, 519229685853482763ull, 415383748682786211ull,
+	332306998946228969ull, 531691198313966350ull, 425352958651173080ull,
+	340282366920938464ull, 544451787073501542ull, 435561429658801234ull,
+	348449143727040987ull, 557518629963265579ull, 446014903970612463ull,
+	356811923176489971ull, 570899077082383953ull, 456719261665907162ull,
+	365375409332725730ull,
+};
+
+static const uint64_t FLOAT_POW5_SPLIT[47] = {
+	1152921504606846976ull, 1441151880758558720ull, 1801439850948198400ull,
+	2251799813685248000ull, 1407374883553280000ull, 1759218604441600000ull,
+	2199023255552000000ull, 1374389534720000000ull, 1717986918400000000ull,
+	2147483648000000000ull, 1342177280000000000ull, 1677721600000000000ull,
+	2097152000000000000ull, 1310720000000000000ull, 1638400000000000000ull,
+	2048000000000000000ull, 1280000000000000000ull, 1600000000000000000ull,
+	2000000000000000000ull, 1250000000000000000ull, 1562500000000000000ull,
+	1953125000000000000ull, 1220703125000000000ull, 1525878906250000000ull,
+	1907348632812500000ull, 1192092895507812500ull, 1490116119384765625ull,
+	1862645149230957031ull, 1164153218269348144ull, 1455191522836685180ull,
+	1818989403545856475ull, 2273736754432320594ull, 1421085471520200371ull,
+	1776356839400250464ull, 2220446049250313080ull, 1387778780781445675ull,
+	1734723475976807094ull, 2168404344971008868ull, 1355252715606880542ull,
+	1694065894508600678ull, 2117582368135750847ull, 1323488980084844279ull,
+	1654361225106055349ull, 2067951531382569187ull, 1292469707114105741ull,
+	1615587133892632177ull, 2019483917365790221ull,
+};
+
+/* ceil(log2(5^e)) for e > 0, 1 for e = 0 */
+static inline int32_t pow5bits(int32_t e) {
+	return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+/* floor(log10(2^e)) */
+static inline uint32_t log10Pow2(int32_t e) {
+	return ((uint32_t)e * 78913) >> 18;
+}
+
+/* floor(log10(5^e)) */
+static inline uint32_t log10Pow5(int32_t e) {
+	return ((uint32_t)e * 732923) >> 20;
+}
+
+static inline uint32_t pow5Factor(uint32_t value) {
+	uint32_t count = 0;
+	while (value % 5 == 0) {
+		value /= 5;
+		++count;
+	}
+	return count;
+}
+
+static inline bool multipleOfPowerOf5(uint32_t value, uint32_t p) {
+	return pow5Factor(value) >= p;
+}
+
+static inline bool multipleOfPowerOf2(uint32_t value, uint32_t p) {
+	return (value & ((1u << p) - 1)) == 0;
+}
+
+static inline uint32_t mulShift(uint32_t m, uint64_t factor, int32_t shift) {
+	uint64_t bits0 = (uint64_t)m * (uint32_t)factor;
+	uint64_t bits1 = (uint64_t)m * (uint32_t)(factor >> 32);
+	return (uint32_t)(((bits0 >> 32) + bits1) >> (shift - 32));
+}
+
+/* Shortest decimal mantissa * 10^exponent which rounds back to the float with the given bits */
+static void shortestDecimal(uint32_t ieeeMantissa, uint32_t ieeeExponent, uint32_t &mantissa, int32_t &exponent) {
+	int32_t e2;
+	uint32_t m2;
+	if (ieeeExponent == 0) {
+		e2 = 1 - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+		m2 = ieeeMantissa;
+	}
+	else {
+		e2 = (int32_t)ieeeExponent - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+		m2 = (1u << FLOAT_MANTISSA_BITS) | ieeeMantissa;
+	}
+	bool acceptBounds = (m2 & 1) == 0;
+
+	/* Interval of all decimals rounding to this float, scaled by 4 */
+	uint32_t mv = 4 * m2, mp = 4 * m2 + 2;
+	uint32_t mmShift = ieeeMantissa != 0 || ieeeExponent <= 1;
+	uint32_t mm = 4 * m2 - 1 - mmShift;
+
+	uint32_t vr, vp, vm;
+	int32_t e10;
+	bool vmIsTrailingZeros = false, vrIsTrailingZeros = false;
+	uint8_t lastRemovedDigit = 0;
+
+	if (e2 >= 0) {
+		uint32_t q = log10Pow2(e2);
+		e10 = (int32_t)q;
+		int32_t k = FLOAT_POW5_INV_BITCOUNT + pow5bits((int32_t)q) - 1;
+		int32_t i = -e2 + (int32_t)q + k;
+		vr = mulShift(mv, FLOAT_POW5_INV_SPLIT[q], i);
+		vp = mulShift(mp, FLOAT_POW5_INV_SPLIT[q], i);
+		vm = mulShift(mm, FLOAT_POW5_INV_SPLIT[q], i);
+		if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+			int32_t l = FLOAT_POW5_INV_BITCOUNT + pow5bits((int32_t)(q - 1)) - 1;
+			lastRemovedDigit = (uint8_t)(mulShift(mv, FLOAT_POW5_INV_SPLIT[q - 1], -e2 + (int32_t)q - 1 + l) % 10);
+		}
+		if (q <= 9) {
+			/* Only one of mp, mv and mm can be a multiple of 5 */
+			if (mv % 5 == 0)
+				vrIsTrailingZeros = multipleOfPowerOf5(mv, q);
+			else if (acceptBounds)
+				vmIsTrailingZeros = multipleOfPowerOf5(mm, q);
+			else
+				vp -= multipleOfPowerOf5(mp, q);
+		}
+	}
+	else {
+		uint32_t q = log10Pow5(-e2);
+		e10 = (int32_t)q + e2;
+		int32_t i = -e2 - (int32_t)q;
+		int32_t k = pow5bits(i) - FLOAT_POW5_BITCOUNT;
+		int32_t j = (int32_t)q - k;
+		vr = mulShift(mv, FLOAT_POW5_SPLIT[i], j);
+		vp = mulShift(mp, FLOAT_POW5_SPLIT[i], j);
+		vm = mulShift(mm, FLOAT_POW5_SPLIT[i], j);
+		if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+			j = (int32_t)q - 1 - (pow5bits(i + 1) - FLOAT_POW5_BITCOUNT);
+			lastRemovedDigit = (uint8_t)(mulShift(mv, FLOAT_POW5_SPLIT[i + 1], j) % 10);
+		}
+		if (q <= 1) {
+			/* mv = 4 * m2 always has two trailing zero bits, mm has one iff mmShift == 1 */
+			vrIsTrailingZeros = true;
+			if (acceptBounds)
+				vmIsTrailingZeros = mmShift == 1;
+			else
+				--vp;
+		}
+		else if (q < 31) {
+			vrIsTrailingZeros = multipleOfPowerOf2(mv, q - 1);
+		}
+	}
+
+	/* Remove digits while the interval still contains a shorter decimal */
+	int32_t removed = 0;
+	if (vmIsTrailingZeros || vrIsTrailingZeros) {
+		while (vp / 10 > vm / 10) {
+			vmIsTrailingZeros &= vm % 10 == 0;
+			vrIsTrailingZeros &= lastRemovedDigit == 0;
+			lastRemovedDigit = (uint8_t)(vr % 10);
+			vr /= 10, vp /= 10, vm /= 10;
+			++removed;
+		}
+		if (vmIsTrailingZeros) {
+			while (vm % 10 == 0) {
+				vrIsTrailingZeros &= lastRemovedDigit == 0;
+				lastRemovedDigit = (uint8_t)(vr % 10);
+				vr /= 10, vp /= 10, vm /= 10;
+				++removed;
+			}
+		}
+		/* Round half to even if the exact value is ...50..0 */
+		if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0)
+			lastRemovedDigit = 4;
+		mantissa = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) || lastRemovedDigit >= 5);
+	}
+	else {
+		while (vp / 10 > vm / 10) {
+			lastRemovedDigit = (uint8_t)(vr % 10);
+			vr /= 10, vp /= 10, vm /= 10;
+			++removed;
+		}
+		mantissa = vr + (vr == vm || lastRemovedDigit >= 5);
+	}
+	exponent = e10 + removed;
+}
+
+static inline int decimalLength(uint32_t v) {
+	int length = 1;
+	while (v >= 10) {
+		v /= 10;
+		++length;
+	}
+	return length;
+}
+
+int formatFloat(float value, char *buffer) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(float));
+	uint32_t ieeeMantissa = bits & ((1u << FLOAT_MANTISSA_BITS) - 1);
+	uint32_t ieeeExponent = (bits >> FLOAT_MANTISSA_BITS) & ((1u << FLOAT_EXPONENT_BITS) - 1);
+	bool sign = (bits >> 31) != 0;
+
+	char *out = buffer;
+	if (ieeeExponent == (1u << FLOAT_EXPONENT_BITS) - 1) {
+		if (ieeeMantissa) {
+			memcpy(out, "nan", 3);
+			return 3;
+		}
+		if (sign) *out++ = '-';
+		memcpy(out, "inf", 3);
+		return (int)(out - buffer) + 3;
+	}
+	if (sign) *out++ = '-';
+	if (ieeeExponent == 0 && ieeeMantissa == 0) {
+		*out++ = '0';
+		return (int)(out - buffer);
+	}
+
+	uint32_t mantissa;
+	int32_t exponent;
+	shortestDecimal(ieeeMantissa, ieeeExponent, mantissa, exponent);
+
+	char digits[10];
+	int length = decimalLength(mantissa);
+	for (int i = length - 1; i >= 0; --i, mantissa /= 10)
+		digits[i] = (char)('0' + mantissa % 10);
+
+	/* Position of the decimal point relative to the first digit */
+	int point = length + exponent;
+	if (exponent >= 0 && point <= 9) {
+		/* 123, 1200 */
+		memcpy(out, digits, length), out += length;
+		for (int i = 0; i < exponent; ++i) *out++ = '0';
+	}
+	else if (point > 0 && exponent < 0) {
+		/* 12.345 */
+		memcpy(out, digits, point), out += point;
+		*out++ = '.';
+		memcpy(out, digits + point, length - point), out += length - point;
+	}
+	else if (point <= 0 && point > -5) {
+		/* 0.00123 */
+		*out++ = '0', *out++ = '.';
+		for (int i = point; i < 0; ++i) *out++ = '0';
+		memcpy(out, digits, length), out += length;
+	}
+	else {
+		/* 1.2345e-07, 1e+20 */
+		*out++ = digits[0];
+		if (length > 1) {
+			*out++ = '.';
+			memcpy(out, digits + 1, length - 1), out += length - 1;
+		}
+		int e = point - 1;
+		*out++ = 'e';
+		*out++ = e < 0 ? '-' : '+';
+		if (e < 0) e = -e;
+		if (e >= 100) *out++ = (char)('0' + e / 100);
+		*out++ = (char)('0' + e / 10 % 10);
+		*out++ = (char)('0' + e % 10);
+	}
+	return (int)(out - buffer);
+}
+
+int formatUInt(uint32_t value, char *buffer) {
+	char digits[10];
+	int length = 0;
+	do {
+		digits[length++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value);
+	for (int i = 0; i < length; ++i)
+		buffer[i] = digits[length - 1 - i];
+	return length;
+}
+
+static const double DOUBLE_POW10[23] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static const char *parseFloatSlow(const char *str, const char *end, float &value) {
+	char buffer[64];
+	size_t length = std::min<size_t>((size_t)(end - str), sizeof(buffer) - 1);
+	memcpy(buffer, str, length);
+	buffer[length] = '\0';
+
+	char *last = nullptr;
+	value = strtof(buffer, &last);
+	if (last == buffer)
+		return nullptr;
+	return str + (last - buffer);
+}
+
+const char *parseFloat(const char *str, const char *end, float &value) {
+	const char *p = str;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	/* Up to 19 significant digits fit into the mantissa */
+	uint64_t mantissa = 0;
+	int32_t exponent = 0, significant = 0, digits = 0;
+	for (; p < end && isDigit(*p); ++p, ++digits) {
+		if (significant < 19) {
+			mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+			if (mantissa) ++significant;
+		}
+		else {
+			++exponent;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (++p; p < end && isDigit(*p); ++p, ++digits) {
+			if (significant < 19) {
+				mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+				if (mantissa) ++significant;
+				--exponent;
+			}
+		}
+	}
+	/* inf, nan, hexadecimal numbers */
+	if (digits == 0)
+		return parseFloatSlow(str, end, value);
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool negativeExponent = false;
+		if (q < end && (*q == '-' || *q == '+'))
+			negativeExponent = *q++ == '-';
+		if (q < end && isDigit(*q)) {
+			int32_t e = 0;
+			for (; q < end && isDigit(*q); ++q)
+				e = std::min(e * 10 + (*q - '0'), 100000);
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
+
+	if (mantissa == 0) {
+		value = negative ? -0.0f : 0.0f;
+		return p;
+	}
+	if (significant >= 19 || mantissa > (1ull << 53) || exponent < -22 || exponent > 22)
+		return parseFloatSlow(str, end, value);
+
+	double d = (double)mantissa;
+	d = exponent < 0 ? d / DOUBLE_POW10[-exponent] : d * DOUBLE_POW10[exponent];
+
+	float f = (float)d;
+	if ((double)f != d) {
+		/* The sum of two neighbouring floats is exact in double precision */
+		float other = nextafterf(f, d > (double)f ? HUGE_VALF : -HUGE_VALF);
+		if (std::isinf(f) || ((double)f + (double)other) * 0.5 == d)
+			return parseFloatSlow(str, end, value);
+	}
+	value = negative ? -f : f;
+	return p;
+}
+
+const char *parseUInt(const char *str, const char *end, uint32_t &value) {
+	const char *p = str;
+	uint64_t result = 0;
+	for (; p < end && isDigit(*p); ++p) {
+		result = result * 10 + (uint64_t)(*p - '0');
+		if (result > 0xFFFFFFFFull)
+			return nullptr;
+	}
+	if (p == str)
+		return nullptr;
+	value = (uint32_t)result;
+	return p;
+}
@@ -0,0 +1,26 @@
+/*
+	floatformat.h: Fast number <-> text conversion for the text input and output formats
+
+	formatFloat() writes the shortest decimal string which parses back to exactly the same float
+	(fixed notation for moderate exponents, otherwise d.ddde[+-]XX), so text files keep the full
+	precision of the data while staying readable by fscanf/strtof/iostream based readers.
+
+	parseFloat() is the reverse for the mesh loaders: it gives the correctly rounded result of
+	strtof, but handles the common short decimal numbers without a locale aware library call.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/* Maximum number of characters written by formatFloat(), e.g. "-1.2345678e-38" */
+#define FLOAT_FORMAT_MAX_LENGTH 16
+
+/* Both return the number of characters written to buffer, no terminating zero is appended */
+extern int formatFloat(float value, char *buffer);
+extern int formatUInt(uint32_t value, char *buffer);
+
+/* Parse a number from [str, end), no leading whitespace is skipped. Return the first character after
+   the number or nullptr if there is no valid number at str */
+extern const char *parseFloat(const char *str, const char *end, float &value);
+extern const char *parseUInt(const char *str, const char *end, uint32_t &value);
@@ -0,0 +1,96 @@
+#include "heightmap.h"
+#include "parallel.h"
+
+/* A private copy of the implementation, nanovg compiles its own into the nanogui library */
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+void loadHeightMap(const std::string &filename, MatrixXf &heights) {
+	std::cout << "--Load height map \"" << filename << "\" ..." << std::endl;
+	int width = 0, height = 0, channels = 0;
+	if (stbi_is_hdr(filename.c_str())) {
+		float *data = stbi_loadf(filename.c_str(), &width, &height, &channels, 1);
+		if (!data)
+			throw std::runtime_error("Could not load height map \"" + filename + "\": " + stbi_failure_reason());
+		heights = Eigen::Map<MatrixXf>(data, width, height);
+		stbi_image_free(data);
+	}
+	else {
+		stbi_uc *data = stbi_load(filename.c_str(), &width, &height, &channels, 1);
+		if (!data)
+			throw std::runtime_error("Could not load height map \"" + filename + "\": " + stbi_failure_reason());
+		heights = Eigen::Map<Eigen::Matrix<stbi_uc, Eigen::Dynamic, Eigen::Dynamic>>(data, width, height).cast<float>() / 255.0f;
+		stbi_image_free(data);
+	}
+	std::cout << "++Load height map done (" << width << " x " << height << ", heights between " << heights.minCoeff()
+		<< " and " << heights.maxCoeff() << ")." << std::endl;
+}
+
+static inline float texelHeight(const MatrixXf &heights, float x, float y) {
+	int ix = std::min(std::max((int)std::floor(x), 0), (int)heights.rows() - 1);
+	int iy = std::min(std::max((int)std::floor(y), 0), (int)heights.cols() - 1);
+	return heights(ix, iy);
+}
+
+/* Maximum height over the texels overlapped by the triangle (a, b, c) given in texels */
+static float footprintHeight(const MatrixXf &heights, const Vector2f &a, const Vector2f &b, const Vector2f &c) {
+	float result = std::max(std::max(texelHeight(heights, a.x(), a.y()), texelHeight(heights, b.x(), b.y())),
+		texelHeight(heights, c.x(), c.y()));
+
+	float area = (b - a).x() * (c - a).y() - (b - a).y() * (c - a).x();
+	if (area == 0.0f)
+		return result;
+	float sign = area > 0.0f ? 1.0f : -1.0f;
+	/* A texel overlaps the triangle iff the corner furthest inside each edge is inside, which is its center
+		moved by half the L1 norm of the edge */
+	auto inside = [sign](const Vector2f &p, const Vector2f &q, float x, float y) {
+		Vector2f e = q - p;
+		return sign * (e.x() * (y - p.y()) - e.y() * (x - p.x())) + 0.5f * (std::abs(e.x()) + std::abs(e.y())) >= 0.0f;
+	};
+
+	int xMin = std::max((int)std::floor(std::min(std::min(a.x(), b.x()), c.x())), 0);
+	int yMin = std::max((int)std::floor(std::min(std::min(a.y(), b.y()), c.y())), 0);
+	int xMax = std::min((int)std::floor(std::max(std::max(a.x(), b.x()), c.x())), (int)heights.rows() - 1);
+	int yMax = std::min((int)std::floor(std::max(std::max(a.y(), b.y()), c.y())), (int)heights.cols() - 1);
+	for (int y = yMin; y <= yMax; ++y) {
+		float cy = y + 0.5f;
+		for (int x = xMin; x <= xMax; ++x) {
+			float cx = x + 0.5f;
+			if (heights(x, y) > result && inside(a, b, cx, cy) && inside(b, c, cx, cy) && inside(c, a, cx, cy))
+				result = heights(x, y);
+		}
+	}
+	return result;
+}
+
+float footprintMaximum(const MatrixXf &heights, const Vector2f &a, const Vector2f &b, const Vector2f &c) {
+	/* Image rows go from v = 1 down to v = 0 */
+	Vector2f scale((float)heights.rows(), -(float)heights.cols()), shift(0.0f, (float)heights.cols());
+	return footprintHeight(heights, a.cwiseProduct(scale) + shift, b.cwiseProduct(scale) + shift, c.cwiseProduct(scale) + shift);
+}
+
+void computeHeightMapOffsets(const MatrixXu &F, const MatrixXf &UV, const MatrixXf &heights, float offset, VectorXf &offsets) {
+	std::cout << "--Compute offsets from the height map ..." << std::endl;
+	if (heights.size() == 0)
+		throw std::runtime_error("computeHeightMapOffsets(): empty height map");
+	if (UV.cols() == 0)
+		throw std::runtime_error("computeHeightMapOffsets(): the mesh has no texture coordinates");
+	uint32_t faceCount = (uint32_t)F.cols(), vertexCount = (uint32_t)UV.cols();
+
+	VectorXf faceHeights(faceCount);
+	parallel_for(0u, faceCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t f = begin; f < end; ++f)
+			faceHeights(f) = footprintMaximum(heights, UV.col(F(0, f)).head<2>(), UV.col(F(1, f)).head<2>(), UV.col(F(2, f)).head<2>());
+	});
+
+	offsets.setConstant(vertexCount, HEIGHT_MAP_MINIMUM_HEIGHT);
+	for (uint32_t f = 0; f < faceCount; ++f)
+		for (int i = 0; i < 3; ++i)
+			offsets(F(i, f)) = std::max(offsets(F(i, f)), faceHeights(f));
+	offsets *= offset;
+
+	std::cout << "++Compute offsets from the height map done (between " << (vertexCount > 0 ? offsets.minCoeff() : 0.0f)
+		<< " and " << (vertexCount > 0 ? offsets.maxCoeff() : 0.0f) << ", mean " << (vertexCount > 0 ? offsets.mean() : 0.0f)
+		<< ")." << std::endl;
+}
@@ -0,0 +1,41 @@
+/*
+	heightmap.h: Per vertex offsets following the height of the shell content
+
+	A uniform offset has to fit the highest content anywhere on the garment, which leaves most prisms
+	mostly empty. With a height image over the UV domain (0 = base surface, 1 = full offset) each vertex
+	instead gets the highest value its incident UV triangles cover:
+
+	- Per face, the maximum over the texels its UV triangle overlaps, including those it covers only
+	  partly, so that triangles smaller than a texel still see the content.
+	- Per vertex, the maximum over the incident faces, so that the prism over every face reaches above
+	  the content within its footprint.
+
+	Images are loaded with the stb_image copy vendored with nanovg as a single grey channel: stb_image
+	converts color images to luminance (HDR images: the mean of RGB) and drops alpha. 8 bit images are
+	mapped to [0, 1], HDR images keep their values.
+*/
+
+#pragma once
+
+#include "mycommon.h"
+
+using nanogui::MatrixXu;
+using nanogui::MatrixXf;
+using nanogui::Vector2f;
+using Eigen::VectorXf;
+
+/* Lowest height used for a vertex, relative to the full offset, to keep the prisms over empty regions from
+	collapsing into the base surface */
+#define HEIGHT_MAP_MINIMUM_HEIGHT 0.01f
+
+/* Load an image as a width x height matrix of grey values, heights(x, y) with y = 0 being the top row; color images
+	are converted to luminance by stb_image (HDR images: the mean of RGB) */
+extern void loadHeightMap(const std::string &filename, MatrixXf &heights);
+
+/* Maximum of heights over the texels overlapped by the triangle with texcoords (a, b, c), including those it covers only
+	partly; v = 1 is the top row of the image and texcoords outside [0, 1] are clamped */
+extern float footprintMaximum(const MatrixXf &heights, const Vector2f &a, const Vector2f &b, const Vector2f &c);
+
+/* Compute offsets(v) = offset * max(h(v), HEIGHT_MAP_MINIMUM_HEIGHT) for every vertex of the base mesh F with texcoords
+	UV in [0, 1], h(v) being the maximum of heights over the UV triangles around v. v = 1 is the top row of the image. */
+extern void computeHeightMapOffsets(const MatrixXu &F, const MatrixXf &UV, const MatrixXf &heights, float offset, VectorXf &offsets);
@@ -0,0 +1,57 @@
+#include "implicitshell.h"
+#include "parallel.h"
+
+void ImplicitShell::set(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV, const MatrixXf &N, const MatrixXf &DPDU,
+	const MatrixXf &DPDV, const VectorXf &offsets, const MatrixXu &P) {
+	uint32_t baseCount = (uint32_t)V.cols(), faceCount = (uint32_t)F.cols();
+	if (UV.cols() != baseCount || N.cols() != baseCount || DPDU.cols() != baseCount || DPDV.cols() != baseCount ||
+		offsets.size() != baseCount || P.cols() != faceCount)
+		throw std::runtime_error("ImplicitShell::set(): inconsistent input sizes!");
+
+	mF = F;
+	mV = V, mUV = UV, mN = N;
+	mDPDU = DPDU, mDPDV = DPDV;
+	mOffsets = offsets;
+
+	mPatterns.resize(faceCount);
+	parallel_for(0u, faceCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t f = begin; f < end; ++f) {
+			PackedPattern packed = 0;
+			for (int i = 0; i < 3; ++i)
+				packed |= (PackedPattern)(std::min<uint32_t>(P(i, f), 3u) << (2 * i));
+			mPatterns[f] = packed;
+		}
+	});
+}
+
+void ImplicitShell::set(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV, const MatrixXf &N, const MatrixXf &DPDU,
+	const MatrixXf &DPDV, float offset, const MatrixXu &P) {
+	set(F, V, UV, N, DPDU, DPDV, VectorXf::Constant(V.cols(), offset), P);
+}
+
+size_t ImplicitShell::memoryUsage() const {
+	return sizeof(uint32_t) * (size_t)mF.size() + sizeof(float) * (size_t)(mV.size() + mUV.size() + mN.size() +
+		mDPDU.size() + mDPDV.size() + mOffsets.size()) + sizeof(PackedPattern) * mPatterns.size();
+}
+
+void ImplicitShell::toTetrahedronMesh(TetrahedronMesh &shell) const {
+	uint32_t vertexCount = getVertexCount(), tetrahedronCount = getTetrahedronCount();
+	shell.resize(vertexCount, tetrahedronCount);
+	MatrixXf &V = shell.V(), &UV = shell.UV(), &N = shell.N(), &DPDU = shell.DPDU(), &DPDV = shell.DPDV();
+	MatrixXu &T = shell.T();
+
+	parallel_for(0u, vertexCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t v = begin; v < end; ++v) {
+			V.col(v) = position(v);
+			UV.col(v) = texcoord(v);
+			N.col(v) = normal(v);
+			DPDU.col(v) = dpdu(v);
+			DPDV.col(v) = dpdv(v);
+		}
+	});
+
+	parallel_for(0u, tetrahedronCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t t = begin; t < end; ++t)
+			T.col(t) = tetrahedron(t);
+	});
+}
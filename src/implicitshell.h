@@ -0,0 +1,98 @@
+/*
+	implicitshell.h: Shell stored as the base mesh, its attributes, the offsets and the split pattern
+
+	A TetrahedronMesh duplicates the normals and tangents of every base vertex for its offset vertex,
+	stores the offset positions and a texcoord w which is 0 or 1, and 4 indices per tetrahedron,
+	although all of it follows from the base mesh: offset vertex v is base vertex v moved by its offset
+	along the normal, and the three tetrahedra of a prism follow from its face and the split patterns
+	of its edges. ImplicitShell keeps only that data (the patterns packed into 2 bits per edge) and
+	produces the vertices and tetrahedra of the equivalent TetrahedronMesh on demand.
+
+	Shell vertex v < getBaseVertexCount() is base vertex v, vertex getBaseVertexCount() + v is its
+	offset vertex; tetrahedron 3 * f + i is tetrahedron i of the prism over face f, the same numbering
+	as constructTetrahedronMeshSimple().
+*/
+
+#pragma once
+
+#include "mycommon.h"
+#include "tetra.h"
+#include "shellmapshelper.h"
+
+using nanogui::MatrixXf;
+using nanogui::MatrixXu;
+using nanogui::Vector3f;
+using Eigen::VectorXf;
+
+/* Packed split pattern of a face: bits 2i, 2i + 1 hold P(i, f), invalid patterns are stored as 3 */
+typedef uint8_t PackedPattern;
+
+class ImplicitShell {
+public:
+	ImplicitShell() { }
+
+	/* Offset vertex v is V.col(v) + offsets(v) * N.col(v) */
+	void set(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV, const MatrixXf &N, const MatrixXf &DPDU,
+		const MatrixXf &DPDV, const VectorXf &offsets, const MatrixXu &P);
+
+	/* The same with one offset for all vertices, like generateOffsetSurface() */
+	void set(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV, const MatrixXf &N, const MatrixXf &DPDU,
+		const MatrixXf &DPDV, float offset, const MatrixXu &P);
+
+	inline uint32_t getBaseVertexCount() const { return (uint32_t)mV.cols(); }
+	inline uint32_t getFaceCount() const { return (uint32_t)mF.cols(); }
+	inline uint32_t getVertexCount() const { return 2 * getBaseVertexCount(); }
+	inline uint32_t getTetrahedronCount() const { return 3 * getFaceCount(); }
+
+	/* Base data */
+	inline const MatrixXu &F() const { return mF; }
+	inline const MatrixXf &baseV() const { return mV; }
+	inline const MatrixXf &baseUV() const { return mUV; }
+	inline const MatrixXf &baseN() const { return mN; }
+	inline const MatrixXf &baseDPDU() const { return mDPDU; }
+	inline const MatrixXf &baseDPDV() const { return mDPDV; }
+	inline const VectorXf &offsets() const { return mOffsets; }
+	inline const std::vector<PackedPattern> &patterns() const { return mPatterns; }
+
+	inline uint32_t pattern(uint32_t f, int i) const { return (mPatterns[f] >> (2 * i)) & 3u; }
+
+	/* Per element accessors, the same as TetrahedronMesh provides */
+	inline Vector3f position(uint32_t v) const {
+		uint32_t b = baseVertex(v);
+		if (v == b)
+			return mV.col(b);
+		return mV.col(b) + mOffsets(b) * mN.col(b);
+	}
+	inline Vector3f texcoord(uint32_t v) const {
+		uint32_t b = baseVertex(v);
+		return Vector3f(mUV(0, b), mUV(1, b), v == b ? 0.0f : 1.0f);
+	}
+	inline Vector3f normal(uint32_t v) const { return mN.col(baseVertex(v)); }
+	inline Vector3f dpdu(uint32_t v) const { return mDPDU.col(baseVertex(v)); }
+	inline Vector3f dpdv(uint32_t v) const { return mDPDV.col(baseVertex(v)); }
+
+	inline Vector4u tetrahedron(uint32_t t) const {
+		uint32_t f = t / 3, face[3] = { mF(0, f), mF(1, f), mF(2, f) };
+		uint32_t p[3] = { pattern(f, 0), pattern(f, 1), pattern(f, 2) };
+		Vector4u tet;
+		prismTetrahedron(face, p, getBaseVertexCount(), (int)(t - 3 * f), tet.data());
+		return tet;
+	}
+
+	/* Bytes used by the stored arrays */
+	size_t memoryUsage() const;
+
+	/* Expand into the equivalent explicit tetrahedron mesh */
+	void toTetrahedronMesh(TetrahedronMesh &shell) const;
+
+private:
+	inline uint32_t baseVertex(uint32_t v) const {
+		uint32_t baseCount = getBaseVertexCount();
+		return v < baseCount ? v : v - baseCount;
+	}
+
+	MatrixXu mF;
+	MatrixXf mV, mUV, mN, mDPDU, mDPDV;
+	VectorXf mOffsets;
+	std::vector<PackedPattern> mPatterns;
+};
@@ -1,179 +1,336 @@
 #include "meshio.h"
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
-#include <unordered_map>
+#include "mmapfile.h"
+#include "parallel.h"
+#include "floatformat.h"
 
-void loadObj(const std::string &filename, MatrixXu &F, MatrixXf &V, MatrixXf &UV) {
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string err;
+#include <cstring>
 
-	std::cout << "--Load mesh file ..." << std::endl;
+/* Minimum number of bytes parsed per task by loadObjShareVertexNotShareTexcoord() */
+#define OBJ_CHUNK_SIZE (1 << 20)
 
-	bool ret = tinyobj::LoadObj(shapes, materials, err, filename.c_str());
+/* Lets tinyobj write the mesh straight into F, V and UV */
+class ObjMatrixStorage : public tinyobj::MeshStorage {
+public:
+	ObjMatrixStorage(MatrixXu &F, MatrixXf &V, MatrixXf &UV) : mF(F), mV(V), mUV(UV) { }
 
-	if (!err.empty()) std::cerr << err << std::endl;
-	if (!ret) exit(1);
+	unsigned int *allocateIndices(size_t triangles) {
+		mF.resize(3, triangles);
+		return mF.data();
+	}
 
-	if (shapes.empty()) std::cerr << "no shape in this mesh file: <" << filename << ">." << std::endl;
+	void allocateVertices(size_t vertices, bool hasTexcoords, float *&positions, float *&texcoords) {
+		mV.resize(3, vertices);
+		mUV.resize(2, hasTexcoords ? vertices : 0);
+		positions = mV.data();
+		texcoords = mUV.data();
+	}
 
-	tinyobj::shape_t shape = shapes[0];		// only handle the first shape
+private:
+	MatrixXu &mF;
+	MatrixXf &mV, &mUV;
+};
 
-	// load F
-	assert(shape.mesh.indices.size() % 3 == 0);
-	size_t FSize = shape.mesh.indices.size() / 3;
-	F.resize(3, FSize);
-	memcpy(F.data(), shape.mesh.indices.data(), sizeof(uint32_t) * FSize * 3);	// F.data: uint32, indices: unsigned int
+void loadObj(const std::string &filename, MatrixXu &F, MatrixXf &V, MatrixXf &UV) {
+	std::string err;
+	size_t shapes = 0;
 
-	// load V
-	assert(shape.mesh.positions.size() % 3 == 0);
-	size_t VSize = shape.mesh.positions.size() / 3;
-	V.resize(3, VSize);
-	memcpy(V.data(), shape.mesh.positions.data(), sizeof(float) * VSize * 3);
+	std::cout << "--Load mesh file ..." << std::endl;
+
+	/* Every shape has its own vertices, they are appended in shape order. UV is only filled
+	   if all vertices have texcoords */
+	ObjMatrixStorage storage(F, V, UV);
+	bool ret = tinyobj::LoadObj(storage, shapes, err, filename.c_str());
+
+	if (!err.empty()) std::cerr << err << std::endl;
+	if (!ret) throw std::runtime_error("Unable to load OBJ file \"" + filename + "\"!");
 
-	// load UV
-	assert(shape.mesh.texcoords.size() % 2 == 0);
-	size_t UVSize = shape.mesh.texcoords.size() / 2;
-	UV.resize(2, UVSize);
-	memcpy(UV.data(), shape.mesh.texcoords.data(), sizeof(float) * UVSize * 2);
+	if (shapes == 0) std::cerr << "no shape in this mesh file: <" << filename << ">." << std::endl;
 
-	std::cout << "load mesh done. (V=" << V.cols() << ", F=" << F.cols() << ", UV=" << UV.cols() << std::endl;
+	std::cout << "load mesh done. (V=" << V.cols() << ", F=" << F.cols() << ", UV=" << UV.cols() << ", shapes=" << shapes << ")" << std::endl;
 }
 
-void loadObjShareVertexNotShareTexcoord(const std::string &filename, MatrixXu &F, MatrixXf &V, MatrixXf &UV) {
-	/// Vertex indices used by the OBJ format
-	struct obj_vertex {
-		uint32_t p = (uint32_t)-1;
-		uint32_t n = (uint32_t)-1;
-		uint32_t uv = (uint32_t)-1;
+/* Line aligned part of a mapped OBJ file, the counts become the first output index of the chunk */
+struct ObjChunk {
+	const char *begin, *end;
+	uint32_t positions, texcoords, triangles;
+};
+
+enum OBJ_RECORD {
+	OBJ_POSITION = 0,
+	OBJ_TEXCOORD,
+	OBJ_FACE,
+	OBJ_OTHER
+};
+
+static inline bool isObjSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
 
-		inline obj_vertex() { }
+static inline const char *skipObjSpace(const char *p, const char *end) {
+	while (p < end && isObjSpace(*p)) ++p;
+	return p;
+}
 
-		inline obj_vertex(const std::string &string) {
-			std::vector<std::string> tokens = str_tokenize(string, '/', true);
+static inline const char *skipObjToken(const char *p, const char *end) {
+	while (p < end && !isObjSpace(*p)) ++p;
+	return p;
+}
 
-			if (tokens.size() < 1 || tokens.size() > 3)
-				throw std::runtime_error("Invalid vertex data: \"" + string + "\"");
+/* Classify the line [p, end) by its first token and advance p behind it */
+static inline OBJ_RECORD objRecord(const char *&p, const char *end) {
+	p = skipObjSpace(p, end);
+	const char *token = p;
+	p = skipObjToken(p, end);
+	size_t length = (size_t)(p - token);
+	if (length == 1 && token[0] == 'v') return OBJ_POSITION;
+	if (length == 2 && token[0] == 'v' && token[1] == 't') return OBJ_TEXCOORD;
+	if (length == 1 && token[0] == 'f') return OBJ_FACE;
+	return OBJ_OTHER;
+}
 
-			p = str_to_uint32_t(tokens[0]);
+/* Number of face vertices used by the loader, only the first 4 are read */
+static inline int objFaceVertexCount(const char *p, const char *end) {
+	int count = 0;
+	for (p = skipObjSpace(p, end); p < end && count < 4; p = skipObjSpace(p, end)) {
+		p = skipObjToken(p, end);
+		++count;
+	}
+	return count;
+}
 
-			if (tokens.size() >= 2 && !tokens[1].empty())
-				uv = str_to_uint32_t(tokens[1]);
+/* Call body(line, lineEnd) for every line of the chunk, without the line break */
+template <typename Body> static void forEachObjLine(const ObjChunk &chunk, const Body &body) {
+	for (const char *line = chunk.begin; line < chunk.end; ) {
+		const char *newline = static_cast<const char *>(memchr(line, '\n', (size_t)(chunk.end - line)));
+		const char *end = newline ? newline : chunk.end;
+		body(line, end);
+		line = end + 1;
+	}
+}
 
-#if 0
-			if (tokens.size() >= 3 && !tokens[2].empty())
-				n = str_to_uint32_t(tokens[2]);
-#endif
-		}
+static void invalidObjLine(const std::string &what, const char *line, const char *end) {
+	throw std::runtime_error("Invalid " + what + ": \"" + std::string(line, end) + "\"");
+}
 
-		inline bool operator==(const obj_vertex &v) const {
-//			return v.p == p && v.n == n && v.uv == uv;
-			return v.p == p;	// Same vertex have same p in different faces, but with different uv(Index).
-								// Of course, the uv(value) are same, see mesh files in Berkeley Garment Library.
-								// http://graphics.berkeley.edu/resources/GarmentLibrary/index.html
-		}
-	};
-
-	/// Hash function for obj_vertex
-	struct obj_vertexHash : std::unary_function<obj_vertex, size_t> {
-		std::size_t operator()(const obj_vertex &v) const {
-			size_t hash = std::hash<uint32_t>()(v.p);
-//			hash = hash * 37 + std::hash<uint32_t>()(v.uv);
-//			hash = hash * 37 + std::hash<uint32_t>()(v.n);
-			return hash;
-		}
-	};
+static void parseObjFloats(const char *line, const char *p, const char *end, float *values, int count, const char *what) {
+	for (int i = 0; i < count; ++i) {
+		p = skipObjSpace(p, end);
+		p = parseFloat(p, end, values[i]);
+		if (!p || (p < end && !isObjSpace(*p)))
+			invalidObjLine(what, line, end);
+	}
+}
 
-	typedef std::unordered_map<obj_vertex, uint32_t, obj_vertexHash> VertexMap;
+/* Parse "p", "p/uv", "p//n" or "p/uv/n" (the normal index is ignored) */
+static const char *parseObjVertex(const char *p, const char *end, uint32_t &position, uint32_t &texcoord) {
+	const char *token = skipObjSpace(p, end);
+	texcoord = (uint32_t)-1;
+	p = parseUInt(token, end, position);
+	if (p && p < end && *p == '/') {
+		++p;
+		if (p < end && *p != '/' && !isObjSpace(*p))
+			p = parseUInt(p, end, texcoord);
+		if (p && p < end && *p == '/')
+			p = skipObjToken(p + 1, end);
+	}
+	if (!p || (p < end && !isObjSpace(*p)))
+		invalidObjLine("vertex data", token, skipObjToken(token, end));
+	return p;
+}
 
-	std::ifstream is(filename);
-	if (is.fail())
-		throw std::runtime_error("Unable to open OBJ file \"" + filename + "\"!");
+void loadObjShareVertexNotShareTexcoord(const std::string &filename, MatrixXu &F, MatrixXf &V, MatrixXf &UV) {
+	/* Same vertex have same p in different faces, but with different uv(Index).
+	   Of course, the uv(value) are same, see mesh files in Berkeley Garment Library.
+	   http://graphics.berkeley.edu/resources/GarmentLibrary/index.html
+	   So vertices are keyed by their position index only and numbered in the order of their first
+	   appearance in the faces, the texcoord of that first appearance is used. */
+
+	MemoryMappedFile file(filename);
+	file.adviseSequential();
 	std::cout << "Loading \"" << filename << "\" .. ";
 	std::cout.flush();
 	Timer<> timer;
 
-	std::vector<Vector3f>   positions;
-	std::vector<Vector2f>   texcoords;
-	//std::vector<Vector3f>   normals;
-	std::vector<uint32_t>   indices;
-	std::vector<obj_vertex> vertices;
-	VertexMap vertexMap;
-
-	std::string line_str;
-	while (std::getline(is, line_str)) {
-		std::istringstream line(line_str);
-
-		std::string prefix;
-		line >> prefix;
-
-		if (prefix == "v") {
-			Vector3f p;
-			line >> p.x() >> p.y() >> p.z();
-			positions.push_back(p);
+	/* Cut the file into line aligned chunks */
+	const char *data = reinterpret_cast<const char *>(file.data());
+	const char *dataEnd = data + file.size();
+	size_t chunkSize = std::max<size_t>(OBJ_CHUNK_SIZE, file.size() / (4 * getThreadCount()) + 1);
+	std::vector<ObjChunk> chunks;
+	for (const char *begin = data; begin < dataEnd; ) {
+		const char *end = begin + std::min(chunkSize, (size_t)(dataEnd - begin));
+		if (end < dataEnd) {
+			const char *newline = static_cast<const char *>(memchr(end, '\n', (size_t)(dataEnd - end)));
+			end = newline ? newline + 1 : dataEnd;
 		}
-		else if (prefix == "vt") {
-			Vector2f tc;
-			line >> tc.x() >> tc.y();
-			texcoords.push_back(tc);
-		}
-		else if (prefix == "vn") {
-			/*
-			Vector3f n;
-			line >> n.x() >> n.y() >> n.z();
-			normals.push_back(n);
-			*/
+		chunks.push_back(ObjChunk{ begin, end, 0, 0, 0 });
+		begin = end;
+	}
+	uint32_t chunkCount = (uint32_t)chunks.size();
+
+	/* Count the records per chunk */
+	parallel_for(0, chunkCount, 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t c = begin; c < end; ++c) {
+			ObjChunk &chunk = chunks[c];
+			forEachObjLine(chunk, [&](const char *line, const char *lineEnd) {
+				const char *p = line;
+				switch (objRecord(p, lineEnd)) {
+				case OBJ_POSITION: ++chunk.positions; break;
+				case OBJ_TEXCOORD: ++chunk.texcoords; break;
+				case OBJ_FACE: chunk.triangles += objFaceVertexCount(p, lineEnd) == 4 ? 2 : 1; break;
+				default: break;
+				}
+			});
 		}
-		else if (prefix == "f") {
-			std::string v1, v2, v3, v4;
-			line >> v1 >> v2 >> v3 >> v4;
-			obj_vertex tri[6];
-			int nVertices = 3;
-
-			tri[0] = obj_vertex(v1);
-			tri[1] = obj_vertex(v2);
-			tri[2] = obj_vertex(v3);
-
-			if (!v4.empty()) {
-				/* This is a quad, split into two triangles */
-				tri[3] = obj_vertex(v4);
-				tri[4] = tri[0];
-				tri[5] = tri[2];
-				nVertices = 6;
-			}
-			/* Convert to an indexed vertex list */
-			for (int i = 0; i<nVertices; ++i) {
-				const obj_vertex &v = tri[i];
-				VertexMap::const_iterator it = vertexMap.find(v);
-				if (it == vertexMap.end()) {
-					vertexMap[v] = (uint32_t)vertices.size();
-					indices.push_back((uint32_t)vertices.size());
-					vertices.push_back(v);
+	});
+
+	uint64_t positionCount = 0, texcoordCount = 0, triangleCount = 0;
+	for (ObjChunk &chunk : chunks) {
+		uint32_t positions = chunk.positions, texcoords = chunk.texcoords, triangles = chunk.triangles;
+		chunk.positions = (uint32_t)positionCount;
+		chunk.texcoords = (uint32_t)texcoordCount;
+		chunk.triangles = (uint32_t)triangleCount;
+		positionCount += positions;
+		texcoordCount += texcoords;
+		triangleCount += triangles;
+	}
+	if (positionCount >= 0xFFFFFFFFull || texcoordCount >= 0xFFFFFFFFull || 3 * triangleCount >= 0xFFFFFFFFull)
+		throw std::runtime_error("OBJ file \"" + filename + "\" is too large!");
+
+	/* Parse the records straight to their final index. F temporarily holds 0 based position indices,
+	   cornerTexcoords the 1 based texcoord index of every corner ((uint32_t)-1 if there is none) */
+	MatrixXf positions(3, positionCount), texcoords(2, texcoordCount);
+	F.resize(3, triangleCount);
+	std::vector<uint32_t> cornerTexcoords(3 * triangleCount);
+
+	parallel_for(0, chunkCount, 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t c = begin; c < end; ++c) {
+			const ObjChunk &chunk = chunks[c];
+			uint32_t position = chunk.positions, texcoord = chunk.texcoords, corner = 3 * chunk.triangles;
+			forEachObjLine(chunk, [&](const char *line, const char *lineEnd) {
+				const char *p = line;
+				switch (objRecord(p, lineEnd)) {
+				case OBJ_POSITION:
+					parseObjFloats(line, p, lineEnd, positions.col(position++).data(), 3, "vertex position");
+					break;
+				case OBJ_TEXCOORD:
+					parseObjFloats(line, p, lineEnd, texcoords.col(texcoord++).data(), 2, "texture coordinate");
+					break;
+				case OBJ_FACE: {
+					int count = objFaceVertexCount(p, lineEnd);
+					if (count < 3)
+						invalidObjLine("face", line, lineEnd);
+					uint32_t indices[4], uvs[4];
+					for (int i = 0; i < count; ++i) {
+						p = parseObjVertex(p, lineEnd, indices[i], uvs[i]);
+						if (indices[i] == 0 || indices[i] > positionCount)
+							invalidObjLine("vertex index", line, lineEnd);
+					}
+					/* A quad is split into two triangles */
+					static const int order[6] = { 0, 1, 2, 3, 0, 2 };
+					for (int i = 0; i < (count == 4 ? 6 : 3); ++i, ++corner) {
+						F.data()[corner] = indices[order[i]] - 1;
+						cornerTexcoords[corner] = uvs[order[i]];
+					}
+					break;
 				}
-				else {
-					indices.push_back(it->second);
+				default:
+					break;
 				}
-			}
+			});
 		}
+	});
+
+	/* Number the vertices in the order of their first appearance */
+	const uint32_t INVALID = (uint32_t)-1;
+	std::vector<uint32_t> vertexIds(positionCount, INVALID), firstCorners;
+	firstCorners.reserve(positionCount);
+	bool identity = true;
+	uint32_t *indices = F.data();
+	for (uint32_t corner = 0; corner < (uint32_t)(3 * triangleCount); ++corner) {
+		uint32_t &id = vertexIds[indices[corner]];
+		if (id == INVALID) {
+			id = (uint32_t)firstCorners.size();
+			identity &= id == indices[corner];
+			firstCorners.push_back(corner);
+		}
+		indices[corner] = id;
 	}
+	uint32_t vertexCount = (uint32_t)firstCorners.size();
 
-	F.resize(3, indices.size() / 3);
-	memcpy(F.data(), indices.data(), sizeof(uint32_t)*indices.size());
-
-	V.resize(3, vertices.size());
-	for (uint32_t i = 0; i<vertices.size(); ++i)
-		V.col(i) = positions.at(vertices[i].p - 1);
+	/* Usually every position is used and the faces reference them in file order */
+	if (identity && vertexCount == positionCount) {
+		V.swap(positions);
+	}
+	else {
+		V.resize(3, vertexCount);
+		parallel_for(0, (uint32_t)positionCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t p = begin; p < end; ++p)
+				if (vertexIds[p] != INVALID)
+					V.col(vertexIds[p]) = positions.col(p);
+		});
+	}
 
-	if (texcoords.size() > 0) {
-		UV.resize(2, vertices.size());
-		for (uint32_t i = 0; i < vertices.size(); ++i)
-			UV.col(i) = texcoords.at(vertices[i].uv - 1);
+	if (texcoordCount > 0) {
+		UV.resize(2, vertexCount);
+		parallel_for(0, vertexCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; ++i) {
+				uint32_t uv = cornerTexcoords[firstCorners[i]];
+				if (uv == 0 || uv > texcoordCount)
+					throw std::runtime_error("Invalid texture coordinate index of vertex " + std::to_string(i) + " in OBJ file \"" + filename + "\"!");
+				UV.col(i) = texcoords.col(uv - 1);
+			}
+		});
+	}
+	else {
+		UV.resize(2, 0);
 	}
 
 	std::cout << "done. (V=" << V.cols() << ", F=" << F.cols() << ", UV=" << UV.cols() << ", took "
 		<< timeString(timer.value()) << ")" << std::endl;
 }
 
+void normalizeTexcoords(MatrixXf &UV) {
+	if (UV.cols() > 0) {
+		float uMin = 1000000.0, vMin = 1000000.0, uMax = -1000000, vMax = -1000000;
+
+		for (int v = 0; v < UV.cols(); ++v) {
+			if (UV(0, v) < uMin) uMin = UV(0, v);
+			if (UV(0, v) > uMax) uMax = UV(0, v);
+			if (UV(1, v) < vMin) vMin = UV(1, v);
+			if (UV(1, v) > vMax) vMax = UV(1, v);
+		}
+
+		std::cout << "[u, v] is between (" << uMin << ", " << vMin << ") and (" << uMax << ", " << vMax << ").\n";
+		std::cout << "first v: " << UV(0, 0) << ", " << UV(1, 0) << std::endl;
+
+		if (uMin < 0.0 || uMax > 1.0 || vMin < 0.0 || vMax > 1.0) {
+			std::cout << "resizing u,v .." << std::endl;
+
+			float uR = uMax - uMin;
+			float vR = vMax - vMin;
+
+			float s = std::max(uR, vR);
+			UV /= s;
+			float tu = uMin / s;
+			float tv = vMin / s;
+
+			UV.row(0) -= MatrixXf::Constant(1, UV.cols(), tu - 0.000001);
+			UV.row(1) -= MatrixXf::Constant(1, UV.cols(), tv - 0.000001);
+
+			std::cout << "after, first v: " << UV(0, 0) << ", " << UV(1, 0) << std::endl;
+
+			uMax /= s;
+			uMax -= (tu - 0.000001);
+			vMax /= s;
+			vMax -= (tv - 0.000001);
+
+			std::cout << "after resizing, uv is between (" << 0.0 << ", " << 0.0 << ") and (" << uMax << ", " << vMax << ").\n";
+		}
+	}
+}
+
 void writeObj(const std::string filename, const MatrixXu &F, const MatrixXf &V) {
 	std::cout << "Writing \"" << filename << "\" (V=" << V.cols()
 		<< ", F=" << F.cols() << ") ..." << std::endl;
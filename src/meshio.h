@@ -11,12 +11,16 @@ using nanogui::Vector2f;
 using nanogui::MatrixXf;
 using nanogui::MatrixXu;
 
-/* Simply call tiny object loader. Since the shell maps here assumes the underlying mesh shares vertex(using indices) and
- needs vertex texcoords, you may adjust the mesh's representation after calling this function. */
+/* Simply call tiny object loader, the vertices and faces of all shapes are appended in shape order. Since the shell maps
+ here assumes the underlying mesh shares vertex(using indices) and needs vertex texcoords, you may adjust the mesh's
+ representation after calling this function. */
 extern void loadObj(const std::string &filename, MatrixXu &F, MatrixXf &V, MatrixXf &UV);
 
 /* Load mesh which shares vertex and does not share texcoords(but the uv values are same), for example: the meshes in Berkeley Garment Library.
 http://graphics.berkeley.edu/resources/GarmentLibrary/index.html */
 extern void loadObjShareVertexNotShareTexcoord(const std::string &filename, MatrixXu &F, MatrixXf &V, MatrixXf &UV);
 
+/* Uniformly rescale and translate texcoords into [0, 1] x [0, 1] if they exceed the unit square. */
+extern void normalizeTexcoords(MatrixXf &UV);
+
 extern void writeObj(const std::string filename, const MatrixXu &F, const MatrixXf &V);
\ No newline at end of file
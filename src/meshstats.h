@@ -21,7 +21,7 @@ struct MeshStats {
 		mWeightedCenter(Vector3f::Zero()),
 		mSurfaceArea(0.0f),
 		mMaximumEdgeLength(0.0f),
-		mMinimumEdgeLength(0.0f),
+		mMinimumEdgeLength(std::numeric_limits<double>::infinity()),
 		mAverageEdgeLength(0.0f) { }
 };
 
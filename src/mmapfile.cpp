@@ -0,0 +1,113 @@
+#include "mmapfile.h"
+
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MemoryMappedFile::MemoryMappedFile() : mData(nullptr), mSize(0), mOpen(false) {
+#if defined(_WIN32)
+	mFileHandle = mMappingHandle = nullptr;
+#endif
+}
+
+MemoryMappedFile::MemoryMappedFile(const std::string &filename) : MemoryMappedFile() {
+	open(filename);
+}
+
+MemoryMappedFile::~MemoryMappedFile() {
+	close();
+}
+
+void MemoryMappedFile::open(const std::string &filename) {
+	close();
+
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Unable to open file \"" + filename + "\"!");
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		throw std::runtime_error("Unable to query the size of \"" + filename + "\"!");
+	}
+
+	/* Empty files can not be mapped */
+	if (size.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		void *data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (!data) {
+			if (mapping) CloseHandle(mapping);
+			CloseHandle(file);
+			throw std::runtime_error("Unable to map file \"" + filename + "\"!");
+		}
+		mMappingHandle = mapping;
+		mData = static_cast<const uint8_t *>(data);
+	}
+	mFileHandle = file;
+	mSize = (size_t)size.QuadPart;
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Unable to open file \"" + filename + "\"!");
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		throw std::runtime_error("Unable to query the size of \"" + filename + "\"!");
+	}
+
+	/* Empty files can not be mapped */
+	if (st.st_size > 0) {
+		void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			::close(fd);
+			throw std::runtime_error("Unable to map file \"" + filename + "\"!");
+		}
+		mData = static_cast<const uint8_t *>(data);
+	}
+	/* The mapping stays valid after closing the descriptor */
+	::close(fd);
+	mSize = (size_t)st.st_size;
+#endif
+
+	mFilename = filename;
+	mOpen = true;
+}
+
+void MemoryMappedFile::close() {
+	if (!mOpen)
+		return;
+
+#if defined(_WIN32)
+	if (mData) UnmapViewOfFile(mData);
+	if (mMappingHandle) CloseHandle(mMappingHandle);
+	if (mFileHandle) CloseHandle(mFileHandle);
+	mFileHandle = mMappingHandle = nullptr;
+#else
+	if (mData) munmap(const_cast<uint8_t *>(mData), mSize);
+#endif
+
+	mFilename.clear();
+	mData = nullptr;
+	mSize = 0;
+	mOpen = false;
+}
+
+void MemoryMappedFile::adviseSequential() const {
+#if !defined(_WIN32)
+	if (mData) {
+		madvise(const_cast<uint8_t *>(mData), mSize, MADV_SEQUENTIAL);
+		madvise(const_cast<uint8_t *>(mData), mSize, MADV_WILLNEED);
+	}
+#endif
+}
@@ -0,0 +1,43 @@
+/*
+	mmapfile.h: Read-only memory mapped files
+
+	Maps a whole file into the address space (mmap on POSIX systems, file mappings on Windows).
+	Pages are only read from disk when they are touched, so opening a file is independent of its
+	size. Errors are reported with std::runtime_error.
+*/
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+class MemoryMappedFile {
+public:
+	MemoryMappedFile();
+	explicit MemoryMappedFile(const std::string &filename);
+	~MemoryMappedFile();
+
+	void open(const std::string &filename);
+	void close();
+
+	inline bool isOpen() const { return mOpen; }
+	inline const uint8_t *data() const { return mData; }
+	inline size_t size() const { return mSize; }
+	inline const std::string &filename() const { return mFilename; }
+
+	/* Hint the OS that the file will be read front to back (read-ahead) */
+	void adviseSequential() const;
+
+private:
+	MemoryMappedFile(const MemoryMappedFile &) = delete;
+	MemoryMappedFile &operator=(const MemoryMappedFile &) = delete;
+
+	std::string mFilename;
+	const uint8_t *mData;
+	size_t mSize;
+	bool mOpen;
+#if defined(_WIN32)
+	void *mFileHandle, *mMappingHandle;
+#endif
+};
@@ -13,6 +13,9 @@
 using nanogui::Vector3f;
 
 typedef Eigen::Matrix<uint32_t, 3, 1> Vector3u;
+typedef Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic> MatrixXu8;
+typedef Eigen::Matrix<uint16_t, Eigen::Dynamic, Eigen::Dynamic> MatrixXu16;
+typedef Eigen::Matrix<int16_t, Eigen::Dynamic, Eigen::Dynamic> MatrixXi16;
 
 template <typename TimeT = std::chrono::milliseconds> class Timer {
 public:
@@ -61,6 +64,23 @@ inline std::string timeString(double time, bool precise = false) {
 	return os.str();
 }
 
+inline std::string memString(size_t size, bool precise = false) {
+	double value = (double)size;
+	const char *suffixes[] = {
+		"B", "KiB", "MiB", "GiB", "TiB", "PiB"
+	};
+	int suffix = 0;
+	while (suffix < 5 && value > 1024.0f) {
+		value /= 1024.0f; ++suffix;
+	}
+
+	std::ostringstream os;
+	os << std::setprecision(suffix == 0 ? 0 : (precise ? 4 : 1))
+		<< std::fixed << value << " " << suffixes[suffix];
+
+	return os.str();
+}
+
 inline float fast_acos(float x) {
 	float negate = float(x < 0.0f);
 	x = std::abs(x);
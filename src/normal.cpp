@@ -12,56 +12,75 @@
 */
 
 #include "normal.h"
+#include "adjacenttriangles.h"
+#include "parallel.h"
 
 void computeVertexNormals(const MatrixXu &F, const MatrixXf &V, MatrixXf &N, bool angleWeight) {
 	std::cout << "--Computing vertex normals ..." << std::endl;
 	std::cout.flush();
 
-	uint32_t badFaces = 0;
-	N.resize(V.rows(), V.cols());
-	N.setZero();
-
 	const float RCPOVERFLOW_FLT = 2.93873587705571876e-39f;
 
+	/* Compute the contribution of every corner in parallel, C.col(3 * f + i) belongs to vertex F(i, f) */
 	uint32_t trianglesCount = F.cols();
-	for (uint32_t f = 0; f < trianglesCount; ++f) {
-		Vector3f fn = Vector3f::Zero();
-
-		for (int i = 0; i < 3; ++i) {
-			Vector3f v0 = V.col(F(i, f)),
-				v1 = V.col(F((i + 1) % 3, f)),
-				v2 = V.col(F((i + 2) % 3, f)),
-				d0 = v1 - v0,
-				d1 = v2 - v0;
-					 
-			if (i == 0) {
-				fn = d0.cross(d1);
-				float norm = fn.norm();
-				if (norm < RCPOVERFLOW_FLT) {
-					badFaces++;
-					break;
+	MatrixXf C(3, 3 * trianglesCount);
+	std::atomic<uint32_t> badFaces(0);
+
+	parallel_for(0u, trianglesCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		uint32_t localBadFaces = 0;
+		for (uint32_t f = begin; f < end; ++f) {
+			Vector3f fn = Vector3f::Zero();
+
+			for (int i = 0; i < 3; ++i) {
+				Vector3f v0 = V.col(F(i, f)),
+					v1 = V.col(F((i + 1) % 3, f)),
+					v2 = V.col(F((i + 2) % 3, f)),
+					d0 = v1 - v0,
+					d1 = v2 - v0;
+
+				if (i == 0) {
+					fn = d0.cross(d1);
+					float norm = fn.norm();
+					if (norm < RCPOVERFLOW_FLT) {
+						localBadFaces++;
+						C.block<3, 3>(0, 3 * f).setZero();
+						break;
+					}
+					fn /= norm;
 				}
-				fn /= norm;
-			}
 
-			/* "Computing Vertex Normals from Polygonal Facets"
-			by Grit Thuermer and Charles A. Wuethrich, JGT 1998, Vol 3 */
-			float angle = fast_acos(d0.dot(d1) / std::sqrt(d0.squaredNorm() * d1.squaredNorm()));
-			if (angleWeight) N.col(F(i, f)) += fn * angle;
-			else N.col(F(i, f)) += fn;
+				/* "Computing Vertex Normals from Polygonal Facets"
+				by Grit Thuermer and Charles A. Wuethrich, JGT 1998, Vol 3 */
+				float angle = fast_acos(d0.dot(d1) / std::sqrt(d0.squaredNorm() * d1.squaredNorm()));
+				if (angleWeight) C.col(3 * f + i) = fn * angle;
+				else C.col(3 * f + i) = fn;
+			}
 		}
-	}
+		badFaces += localBadFaces;
+	});
 
+	/* Gather the corner contributions per vertex in ascending corner order, which is the summation order of
+	a serial loop over the faces, so the result does not depend on the number of threads */
 	uint32_t vertexCount = V.cols();
-	for (uint32_t v = 0; v < vertexCount; ++v) {
-		float norm = N.col(v).norm();
-		if (norm < RCPOVERFLOW_FLT) {
-			N.col(v) = Vector3f::UnitX();
-		}
-		else {
-			N.col(v) /= norm;
+	std::vector<uint32_t> offsets, corners;
+	buildVertexCornerTable(F, vertexCount, offsets, corners);
+	N.resize(V.rows(), V.cols());
+
+	parallel_for(0u, vertexCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t v = begin; v < end; ++v) {
+			N.col(v).setZero();
+			for (uint32_t k = offsets[v]; k < offsets[v + 1]; ++k)
+				N.col(v) += C.col(corners[k]);
+
+			float norm = N.col(v).norm();
+			if (norm < RCPOVERFLOW_FLT) {
+				N.col(v) = Vector3f::UnitX();
+			}
+			else {
+				N.col(v) /= norm;
+			}
 		}
-	}
+	});
 
 	std::cout << "++Computing vertex normals done. (";
 	if (badFaces > 0)
@@ -0,0 +1,194 @@
+#include "occupancy.h"
+#include "heightmap.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+void ShellOccupancy::setBoxes(const std::vector<AABB> &boxes) {
+	mBoxes = boxes;
+	mBVH.build(mBoxes);
+}
+
+void ShellOccupancy::clear() {
+	mBitmap.resize(0, 0);
+	mBoxes.clear();
+	mBVH.clear();
+}
+
+/* Whether the box lies outside one of the face planes of the tetrahedron p */
+static bool separatedByFace(const Vector3f p[4], const AABB &box) {
+	static const int faces[4][3] = { { 1, 2, 3 }, { 0, 3, 2 }, { 0, 1, 3 }, { 0, 2, 1 } };
+	Vector3f center = 0.5f * (box.min + box.max), extent = 0.5f * (box.max - box.min);
+	for (int k = 0; k < 4; ++k) {
+		const Vector3f &a = p[faces[k][0]];
+		Vector3f n = (p[faces[k][1]] - a).cross(p[faces[k][2]] - a);
+		/* Outwards, away from the opposite vertex; degenerate tetrahedra are not separated by their faces */
+		float side = n.dot(p[k] - a);
+		if (side == 0.0f)
+			return false;
+		if (side > 0.0f)
+			n = -n;
+		if (n.dot(center - a) - n.cwiseAbs().dot(extent) > 0.0f)
+			return true;
+	}
+	return false;
+}
+
+bool ShellOccupancy::overlapsBitmap(const Vector2f &a, const Vector2f &b, const Vector2f &c) const {
+	return mBitmap.size() > 0 && footprintMaximum(mBitmap, a, b, c) > 0.0f;
+}
+
+bool ShellOccupancy::overlapsBoxes(const Vector3f uvw[4]) const {
+	if (mBoxes.empty())
+		return false;
+
+	AABB bounds;
+	for (int c = 0; c < 4; ++c)
+		bounds.expandBy(uvw[c]);
+	const std::vector<uint32_t> &indices = mBVH.indices();
+	return mBVH.traverseBox(bounds, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			const AABB &box = mBoxes[indices[i]];
+			if ((bounds.min.array() <= box.max.array()).all() && (box.min.array() <= bounds.max.array()).all() &&
+				!separatedByFace(uvw, box))
+				return true;
+		}
+		return false;
+	});
+}
+
+void loadOccupancyBoxes(const std::string &filename, std::vector<AABB> &boxes) {
+	std::ifstream is(filename);
+	if (is.fail())
+		throw std::runtime_error("Unable to open occupancy box file \"" + filename + "\"!");
+	boxes.clear();
+	std::string line;
+	for (uint32_t lineNumber = 1; std::getline(is, line); ++lineNumber) {
+		std::istringstream tokens(line);
+		std::vector<float> values;
+		float value;
+		while (tokens >> value)
+			values.push_back(value);
+		bool comment = line.find_first_not_of(" \t\r") == std::string::npos || line[line.find_first_not_of(" \t\r")] == '#';
+		if (comment)
+			continue;
+		if (!tokens.eof() || (values.size() != 4 && values.size() != 6))
+			throw std::runtime_error("Could not parse occupancy box in line " + std::to_string(lineNumber) + " of \"" + filename + "\"");
+		if (values.size() == 4)
+			boxes.push_back(AABB(Vector3f(values[0], values[1], 0.0f), Vector3f(values[2], values[3], 1.0f)));
+		else
+			boxes.push_back(AABB(Vector3f(values[0], values[1], values[2]), Vector3f(values[3], values[4], values[5])));
+	}
+}
+
+uint32_t applyShellOccupancy(const ShellOccupancy &occupancy, TetrahedronMesh &shell) {
+	std::cout << "--Apply shell occupancy ..." << std::endl;
+	uint32_t vertexCount = shell.getVertexCount(), tetrahedronCount = shell.getTetrahedronCount();
+	if (tetrahedronCount % 3 != 0)
+		throw std::runtime_error("applyShellOccupancy(): the shell does not consist of prisms of three tetrahedra");
+	if (shell.UV().cols() != (Eigen::Index)vertexCount)
+		throw std::runtime_error("applyShellOccupancy(): the shell has no texture coordinates");
+	uint32_t prismCount = tetrahedronCount / 3;
+	const MatrixXf &UV = shell.UV();
+	const MatrixXu &T = shell.T();
+
+	/* The bitmap is tested once per prism against its base triangle, the boxes per tetrahedron */
+	std::vector<uint8_t> occupied(tetrahedronCount);
+	parallel_for(0u, prismCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		Vector3f uvw[4];
+		for (uint32_t f = begin; f < end; ++f) {
+			/* Base corners of the prism, those of the degenerate tetrahedra of invalid patterns are repeated */
+			uint32_t base[3], baseCount = 0;
+			for (uint32_t t = 3 * f; t < 3 * f + 3; ++t)
+				for (int c = 0; c < 4; ++c) {
+					uint32_t v = T(c, t);
+					if (baseCount < 3 && UV(2, v) == 0.0f && std::find(base, base + baseCount, v) == base + baseCount)
+						base[baseCount++] = v;
+				}
+			for (uint32_t i = baseCount; i < 3; ++i)
+				base[i] = baseCount > 0 ? base[baseCount - 1] : T(0, 3 * f);
+			bool bitmap = occupancy.overlapsBitmap(UV.col(base[0]).head<2>(), UV.col(base[1]).head<2>(), UV.col(base[2]).head<2>());
+
+			for (uint32_t t = 3 * f; t < 3 * f + 3; ++t) {
+				if (!bitmap)
+					for (int c = 0; c < 4; ++c)
+						uvw[c] = UV.col(T(c, t));
+				occupied[t] = bitmap || occupancy.overlapsBoxes(uvw) ? 1 : 0;
+			}
+		}
+	});
+
+	/* New index of each kept prism, and of each vertex used by one */
+	const uint32_t removed = (uint32_t)-1;
+	std::vector<uint32_t> prismMap(prismCount, removed), vertexMap(vertexCount, removed);
+	uint32_t keptPrisms = 0, keptVertices = 0, occupiedCount = 0;
+	for (uint32_t f = 0; f < prismCount; ++f) {
+		if (!(occupied[3 * f] | occupied[3 * f + 1] | occupied[3 * f + 2]))
+			continue;
+		prismMap[f] = keptPrisms++;
+		for (uint32_t t = 3 * f; t < 3 * f + 3; ++t) {
+			occupiedCount += occupied[t];
+			for (int c = 0; c < 4; ++c)
+				vertexMap[T(c, t)] = 0;
+		}
+	}
+	for (uint32_t v = 0; v < vertexCount; ++v)
+		if (vertexMap[v] != removed)
+			vertexMap[v] = keptVertices++;
+
+	bool tangents = shell.DPDU().cols() == (Eigen::Index)vertexCount && shell.DPDV().cols() == (Eigen::Index)vertexCount;
+	MatrixXf V(3, keptVertices), N(3, keptVertices), sUV(3, keptVertices);
+	MatrixXf DPDU(3, tangents ? keptVertices : 0), DPDV(3, tangents ? keptVertices : 0);
+	parallel_for(0u, vertexCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t v = begin; v < end; ++v) {
+			uint32_t s = vertexMap[v];
+			if (s == removed)
+				continue;
+			V.col(s) = shell.V().col(v), N.col(s) = shell.N().col(v), sUV.col(s) = UV.col(v);
+			if (tangents)
+				DPDU.col(s) = shell.DPDU().col(v), DPDV.col(s) = shell.DPDV().col(v);
+		}
+	});
+
+	bool neighbors = shell.hasNeighbors();
+	MatrixXu sT(4, 3 * keptPrisms), sTN(neighbors ? 4 : 0, neighbors ? 3 * keptPrisms : 0);
+	MatrixXu8 O = MatrixXu8::Zero(1, (3 * keptPrisms + 7) / 8);
+	parallel_for(0u, prismCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t f = begin; f < end; ++f) {
+			if (prismMap[f] == removed)
+				continue;
+			for (uint32_t i = 0; i < 3; ++i) {
+				uint32_t t = 3 * f + i, s = 3 * prismMap[f] + i;
+				for (int c = 0; c < 4; ++c)
+					sT(c, s) = vertexMap[T(c, t)];
+				if (!neighbors)
+					continue;
+				for (int c = 0; c < 4; ++c) {
+					uint32_t entry = shell.TN()(c, t);
+					if (isTetrahedronNeighbor(entry))
+						entry = prismMap[entry / 3] == removed ? TETRAHEDRON_BOUNDARY : 3 * prismMap[entry / 3] + entry % 3;
+					sTN(c, s) = entry;
+				}
+			}
+		}
+	});
+	/* Serially, neighbouring prisms share bytes */
+	for (uint32_t f = 0; f < prismCount; ++f)
+		if (prismMap[f] != removed)
+			for (uint32_t i = 0; i < 3; ++i)
+				if (occupied[3 * f + i]) {
+					uint32_t s = 3 * prismMap[f] + i;
+					O(0, s / 8) |= (uint8_t)(1u << (s % 8));
+				}
+
+	shell.setTetrahedronMesh(std::move(V), std::move(N), std::move(sUV), std::move(DPDU), std::move(DPDV), std::move(sT));
+	if (neighbors)
+		shell.TN() = std::move(sTN);
+	shell.O() = std::move(O);
+
+	std::cout << "++Apply shell occupancy done (" << keptPrisms << " of " << prismCount << " prisms kept, V=" << keptVertices
+		<< ", T=" << 3 * keptPrisms << ", " << occupiedCount << " tetrahedra occupied)." << std::endl;
+	return prismCount - keptPrisms;
+}
@@ -0,0 +1,66 @@
+/*
+	occupancy.h: Sparse shells without the prisms over empty texture space
+
+	Shell content often covers only parts of the UV domain, but every prism of the shell carries its
+	three tetrahedra, which renderers still traverse. A ShellOccupancy describes where the content is,
+	as an image over the UV domain or as boxes in texture space (u, v, w), and applyShellOccupancy()
+	keeps only the prisms with at least one tetrahedron overlapping it:
+
+	- An image is tested once per prism, against the texels its UV triangle overlaps. Every
+	  tetrahedron of a prism spans that whole triangle, so an image can't tell them apart.
+	- Boxes are tested against the tetrahedron itself, separated by the box axes or the face planes of
+	  the tetrahedron. This is conservative, edge/edge separations are not tested.
+
+	The remaining tetrahedra keep their order and stay in groups of three per prism, the vertices not
+	used by them are removed and the rest renumbered, so the offset vertex of base vertex v is no longer
+	at a fixed index. Neighbours in removed prisms become TETRAHEDRON_BOUNDARY. Each remaining
+	tetrahedron gets an occupancy bit (TetrahedronMesh::O()) telling whether it overlaps the content
+	itself or only shares a prism with one that does; with an image alone all bits are set.
+*/
+
+#pragma once
+
+#include "mycommon.h"
+#include "aabb.h"
+#include "bvh.h"
+#include "tetra.h"
+
+#include <vector>
+
+using nanogui::MatrixXf;
+using nanogui::Vector2f;
+using nanogui::Vector3f;
+
+class ShellOccupancy {
+public:
+	ShellOccupancy() { }
+
+	/* Image over the UV domain laid out as by loadHeightMap() (src/heightmap.h), texels above 0 hold content */
+	void setBitmap(const MatrixXf &bitmap) { mBitmap = bitmap; }
+	/* Texture space (u, v, w) boxes holding content, w = 0 on the base and 1 on the offset surface */
+	void setBoxes(const std::vector<AABB> &boxes);
+	void clear();
+
+	inline bool isEmpty() const { return mBitmap.size() == 0 && mBoxes.empty(); }
+	inline const MatrixXf &bitmap() const { return mBitmap; }
+	inline const std::vector<AABB> &boxes() const { return mBoxes; }
+
+	/* Whether the UV triangle (a, b, c) covers a texel of the bitmap holding content */
+	bool overlapsBitmap(const Vector2f &a, const Vector2f &b, const Vector2f &c) const;
+	/* Whether the tetrahedron with the texcoords uvw may overlap one of the boxes */
+	bool overlapsBoxes(const Vector3f uvw[4]) const;
+
+private:
+	MatrixXf mBitmap;
+	std::vector<AABB> mBoxes;
+	BVH mBVH;
+};
+
+/* Read texture space boxes from a text file, one per line as "u0 v0 u1 v1" (spanning the whole shell height) or
+	"u0 v0 w0 u1 v1 w1". Empty lines and lines starting with '#' are skipped. */
+extern void loadOccupancyBoxes(const std::string &filename, std::vector<AABB> &boxes);
+
+/* Remove the prisms of a shell built by constructTetrahedronMeshSimple() none of whose tetrahedra overlaps the content,
+	compact the vertices and set the occupancy bits. The neighbour table is remapped if present. Returns the number of
+	prisms removed. */
+extern uint32_t applyShellOccupancy(const ShellOccupancy &occupancy, TetrahedronMesh &shell);
@@ -0,0 +1,76 @@
+/*
+	parallel.h: Minimal blocked parallel loops on top of std::thread
+
+	The range [begin, end) is cut into blocks of 'grainSize' elements which are handed out to
+	the worker threads on demand. Block boundaries only depend on the range and the grain size,
+	so loops writing disjoint outputs per block produce the same result for any thread count.
+*/
+
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <exception>
+#include <cstdint>
+
+#define GRAIN_SIZE 1024
+
+inline uint32_t &threadCountStorage() {
+	static uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+	return threadCount;
+}
+
+/* Set the number of threads used by parallel_for (0: number of hardware threads) */
+inline void setThreadCount(uint32_t threadCount) {
+	threadCountStorage() = threadCount > 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+}
+
+inline uint32_t getThreadCount() { return threadCountStorage(); }
+
+/* Call body(blockBegin, blockEnd) for every block of [begin, end) */
+template <typename Body> void parallel_for(uint32_t begin, uint32_t end, uint32_t grainSize, const Body &body) {
+	if (end <= begin)
+		return;
+	grainSize = std::max(grainSize, 1u);
+
+	uint32_t blockCount = (end - begin - 1) / grainSize + 1;
+	uint32_t threadCount = std::min(getThreadCount(), blockCount);
+
+	if (threadCount <= 1) {
+		for (uint32_t block = 0; block < blockCount; ++block) {
+			uint32_t blockBegin = begin + block * grainSize;
+			body(blockBegin, std::min(end, blockBegin + grainSize));
+		}
+		return;
+	}
+
+	std::atomic<uint32_t> nextBlock(0);
+	std::exception_ptr error;
+	std::atomic<bool> failed(false);
+
+	auto worker = [&]() {
+		try {
+			uint32_t block;
+			while (!failed && (block = nextBlock++) < blockCount) {
+				uint32_t blockBegin = begin + block * grainSize;
+				body(blockBegin, std::min(end, blockBegin + grainSize));
+			}
+		} catch (...) {
+			if (!failed.exchange(true))
+				error = std::current_exception();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount - 1);
+	for (uint32_t i = 1; i < threadCount; ++i)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &thread : threads)
+		thread.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
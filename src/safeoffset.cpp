@@ -0,0 +1,104 @@
+#include "safeoffset.h"
+#include "trianglebvh.h"
+#include "parallel.h"
+
+/* Smallest positive root of a + b h + c h^2, infinity if there is none */
+static float smallestPositiveRoot(float a, float b, float c) {
+	const float infinity = std::numeric_limits<float>::infinity();
+	if (std::abs(c) <= 1e-12f * (std::abs(a) + std::abs(b))) {
+		float h = b != 0.0f ? -a / b : infinity;
+		return h > 0.0f ? h : infinity;
+	}
+	float discriminant = b * b - 4.0f * a * c;
+	if (discriminant < 0.0f)
+		return infinity;
+	float root = std::sqrt(discriminant);
+	/* Numerically stable pair of roots */
+	float q = -0.5f * (b + (b >= 0.0f ? root : -root));
+	float h0 = q / c, h1 = q != 0.0f ? a / q : infinity;
+	float result = infinity;
+	if (h0 > 0.0f)
+		result = h0;
+	if (h1 > 0.0f)
+		result = std::min(result, h1);
+	return result;
+}
+
+uint32_t computeSafeOffsets(const MatrixXu &F, const MatrixXf &V, const MatrixXf &N, float offset, VectorXf &offsets,
+	uint32_t smoothingIterations) {
+	std::cout << "--Compute safe offsets ..." << std::endl;
+	uint32_t faceCount = (uint32_t)F.cols(), vertexCount = (uint32_t)V.cols();
+	offsets.setConstant(vertexCount, offset);
+
+	/* Folds: offset at which the offset triangle of each face flips, as a bound of its vertices */
+	VectorXf faceBounds(faceCount);
+	parallel_for(0u, faceCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t f = begin; f < end; ++f) {
+			Vector3f a = V.col(F(0, f)), na = N.col(F(0, f));
+			Vector3f e1 = V.col(F(1, f)) - a, e2 = V.col(F(2, f)) - a;
+			Vector3f d1 = N.col(F(1, f)) - na, d2 = N.col(F(2, f)) - na;
+			Vector3f n = e1.cross(e2);
+			faceBounds(f) = SAFE_OFFSET_FOLD_FRACTION * smallestPositiveRoot(n.squaredNorm(), n.dot(e1.cross(d2) + d1.cross(e2)), n.dot(d1.cross(d2)));
+		}
+	});
+	for (uint32_t f = 0; f < faceCount; ++f)
+		for (int i = 0; i < 3; ++i)
+			offsets(F(i, f)) = std::min(offsets(F(i, f)), faceBounds(f));
+
+	/* Facing and nearby parts of the base surface */
+	TriangleBVH bvh;
+	bvh.build(F, V);
+	AABB bounds = bvh.bvh().bounds();
+	float epsilon = 1e-5f * (bounds.max - bounds.min).norm();
+	parallel_for(0u, vertexCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		TriangleHit hit;
+		for (uint32_t v = begin; v < end; ++v) {
+			Vector3f p = V.col(v), n = N.col(v);
+			float h = offsets(v);
+			if (!(h > 0.0f)) {
+				offsets(v) = 0.0f;
+				continue;
+			}
+			/* The faces around v only touch the ray at its origin */
+			if (bvh.rayIntersect(Ray(p, n, epsilon, 2.0f * h), hit))
+				h = std::min(h, 0.5f * hit.t);
+
+			auto clear = [&](float height) {
+				return !bvh.closestPoint(p + height * n, hit, SAFE_OFFSET_CLEARANCE * height);
+			};
+			if (!clear(h)) {
+				float lower = 0.0f, upper = h;
+				for (int step = 0; step < SAFE_OFFSET_SEARCH_STEPS; ++step) {
+					float middle = 0.5f * (lower + upper);
+					if (clear(middle))
+						lower = middle;
+					else
+						upper = middle;
+				}
+				h = lower;
+			}
+			offsets(v) = h;
+		}
+	});
+
+	/* Smooth the clamped field without raising any offset */
+	for (uint32_t iteration = 0; iteration < smoothingIterations; ++iteration) {
+		VectorXf sums = offsets, counts = VectorXf::Ones(vertexCount);
+		for (uint32_t f = 0; f < faceCount; ++f) {
+			for (int i = 0; i < 3; ++i) {
+				uint32_t v = F(i, f);
+				sums(v) += offsets(F(i == 2 ? 0 : i + 1, f)) + offsets(F(i == 0 ? 2 : i - 1, f));
+				counts(v) += 2.0f;
+			}
+		}
+		offsets = offsets.cwiseMin(sums.cwiseQuotient(counts));
+	}
+
+	/* Averaging equal offsets may round them down by an ulp, which does not count as clamping */
+	uint32_t clamped = 0;
+	for (uint32_t v = 0; v < vertexCount; ++v)
+		clamped += offsets(v) < (1.0f - 1e-6f) * offset ? 1 : 0;
+	std::cout << "++Compute safe offsets done (" << clamped << " of " << vertexCount << " vertices clamped, minimum "
+		<< (vertexCount > 0 ? offsets.minCoeff() : 0.0f) << ")." << std::endl;
+	return clamped;
+}
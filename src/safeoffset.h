@@ -0,0 +1,39 @@
+/*
+	safeoffset.h: Per vertex offsets clamped to where the offset surface stays free of intersections
+
+	One global offset has to fit the tightest fold of the whole mesh. Instead, every vertex v gets the
+	largest offset h(v) up to the requested one which passes three tests:
+
+	- Folds: the offset triangles of the faces around v must not flip. For each face the orientation of
+	  its offset triangle is a quadratic in a common offset h, its first positive root bounds h.
+	- Facing surfaces: a ray from v along its normal hits another part of the base surface at distance
+	  t; as that part may be offset towards v as well, h is bounded by t / 2.
+	- Nearby surfaces: the offset vertex V(v) + h N(v) must keep a distance of at least h / 2 from the
+	  base surface, found by bisection with closest point queries.
+
+	The ray and closest point queries run in parallel over the vertices against a TriangleBVH of the
+	base mesh. The resulting offsets can be smoothed, which only lowers them.
+*/
+
+#pragma once
+
+#include "mycommon.h"
+
+using nanogui::MatrixXu;
+using nanogui::MatrixXf;
+using Eigen::VectorXf;
+
+/* Fraction of the offset at which an offset triangle flips that is still used */
+#define SAFE_OFFSET_FOLD_FRACTION 0.5f
+
+/* Minimum distance of an offset vertex to the base surface relative to its offset */
+#define SAFE_OFFSET_CLEARANCE 0.5f
+
+/* Bisection steps of the clearance test */
+#define SAFE_OFFSET_SEARCH_STEPS 8
+
+/* Compute offsets(v) <= offset for every vertex of the base mesh (F, V) with vertex normals N. smoothingIterations
+	replaces each offset by the smaller of itself and the average over its one ring that many times. Returns the
+	number of vertices whose offset is below 'offset'. */
+extern uint32_t computeSafeOffsets(const MatrixXu &F, const MatrixXf &V, const MatrixXf &N, float offset, VectorXf &offsets,
+	uint32_t smoothingIterations = 0);
@@ -0,0 +1,148 @@
+#include "selfintersection.h"
+#include "trianglebvh.h"
+#include "parallel.h"
+
+static inline bool sharesVertex(const MatrixXu &F, uint32_t f, uint32_t g) {
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			if (F(i, f) == F(j, g))
+				return true;
+	return false;
+}
+
+/* Distances to a plane below this fraction of the triangle size count as on the plane */
+#define SELF_INTERSECTION_EPSILON 1e-5f
+
+/* Whether the segment p -> q crosses the triangle (a, b, c); segments (nearly) parallel to the triangle do not */
+static inline bool segmentCrossesTriangle(const Vector3f &p, const Vector3f &q, const Vector3f &a, const Vector3f &b, const Vector3f &c) {
+	Vector3f d = q - p, e1 = b - a, e2 = c - a;
+	Vector3f pvec = d.cross(e2);
+	float det = e1.dot(pvec);
+	if (!(std::abs(det) > SELF_INTERSECTION_EPSILON * d.norm() * e1.cross(e2).norm()))
+		return false;
+	float invDet = 1.0f / det;
+	Vector3f tvec = p - a;
+	float u = tvec.dot(pvec) * invDet;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+	Vector3f qvec = tvec.cross(e1);
+	float v = d.dot(qvec) * invDet;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+	float t = e2.dot(qvec) * invDet;
+	return t >= 0.0f && t <= 1.0f;
+}
+
+/* Side of the vertices of t relative to the plane of s: 1 or -1 if all are strictly on one side, 2 if all are on the
+	plane (within size * SELF_INTERSECTION_EPSILON), 0 otherwise */
+static inline int planeSide(const Vector3f s[3], const Vector3f t[3], float size) {
+	Vector3f n = (s[1] - s[0]).cross(s[2] - s[0]);
+	float epsilon = SELF_INTERSECTION_EPSILON * size * n.norm();
+	int positive = 0, negative = 0;
+	for (int i = 0; i < 3; ++i) {
+		float d = n.dot(t[i] - s[0]);
+		positive += d > epsilon ? 1 : 0;
+		negative += d < -epsilon ? 1 : 0;
+	}
+	return positive == 3 ? 1 : negative == 3 ? -1 : positive + negative == 0 ? 2 : 0;
+}
+
+static bool trianglesIntersect(const Vector3f s[3], const Vector3f t[3]) {
+	AABB box;
+	for (int i = 0; i < 3; ++i) {
+		box.expandBy(s[i]);
+		box.expandBy(t[i]);
+	}
+	float size = (box.max - box.min).norm();
+	/* Coplanar pairs are left out, as are pairs separated by the plane of either triangle */
+	if (planeSide(s, t, size) != 0 || planeSide(t, s, size) != 0)
+		return false;
+	for (int i = 0; i < 3; ++i) {
+		int j = (i == 2 ? 0 : i + 1);
+		if (segmentCrossesTriangle(s[i], s[j], t[0], t[1], t[2]) || segmentCrossesTriangle(t[i], t[j], s[0], s[1], s[2]))
+			return true;
+	}
+	return false;
+}
+
+/* Set 'bit' in flags for the faces whose offset triangles intersect a triangle of bvh (built over F), skipping
+	topological neighbours. With sameSurface, bvh is over the offset triangles and each pair is tested once. */
+static void flagIntersections(const MatrixXu &F, const MatrixXf &oV, const TriangleBVH &bvh, bool sameSurface, uint8_t bit,
+	std::vector<uint8_t> &flags) {
+	uint32_t faceCount = (uint32_t)F.cols();
+	uint32_t blockCount = (faceCount + GRAIN_SIZE - 1) / GRAIN_SIZE;
+	std::vector<std::vector<uint32_t>> blockFaces(blockCount);
+	const std::vector<uint32_t> &indices = bvh.bvh().indices();
+
+	parallel_for(0u, faceCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		std::vector<uint32_t> &local = blockFaces[begin / GRAIN_SIZE];
+		Vector3f triangle[3], other[3];
+		for (uint32_t f = begin; f < end; ++f) {
+			AABB box;
+			for (int i = 0; i < 3; ++i) {
+				triangle[i] = oV.col(F(i, f));
+				box.expandBy(triangle[i]);
+			}
+			if (!std::isfinite(box.min.sum() + box.max.sum()))
+				continue;
+			bool found = false;
+			bvh.bvh().traverseBox(box, [&](uint32_t entryBegin, uint32_t entryEnd) {
+				for (uint32_t i = entryBegin; i < entryEnd; ++i) {
+					uint32_t g = indices[i];
+					if ((sameSurface && g <= f) || sharesVertex(F, f, g))
+						continue;
+					for (int c = 0; c < 3; ++c)
+						other[c] = bvh.vertex(i, c);
+					if (!trianglesIntersect(triangle, other))
+						continue;
+					found = true;
+					local.push_back(g);
+				}
+				return false;
+			});
+			if (found)
+				local.push_back(f);
+		}
+	});
+
+	for (const std::vector<uint32_t> &faces : blockFaces)
+		for (uint32_t f : faces)
+			flags[f] |= bit;
+}
+
+static uint32_t listFlaggedFaces(const std::vector<uint8_t> &flags, std::vector<uint32_t> &faces) {
+	faces.clear();
+	for (uint32_t f = 0; f < (uint32_t)flags.size(); ++f)
+		if (flags[f] != 0)
+			faces.push_back(f);
+	return (uint32_t)faces.size();
+}
+
+uint32_t detectSelfIntersections(const MatrixXu &F, const MatrixXf &oV, std::vector<uint32_t> &faces, std::vector<uint8_t> &flags) {
+	std::cout << "--Detect self-intersections of the offset surface ..." << std::endl;
+	flags.assign(F.cols(), 0);
+
+	TriangleBVH offsetBVH;
+	offsetBVH.build(F, oV);
+	flagIntersections(F, oV, offsetBVH, true, SELF_INTERSECTION_OFFSET, flags);
+
+	uint32_t count = listFlaggedFaces(flags, faces);
+	std::cout << "++Detect self-intersections done (" << count << " of " << F.cols() << " faces intersect)." << std::endl;
+	return count;
+}
+
+uint32_t detectSelfIntersections(const MatrixXu &F, const MatrixXf &bV, const MatrixXf &oV, std::vector<uint32_t> &faces,
+	std::vector<uint8_t> &flags) {
+	std::cout << "--Detect self-intersections of the offset surface and with the base surface ..." << std::endl;
+	flags.assign(F.cols(), 0);
+
+	TriangleBVH bvh;
+	bvh.build(F, oV);
+	flagIntersections(F, oV, bvh, true, SELF_INTERSECTION_OFFSET, flags);
+	bvh.build(F, bV);
+	flagIntersections(F, oV, bvh, false, SELF_INTERSECTION_BASE, flags);
+
+	uint32_t count = listFlaggedFaces(flags, faces);
+	std::cout << "++Detect self-intersections done (" << count << " of " << F.cols() << " faces intersect)." << std::endl;
+	return count;
+}
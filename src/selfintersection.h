@@ -0,0 +1,34 @@
+/*
+	selfintersection.h: Detection of self-intersections of the offset surface
+
+	Moving every vertex along its normal by the same distance makes the offset surface pass through
+	itself in concave regions whose radius of curvature is below the offset (tight folds), and
+	may push it through the base surface elsewhere. The prisms over such faces overlap or are
+	inverted.
+
+	Each offset triangle is tested against the triangles of a BVH (src/trianglebvh.h) that
+	overlap its bounding box, in parallel over the faces. Triangles sharing a vertex index are
+	topological neighbours and are not tested. Two triangles intersect iff an edge of one crosses
+	the other; (nearly) coplanar pairs, such as two faces of a flat region, are not reported.
+*/
+
+#pragma once
+
+#include "mycommon.h"
+
+#include <vector>
+
+using nanogui::MatrixXu;
+using nanogui::MatrixXf;
+
+/* Bits of the per face flags */
+#define SELF_INTERSECTION_OFFSET	0x1		// the offset triangle intersects another offset triangle
+#define SELF_INTERSECTION_BASE		0x2		// the offset triangle of one face intersects the base triangle of another, set on both
+
+/* Find the faces F whose offset triangles (vertices oV) intersect each other. faces lists them in increasing order,
+	flags has one entry per face with SELF_INTERSECTION_* bits. Returns the number of faces found. */
+extern uint32_t detectSelfIntersections(const MatrixXu &F, const MatrixXf &oV, std::vector<uint32_t> &faces, std::vector<uint8_t> &flags);
+
+/* Same as above, additionally testing the offset triangles against the base triangles (vertices bV) */
+extern uint32_t detectSelfIntersections(const MatrixXu &F, const MatrixXf &bV, const MatrixXf &oV, std::vector<uint32_t> &faces,
+	std::vector<uint8_t> &flags);
@@ -2,6 +2,14 @@
 #include "adjacenttriangles.h"
 
 void generateShellBoundSimple(const MatrixXu &bF, const MatrixXf &bV, const MatrixXf &oV, MatrixXu &boundF, MatrixXf &boundV) {
+	MatrixXi A;
+	MatrixXu8 AE;
+	buildFaceAdjacencyTable(bF, A, AE);
+
+	generateShellBoundSimple(bF, bV, oV, A, boundF, boundV);
+}
+
+void generateShellBoundSimple(const MatrixXu &bF, const MatrixXf &bV, const MatrixXf &oV, const MatrixXi &A, MatrixXu &boundF, MatrixXf &boundV) {
 	boundV.resize(bV.rows(), bV.cols() + oV.cols());
 	memcpy(boundV.data(), bV.data(), sizeof(bV(0, 0)) * bV.size());
 	memcpy(reinterpret_cast<uint8_t *>(boundV.data()) + sizeof(bV(0, 0)) * bV.size(), oV.data(), sizeof(oV(0, 0)) * oV.size());
@@ -16,17 +24,12 @@ void generateShellBoundSimple(const MatrixXu &bF, const MatrixXf &bV, const Matr
 	oF.setConstant(bV.cols());
 	oF += bF;
 
-	EdgeToAdjacentTrianglesMap adjacentMap;
-	buildEdgeAdjacentTrianglesTable(bF, adjacentMap);
-
 	std::vector<Vector3u> primF;	// prim faces generated by linking base mesh's bounding edges' points to offset mesh's
 
 	for (uint32_t f = 0; f < bF_f.cols(); ++f) {
-		uint32_t points[3] = { bF(0, f), bF(1, f), bF(2, f) };
-
 		for (int i = 0; i < 3; ++i) {
 			int j = (i == 2 ? 0 : i + 1);
-			if (lookupEdgeAdjacentTriangle(f, points[i], points[j], adjacentMap) == -1) {
+			if (A(i, f) == -1) {
 				// this is a bounding edge, generate new prism faces
 				Vector3u tri0, tri1;
 				tri0 << bF(j, f), oF(i, f), bF(i, f);
@@ -4,6 +4,10 @@
 
 using nanogui::MatrixXu;
 using nanogui::MatrixXf;
+using Eigen::MatrixXi;
 
 /* Generate a tight mesh 'box', bounding shell space between the base surface and offset surface */
-extern void generateShellBoundSimple(const MatrixXu &bF, const MatrixXf &bV, const MatrixXf &oV, MatrixXu &boundF, MatrixXf &boundV);
\ No newline at end of file
+extern void generateShellBoundSimple(const MatrixXu &bF, const MatrixXf &bV, const MatrixXf &oV, MatrixXu &boundF, MatrixXf &boundV);
+
+/* Same as above, with the face adjacency table A (see buildFaceAdjacencyTable) of the base surface given */
+extern void generateShellBoundSimple(const MatrixXu &bF, const MatrixXf &bV, const MatrixXf &oV, const MatrixXi &A, MatrixXu &boundF, MatrixXf &boundV);
\ No newline at end of file
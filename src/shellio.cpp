@@ -0,0 +1,391 @@
+#include "shellio.h"
+#include "floatformat.h"
+#include "parallel.h"
+
+#include <cstring>
+#include <cstdio>
+
+static inline uint64_t alignOffset(uint64_t offset) {
+	return (offset + SHELL_FILE_ALIGNMENT - 1) / SHELL_FILE_ALIGNMENT * SHELL_FILE_ALIGNMENT;
+}
+
+static bool isLittleEndian() {
+	uint32_t value = SHELL_FILE_BYTE_ORDER;
+	uint8_t first;
+	memcpy(&first, &value, 1);
+	return first == 0x04;
+}
+
+size_t shellSectionTypeSize(uint32_t type) {
+	switch (type) {
+	case SHELL_TYPE_FLOAT32: return 4;
+	case SHELL_TYPE_UINT32: return 4;
+	case SHELL_TYPE_UINT16: return 2;
+	case SHELL_TYPE_UINT8: return 1;
+	case SHELL_TYPE_INT32: return 4;
+	case SHELL_TYPE_FLOAT64: return 8;
+	case SHELL_TYPE_INT16: return 2;
+	case SHELL_TYPE_FLOAT16: return 2;
+	default: return 0;
+	}
+}
+
+uint64_t fnv1a(const void *data, size_t size, uint64_t hash) {
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+ShellFileWriter::ShellFileWriter(uint32_t vertexCount, uint32_t tetrahedronCount)
+	: mVertexCount(vertexCount), mTetrahedronCount(tetrahedronCount) { }
+
+void ShellFileWriter::addSection(uint32_t id, uint32_t type, uint32_t rows, uint64_t cols, const void *data) {
+	Section section;
+	memset(&section.info, 0, sizeof(ShellFileSection));
+	section.info.id = id;
+	section.info.type = type;
+	section.info.rows = rows;
+	section.info.cols = cols;
+	section.info.size = (uint64_t)rows * cols * shellSectionTypeSize(type);
+	section.data = data;
+	mSections.push_back(section);
+}
+
+void ShellFileWriter::write(const std::string &filename, bool checksum) const {
+	if (!isLittleEndian())
+		throw std::runtime_error("The binary shell format is only supported on little endian machines!");
+
+	ShellFileHeader header;
+	memset(&header, 0, sizeof(ShellFileHeader));
+	memcpy(header.magic, SHELL_FILE_MAGIC, sizeof(header.magic));
+	header.byteOrder = SHELL_FILE_BYTE_ORDER;
+	header.version = SHELL_FILE_VERSION;
+	header.flags = checksum ? SHELL_FILE_CHECKSUM : 0;
+	header.sectionCount = (uint32_t)mSections.size();
+	header.vertexCount = mVertexCount;
+	header.tetrahedronCount = mTetrahedronCount;
+
+	/* Lay out the sections */
+	std::vector<ShellFileSection> table(mSections.size());
+	uint64_t offset = alignOffset(sizeof(ShellFileHeader) + sizeof(ShellFileSection) * mSections.size());
+	for (size_t i = 0; i < mSections.size(); ++i) {
+		table[i] = mSections[i].info;
+		table[i].offset = offset;
+		if (checksum)
+			table[i].checksum = fnv1a(mSections[i].data, (size_t)table[i].size);
+		offset = alignOffset(offset + table[i].size);
+	}
+	header.fileSize = offset;
+
+	FILE *fout = fopen(filename.c_str(), "wb");
+	if (!fout)
+		throw std::runtime_error("Unable to open shell file \"" + filename + "\" for writing!");
+
+	static const uint8_t padding[SHELL_FILE_ALIGNMENT] = { 0 };
+	uint64_t position = 0;
+	auto put = [&](const void *data, uint64_t size) {
+		if (size > 0 && fwrite(data, 1, (size_t)size, fout) != size) {
+			fclose(fout);
+			throw std::runtime_error("Unable to write shell file \"" + filename + "\"!");
+		}
+		position += size;
+	};
+	auto pad = [&]() { put(padding, alignOffset(position) - position); };
+
+	put(&header, sizeof(ShellFileHeader));
+	put(table.data(), sizeof(ShellFileSection) * table.size());
+	pad();
+	for (size_t i = 0; i < mSections.size(); ++i) {
+		put(mSections[i].data, table[i].size);
+		pad();
+	}
+
+	if (fclose(fout) != 0)
+		throw std::runtime_error("Unable to write shell file \"" + filename + "\"!");
+}
+
+void saveShellBinary(const std::string &filename, const TetrahedronMesh &shell, bool checksum, bool compressed) {
+	std::cout << "Writing \"" << filename << "\" (V=" << shell.getVertexCount()
+		<< ", T=" << shell.getTetrahedronCount() << (compressed ? ", compressed" : "") << ") ..." << std::endl;
+
+	ShellFileWriter writer(shell.getVertexCount(), shell.getTetrahedronCount());
+	CompressedShellAttributes attributes;
+	float quantization[15];
+	if (compressed) {
+		compressShellAttributes(shell, attributes);
+		printCompressionError(measureCompressionError(shell, attributes));
+		packQuantization(attributes.quantization, quantization);
+		writer.addSection(SHELL_SECTION_QUANTIZATION, SHELL_TYPE_FLOAT32, 3, 5, quantization);
+		writer.addSection(SHELL_SECTION_QV, attributes.QV);
+		writer.addSection(SHELL_SECTION_QUV, attributes.QUV);
+		writer.addSection(SHELL_SECTION_QTANGENT, attributes.QT);
+		writer.addSection(SHELL_SECTION_TANGENT_COMPONENTS, SHELL_TYPE_FLOAT16, TANGENT_COMPONENT_COUNT, (uint64_t)attributes.L.cols(), attributes.L.data());
+	}
+	else {
+		writer.addSection(SHELL_SECTION_V, shell.V());
+		writer.addSection(SHELL_SECTION_UV, shell.UV());
+		writer.addSection(SHELL_SECTION_N, shell.N());
+		writer.addSection(SHELL_SECTION_DPDU, shell.DPDU());
+		writer.addSection(SHELL_SECTION_DPDV, shell.DPDV());
+	}
+	writer.addSection(SHELL_SECTION_T, shell.T());
+	if (shell.hasNeighbors())
+		writer.addSection(SHELL_SECTION_TN, shell.TN());
+	if (shell.hasOccupancy())
+		writer.addSection(SHELL_SECTION_OCCUPANCY, shell.O());
+	writer.write(filename, checksum);
+
+	std::cout << "Save shell done." << std::endl;
+}
+
+/* Vertices resp. tetrahedra formatted per chunk, at most ~4 MiB of text each */
+#define TEXT_VERTEX_CHUNK 16384
+#define TEXT_TETRAHEDRON_CHUNK 65536
+
+/* Shell is a TetrahedronMesh or an ImplicitShell, the data is read through the per element accessors */
+template <typename Shell> static void writeShellText(const std::string &filename, const Shell &shell) {
+	uint32_t vertexCount = shell.getVertexCount(), tetrahedronCount = shell.getTetrahedronCount();
+	std::cout << "Writing \"" << filename << "\" (V=" << vertexCount << ", T=" << tetrahedronCount << ") ..." << std::endl;
+	Timer<std::chrono::microseconds> timer;
+
+	FILE *fout = fopen(filename.c_str(), "wb");
+	if (!fout)
+		throw std::runtime_error("Unable to open shell file \"" + filename + "\" for writing!");
+
+	uint64_t written = 0;
+
+	auto put = [&](const char *data, size_t size) {
+		if (size > 0 && fwrite(data, 1, size, fout) != size) {
+			fclose(fout);
+			throw std::runtime_error("Unable to write shell file \"" + filename + "\"!");
+		}
+		written += size;
+	};
+
+	auto formatVertices = [&](uint32_t begin, uint32_t end, std::vector<char> &buffer) {
+		buffer.resize((size_t)(end - begin) * 15 * (FLOAT_FORMAT_MAX_LENGTH + 1));
+		char *out = buffer.data();
+		auto line = [&](const Vector3f &value, char last) {
+			for (int c = 0; c < 3; ++c) {
+				out += formatFloat(value[c], out);
+				*out++ = (c == 2) ? last : ' ';
+			}
+		};
+		for (uint32_t v = begin; v < end; ++v) {
+			line(shell.position(v), '\n');
+			line(shell.texcoord(v), '\n');
+			line(shell.normal(v), '\n');
+			line(shell.dpdu(v), ' ');
+			line(shell.dpdv(v), '\n');
+		}
+		buffer.resize(out - buffer.data());
+	};
+
+	auto formatTetrahedra = [&](uint32_t begin, uint32_t end, std::vector<char> &buffer) {
+		buffer.resize((size_t)(end - begin) * 4 * 11);
+		char *out = buffer.data();
+		for (uint32_t t = begin; t < end; ++t) {
+			Vector4u tet = shell.tetrahedron(t);
+			for (int c = 0; c < 4; ++c) {
+				out += formatUInt(tet[c], out);
+				*out++ = (c == 3) ? '\n' : ' ';
+			}
+		}
+		buffer.resize(out - buffer.data());
+	};
+
+	char header[32];
+	int headerLength = formatUInt(vertexCount, header);
+	header[headerLength++] = ' ';
+	headerLength += formatUInt(tetrahedronCount, header + headerLength);
+	header[headerLength++] = '\n';
+	put(header, headerLength);
+
+	/* Chunks [0, vertexChunks) hold vertices, the rest tetrahedra. A batch of chunks is formatted in
+	parallel and then written in order, so the memory use does not grow with the shell size. */
+	uint32_t vertexChunks = (vertexCount + TEXT_VERTEX_CHUNK - 1) / TEXT_VERTEX_CHUNK;
+	uint32_t chunkCount = vertexChunks + (tetrahedronCount + TEXT_TETRAHEDRON_CHUNK - 1) / TEXT_TETRAHEDRON_CHUNK;
+	uint32_t batchSize = 2 * getThreadCount();
+	std::vector<std::vector<char>> buffers(batchSize);
+
+	for (uint32_t batch = 0; batch < chunkCount; batch += batchSize) {
+		uint32_t batchEnd = std::min(chunkCount, batch + batchSize);
+		parallel_for(batch, batchEnd, 1, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t chunk = begin; chunk < end; ++chunk) {
+				std::vector<char> &buffer = buffers[chunk - batch];
+				if (chunk < vertexChunks) {
+					uint32_t first = chunk * TEXT_VERTEX_CHUNK;
+					formatVertices(first, std::min(vertexCount, first + TEXT_VERTEX_CHUNK), buffer);
+				}
+				else {
+					uint32_t first = (chunk - vertexChunks) * TEXT_TETRAHEDRON_CHUNK;
+					formatTetrahedra(first, std::min(tetrahedronCount, first + TEXT_TETRAHEDRON_CHUNK), buffer);
+				}
+			}
+		});
+		for (uint32_t chunk = batch; chunk < batchEnd; ++chunk)
+			put(buffers[chunk - batch].data(), buffers[chunk - batch].size());
+	}
+
+	if (fclose(fout) != 0)
+		throw std::runtime_error("Unable to write shell file \"" + filename + "\"!");
+
+	double seconds = std::max<size_t>(timer.value(), 1) * 1e-6;
+	std::cout << "Save shell done. (" << memString(written) << ", took " << timeString(seconds * 1000.0)
+		<< ", " << memString((size_t)(written / seconds)) << "/s)" << std::endl;
+}
+
+void saveShellText(const std::string &filename, const TetrahedronMesh &shell) {
+	writeShellText(filename, shell);
+}
+
+void saveShellText(const std::string &filename, const ImplicitShell &shell) {
+	writeShellText(filename, shell);
+}
+
+void MappedShell::open(const std::string &filename, bool verify) {
+	close();
+	mFile.open(filename);
+
+	auto fail = [&](const std::string &reason) {
+		mFile.close();
+		throw std::runtime_error("Invalid shell file \"" + filename + "\": " + reason);
+	};
+
+	if (mFile.size() < sizeof(ShellFileHeader))
+		fail("file too small");
+	const ShellFileHeader *header = reinterpret_cast<const ShellFileHeader *>(mFile.data());
+	if (memcmp(header->magic, SHELL_FILE_MAGIC, sizeof(header->magic)) != 0)
+		fail("not a binary shell file");
+	if (header->byteOrder != SHELL_FILE_BYTE_ORDER)
+		fail("byte order mismatch");
+	if (header->version > SHELL_FILE_VERSION)
+		fail("unsupported version " + std::to_string(header->version));
+	if (header->fileSize > mFile.size())
+		fail("truncated file");
+
+	uint64_t tableEnd = sizeof(ShellFileHeader) + (uint64_t)sizeof(ShellFileSection) * header->sectionCount;
+	if (tableEnd > mFile.size())
+		fail("truncated section table");
+
+	const ShellFileSection *sections = reinterpret_cast<const ShellFileSection *>(mFile.data() + sizeof(ShellFileHeader));
+	for (uint32_t i = 0; i < header->sectionCount; ++i) {
+		const ShellFileSection &section = sections[i];
+		size_t typeSize = shellSectionTypeSize(section.type);
+		/* Sections of unknown types are skipped, but still have to lie inside the file */
+		if (typeSize > 0 && section.size != (uint64_t)section.rows * section.cols * typeSize)
+			fail("inconsistent size of section " + std::to_string(section.id));
+		if (section.offset % SHELL_FILE_ALIGNMENT != 0 || section.offset < tableEnd ||
+			section.offset > mFile.size() || section.size > mFile.size() - section.offset)
+			fail("section " + std::to_string(section.id) + " out of bounds");
+	}
+
+	mHeader = header;
+	mSections = sections;
+
+	if (verify && !verifyChecksums()) {
+		close();
+		throw std::runtime_error("Invalid shell file \"" + filename + "\": checksum mismatch");
+	}
+}
+
+void MappedShell::close() {
+	mFile.close();
+	mHeader = nullptr;
+	mSections = nullptr;
+}
+
+const ShellFileSection *MappedShell::findSection(uint32_t id) const {
+	for (uint32_t i = 0; i < mHeader->sectionCount; ++i)
+		if (mSections[i].id == id)
+			return &mSections[i];
+	return nullptr;
+}
+
+const ShellFileSection &MappedShell::requireSection(uint32_t id, uint32_t type, uint32_t rows, uint64_t cols) const {
+	const ShellFileSection *section = findSection(id);
+	if (!section)
+		throw std::runtime_error("Shell file \"" + mFile.filename() + "\" has no section " + std::to_string(id) + "!");
+	if (section->type != type || section->rows != rows || section->cols != cols)
+		throw std::runtime_error("Section " + std::to_string(id) + " of shell file \"" + mFile.filename() + "\" has an unexpected layout!");
+	return *section;
+}
+
+MappedShell::MapXf MappedShell::mapFloat(uint32_t id, uint32_t rows, uint64_t cols) const {
+	const ShellFileSection &section = requireSection(id, SHELL_TYPE_FLOAT32, rows, cols);
+	return MapXf(reinterpret_cast<const float *>(sectionData(section)), rows, (Eigen::DenseIndex)cols);
+}
+
+MappedShell::MapXu MappedShell::mapUInt(uint32_t id, uint32_t rows, uint64_t cols) const {
+	const ShellFileSection &section = requireSection(id, SHELL_TYPE_UINT32, rows, cols);
+	return MapXu(reinterpret_cast<const uint32_t *>(sectionData(section)), rows, (Eigen::DenseIndex)cols);
+}
+
+MappedShell::MapXu8 MappedShell::O() const {
+	uint64_t cols = ((uint64_t)getTetrahedronCount() + 7) / 8;
+	const ShellFileSection &section = requireSection(SHELL_SECTION_OCCUPANCY, SHELL_TYPE_UINT8, 1, cols);
+	return MapXu8(sectionData(section), 1, (Eigen::DenseIndex)cols);
+}
+
+uint32_t MappedShell::getSweepCount() const {
+	const ShellFileSection *section = findSection(SHELL_SECTION_SWEEP_OFFSETS);
+	return section ? (uint32_t)section->cols : 0;
+}
+
+MappedShell::MapXf MappedShell::sweepLayers() const {
+	uint32_t count = getSweepCount();
+	return mapFloat(SHELL_SECTION_SWEEP_LAYERS, 3, (uint64_t)(count > 0 ? count - 1 : 0) * (getVertexCount() / 2));
+}
+
+bool MappedShell::verifyChecksums() const {
+	if (!(mHeader->flags & SHELL_FILE_CHECKSUM))
+		return true;
+	for (uint32_t i = 0; i < mHeader->sectionCount; ++i)
+		if (fnv1a(sectionData(mSections[i]), (size_t)mSections[i].size) != mSections[i].checksum)
+			return false;
+	return true;
+}
+
+CompressedShellView MappedShell::compressedAttributes() const {
+	uint32_t vertexCount = getVertexCount();
+	CompressedShellView view;
+	view.quantization = unpackQuantization(mapFloat(SHELL_SECTION_QUANTIZATION, 3, 5).data());
+	view.QV = reinterpret_cast<const uint16_t *>(sectionData(requireSection(SHELL_SECTION_QV, SHELL_TYPE_UINT16, 3, vertexCount)));
+	view.QUV = reinterpret_cast<const uint16_t *>(sectionData(requireSection(SHELL_SECTION_QUV, SHELL_TYPE_UINT16, 3, vertexCount)));
+	view.QT = reinterpret_cast<const int16_t *>(sectionData(requireSection(SHELL_SECTION_QTANGENT, SHELL_TYPE_INT16, 4, vertexCount)));
+	view.L = reinterpret_cast<const uint16_t *>(sectionData(requireSection(SHELL_SECTION_TANGENT_COMPONENTS, SHELL_TYPE_FLOAT16, TANGENT_COMPONENT_COUNT, vertexCount)));
+	view.vertexCount = vertexCount;
+	return view;
+}
+
+void MappedShell::toTetrahedronMesh(TetrahedronMesh &shell) const {
+	shell.resize(getVertexCount(), getTetrahedronCount());
+	if (isCompressed()) {
+		decompressShellAttributes(compressedAttributes(), shell);
+	}
+	else {
+		shell.V() = V();
+		shell.UV() = UV();
+		shell.N() = N();
+		shell.DPDU() = DPDU();
+		shell.DPDV() = DPDV();
+	}
+	shell.T() = T();
+	if (hasNeighbors())
+		shell.TN() = TN();
+	if (hasOccupancy())
+		shell.O() = O();
+}
+
+void MappedShell::sweepShell(uint32_t i, TetrahedronMesh &shell) const {
+	if (i >= getSweepCount())
+		throw std::runtime_error("Shell file \"" + mFile.filename() + "\" has no sweep shell " + std::to_string(i) + "!");
+	toTetrahedronMesh(shell);
+	if (i == 0)
+		return;
+	uint32_t baseCount = getVertexCount() / 2;
+	shell.V().rightCols(baseCount) = sweepLayers().middleCols((size_t)(i - 1) * baseCount, baseCount);
+}
@@ -0,0 +1,202 @@
+/*
+	shellio.h: Binary, memory mappable shell file format
+
+	Layout (little endian):
+		ShellFileHeader							64 bytes
+		ShellFileSection[sectionCount]			48 bytes each, padded to SHELL_FILE_ALIGNMENT
+		section data							each section starts at a multiple of SHELL_FILE_ALIGNMENT
+
+	A section holds one column-major matrix (rows x cols elements of the given type), so it can be
+	used in place through an Eigen::Map. Unknown section ids are skipped by readers, new data is
+	added as new sections. With SHELL_FILE_CHECKSUM every section stores the FNV-1a hash of its data.
+*/
+
+#pragma once
+
+#include "mycommon.h"
+#include "tetra.h"
+#include "implicitshell.h"
+#include "compressedshell.h"
+#include "mmapfile.h"
+
+using nanogui::MatrixXf;
+using nanogui::MatrixXu;
+
+#define SHELL_FILE_MAGIC "SHELLMAP"
+#define SHELL_FILE_VERSION 1
+#define SHELL_FILE_ALIGNMENT 64
+#define SHELL_FILE_BYTE_ORDER 0x01020304u
+
+/* Header flags */
+#define SHELL_FILE_CHECKSUM 0x1u
+
+enum SHELL_SECTION {
+	SHELL_SECTION_V = 0,		// 3 x V, float positions
+	SHELL_SECTION_UV,			// 3 x V, float texcoords (u, v, w), w = 0 on the base and 1 on the offset layer
+	SHELL_SECTION_N,			// 3 x V, float normals
+	SHELL_SECTION_DPDU,			// 3 x V, float tangents
+	SHELL_SECTION_DPDV,			// 3 x V, float tangents
+	SHELL_SECTION_T,			// 4 x T, uint32 tetrahedra
+	SHELL_SECTION_QUANTIZATION,	// 3 x 5, float ShellQuantization, see compressedshell.h
+	SHELL_SECTION_QV,			// 3 x V, uint16 quantized positions, replace SHELL_SECTION_V
+	SHELL_SECTION_QUV,			// 3 x V, uint16 quantized texcoords, replace SHELL_SECTION_UV
+	SHELL_SECTION_QTANGENT,		// 4 x V, int16 tangent frame quaternions, replace SHELL_SECTION_N
+	SHELL_SECTION_TANGENT_COMPONENTS,	// 5 x V, float16 tangent components, with QTANGENT replace SHELL_SECTION_DPDU/DPDV
+	SHELL_SECTION_TN,			// 4 x T, uint32 tetrahedron neighbours or TETRAHEDRON_* tags (optional)
+	SHELL_SECTION_OCCUPANCY,	// 1 x ceil(T / 8), uint8 occupancy bits of the tetrahedra of a sparse shell (optional)
+	SHELL_SECTION_SWEEP_OFFSETS,	// 1 x S, float offsets of a shell sweep (optional), see shellsweep.h
+	SHELL_SECTION_SWEEP_LAYERS,	// 3 x ((S - 1) * V / 2), float offset layers of shells 1 .. S - 1 of a sweep, shell 0 is SHELL_SECTION_V
+	SHELL_SECTION_COUNT
+};
+
+enum SHELL_SECTION_TYPE {
+	SHELL_TYPE_FLOAT32 = 0,
+	SHELL_TYPE_UINT32,
+	SHELL_TYPE_UINT16,
+	SHELL_TYPE_UINT8,
+	SHELL_TYPE_INT32,
+	SHELL_TYPE_FLOAT64,
+	SHELL_TYPE_INT16,
+	SHELL_TYPE_FLOAT16,
+	SHELL_TYPE_COUNT
+};
+
+struct ShellFileHeader {
+	char magic[8];					// SHELL_FILE_MAGIC
+	uint32_t byteOrder;				// SHELL_FILE_BYTE_ORDER as written by the producer
+	uint32_t version;				// SHELL_FILE_VERSION
+	uint32_t flags;					// SHELL_FILE_CHECKSUM
+	uint32_t sectionCount;
+	uint32_t vertexCount;
+	uint32_t tetrahedronCount;
+	uint64_t fileSize;
+	uint8_t reserved[24];
+};
+
+struct ShellFileSection {
+	uint32_t id;					// SHELL_SECTION
+	uint32_t type;					// SHELL_SECTION_TYPE
+	uint32_t rows;
+	uint32_t reserved;
+	uint64_t cols;
+	uint64_t offset;				// from the beginning of the file
+	uint64_t size;					// in bytes, rows * cols * element size
+	uint64_t checksum;				// FNV-1a of the data, 0 without SHELL_FILE_CHECKSUM
+};
+
+static_assert(sizeof(ShellFileHeader) == 64, "unexpected shell file header size");
+static_assert(sizeof(ShellFileSection) == 48, "unexpected shell file section size");
+
+extern size_t shellSectionTypeSize(uint32_t type);
+
+/* 64 bit FNV-1a hash */
+extern uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ull);
+
+/* Collects sections and writes them as one shell file, the data has to stay alive until write() */
+class ShellFileWriter {
+public:
+	ShellFileWriter(uint32_t vertexCount, uint32_t tetrahedronCount);
+
+	void addSection(uint32_t id, uint32_t type, uint32_t rows, uint64_t cols, const void *data);
+	void addSection(uint32_t id, const MatrixXf &M) { addSection(id, SHELL_TYPE_FLOAT32, (uint32_t)M.rows(), (uint64_t)M.cols(), M.data()); }
+	void addSection(uint32_t id, const MatrixXu &M) { addSection(id, SHELL_TYPE_UINT32, (uint32_t)M.rows(), (uint64_t)M.cols(), M.data()); }
+	void addSection(uint32_t id, const Eigen::MatrixXi &M) { addSection(id, SHELL_TYPE_INT32, (uint32_t)M.rows(), (uint64_t)M.cols(), M.data()); }
+	void addSection(uint32_t id, const MatrixXu8 &M) { addSection(id, SHELL_TYPE_UINT8, (uint32_t)M.rows(), (uint64_t)M.cols(), M.data()); }
+	void addSection(uint32_t id, const MatrixXu16 &M) { addSection(id, SHELL_TYPE_UINT16, (uint32_t)M.rows(), (uint64_t)M.cols(), M.data()); }
+	void addSection(uint32_t id, const MatrixXi16 &M) { addSection(id, SHELL_TYPE_INT16, (uint32_t)M.rows(), (uint64_t)M.cols(), M.data()); }
+
+	void write(const std::string &filename, bool checksum = true) const;
+
+private:
+	struct Section {
+		ShellFileSection info;
+		const void *data;
+	};
+
+	uint32_t mVertexCount, mTetrahedronCount;
+	std::vector<Section> mSections;
+};
+
+/* Save the shell in the binary format, the equivalent of saveShellToMitsuba(). With compressed the vertex
+   attributes are stored quantized (compressShellAttributes()) instead of as floats, the error is printed. */
+extern void saveShellBinary(const std::string &filename, const TetrahedronMesh &shell, bool checksum = true, bool compressed = false);
+
+/* Save the shell in the text format of the ctcloth tetra.h reader ("V T" header, per vertex the lines
+   "x y z", "u v w", "nx ny nz" and "dpdu dpdv", then one "a b c d" line per tetrahedron). Numbers are
+   written with the shortest representation that reads back exactly, vertex and tetrahedron blocks are
+   formatted in parallel and written in order. */
+extern void saveShellText(const std::string &filename, const TetrahedronMesh &shell);
+
+/* The same for an implicit shell, the vertices and tetrahedra are generated while formatting */
+extern void saveShellText(const std::string &filename, const ImplicitShell &shell);
+
+/* Shell file mapped into memory, the sections are accessed in place */
+class MappedShell {
+public:
+	typedef Eigen::Map<const MatrixXf, Eigen::Aligned> MapXf;
+	typedef Eigen::Map<const MatrixXu, Eigen::Aligned> MapXu;
+	typedef Eigen::Map<const MatrixXu8, Eigen::Aligned> MapXu8;
+
+	MappedShell() : mHeader(nullptr), mSections(nullptr) { }
+	explicit MappedShell(const std::string &filename, bool verify = false) : MappedShell() { open(filename, verify); }
+
+	/* Map the file and validate the header and the section table; with verify also the checksums */
+	void open(const std::string &filename, bool verify = false);
+	void close();
+
+	inline bool isOpen() const { return mHeader != nullptr; }
+	inline const ShellFileHeader &header() const { return *mHeader; }
+	inline uint32_t getVertexCount() const { return mHeader->vertexCount; }
+	inline uint32_t getTetrahedronCount() const { return mHeader->tetrahedronCount; }
+	inline uint32_t getSectionCount() const { return mHeader->sectionCount; }
+	inline const ShellFileSection &section(uint32_t index) const { return mSections[index]; }
+
+	/* First section with the given id, nullptr if there is none */
+	const ShellFileSection *findSection(uint32_t id) const;
+	inline const uint8_t *sectionData(const ShellFileSection &section) const { return mFile.data() + section.offset; }
+
+	/* Views of the standard sections, throw if a section is missing or has the wrong type or shape */
+	MapXf V() const { return mapFloat(SHELL_SECTION_V, 3, getVertexCount()); }
+	MapXf UV() const { return mapFloat(SHELL_SECTION_UV, 3, getVertexCount()); }
+	MapXf N() const { return mapFloat(SHELL_SECTION_N, 3, getVertexCount()); }
+	MapXf DPDU() const { return mapFloat(SHELL_SECTION_DPDU, 3, getVertexCount()); }
+	MapXf DPDV() const { return mapFloat(SHELL_SECTION_DPDV, 3, getVertexCount()); }
+	MapXu T() const { return mapUInt(SHELL_SECTION_T, 4, getTetrahedronCount()); }
+
+	/* Files written with compressed attributes have the quantized sections instead of V, UV, N, DPDU, DPDV */
+	inline bool isCompressed() const { return findSection(SHELL_SECTION_QTANGENT) != nullptr; }
+
+	/* Neighbour table, only present if it was computed for the saved shell */
+	inline bool hasNeighbors() const { return findSection(SHELL_SECTION_TN) != nullptr; }
+	MapXu TN() const { return mapUInt(SHELL_SECTION_TN, 4, getTetrahedronCount()); }
+
+	/* Occupancy bits, only present in sparse shells (see TetrahedronMesh::O()) */
+	inline bool hasOccupancy() const { return findSection(SHELL_SECTION_OCCUPANCY) != nullptr; }
+	MapXu8 O() const;
+
+	/* Shell sweeps store the first shell in the standard sections and the offset layers of the other shells */
+	inline bool hasSweep() const { return findSection(SHELL_SECTION_SWEEP_OFFSETS) != nullptr; }
+	uint32_t getSweepCount() const;
+	MapXf sweepOffsets() const { return mapFloat(SHELL_SECTION_SWEEP_OFFSETS, 1, getSweepCount()); }
+	MapXf sweepLayers() const;
+	CompressedShellView compressedAttributes() const;
+
+	MapXf mapFloat(uint32_t id, uint32_t rows, uint64_t cols) const;
+	MapXu mapUInt(uint32_t id, uint32_t rows, uint64_t cols) const;
+
+	/* Recompute the checksums of all sections (reads the whole file) */
+	bool verifyChecksums() const;
+
+	/* Copy into an in-memory tetrahedron mesh, compressed attributes are decoded */
+	void toTetrahedronMesh(TetrahedronMesh &shell) const;
+
+	/* Copy shell i of a sweep into an in-memory tetrahedron mesh */
+	void sweepShell(uint32_t i, TetrahedronMesh &shell) const;
+
+private:
+	const ShellFileSection &requireSection(uint32_t id, uint32_t type, uint32_t rows, uint64_t cols) const;
+
+	MemoryMappedFile mFile;
+	const ShellFileHeader *mHeader;
+	const ShellFileSection *mSections;
+};
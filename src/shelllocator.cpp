@@ -0,0 +1,153 @@
+#include "shelllocator.h"
+#include "simd.h"
+#include "parallel.h"
+
+#include <limits>
+
+/* Tetrahedra with |det [a - d, b - d, c - d]| below this fraction of the cubed longest edge are degenerate */
+#define DEGENERATE_TETRAHEDRON_RATIO 1e-9f
+
+/* Inverse edge matrix of tetrahedron t, false if it is degenerate */
+static bool tetrahedronInverse(const TetrahedronMesh &shell, uint32_t t, Eigen::Matrix3f &M, Vector3f &d) {
+	const MatrixXu &T = shell.T();
+	const MatrixXf &V = shell.V();
+	d = V.col(T(3, t));
+	Eigen::Matrix3f E;
+	float longest = 0.0f;
+	for (int i = 0; i < 3; ++i) {
+		E.col(i) = V.col(T(i, t)) - d;
+		longest = std::max(longest, E.col(i).squaredNorm());
+	}
+	longest = std::sqrt(longest);
+	float det = E.determinant();
+	if (!(std::abs(det) > DEGENERATE_TETRAHEDRON_RATIO * longest * longest * longest))
+		return false;
+	M = E.inverse();
+	return true;
+}
+
+void ShellPointLocator::build(const TetrahedronMesh &shell) {
+	mShell = &shell;
+	uint32_t tetrahedronCount = shell.getTetrahedronCount(), vertexCount = shell.getVertexCount();
+	const MatrixXu &T = shell.T();
+	const MatrixXf &V = shell.V();
+
+	/* Bounds of the non-degenerate tetrahedra, degenerate ones keep empty bounds and are left out */
+	std::vector<AABB> bounds(tetrahedronCount);
+	parallel_for(0u, tetrahedronCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		Eigen::Matrix3f M;
+		Vector3f d;
+		for (uint32_t t = begin; t < end; ++t) {
+			if (T.col(t).maxCoeff() >= vertexCount)
+				throw std::runtime_error("ShellPointLocator::build(): invalid vertex index in tetrahedron " + std::to_string(t) + "!");
+			if (!tetrahedronInverse(shell, t, M, d))
+				continue;
+			for (int i = 0; i < 4; ++i)
+				bounds[t].expandBy(V.col(T(i, t)));
+		}
+	});
+
+	mBVH.build(bounds);
+
+	/* Packets in leaf order */
+	const std::vector<uint32_t> &indices = mBVH.indices();
+	uint32_t count = (uint32_t)indices.size(), packetCount = (count + 3) / 4;
+	mPackets.resize(packetCount);
+	parallel_for(0u, packetCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		const float nan = std::numeric_limits<float>::quiet_NaN();
+		Eigen::Matrix3f M;
+		Vector3f d;
+		for (uint32_t p = begin; p < end; ++p) {
+			TetrahedronPacket &packet = mPackets[p];
+			for (int lane = 0; lane < 4; ++lane) {
+				uint32_t slot = 4 * p + lane;
+				bool valid = slot < count;
+				if (valid)
+					tetrahedronInverse(shell, indices[slot], M, d);
+				for (int i = 0; i < 9; ++i)
+					packet.M[i][lane] = valid ? M(i / 3, i % 3) : nan;
+				for (int i = 0; i < 3; ++i)
+					packet.d[i][lane] = valid ? d[i] : nan;
+				packet.tetrahedron[lane] = valid ? indices[slot] : SHELL_POINT_OUTSIDE;
+			}
+		}
+	});
+}
+
+/* First lane of the packet containing p, -1 if there is none */
+template <typename P> static int findTetrahedron(const TetrahedronPacket &packet, const Vector3f &p, Vector4f &barycentric) {
+	const int W = P::Width;
+	for (int l = 0; l < 4; l += W) {
+		P dx = P(p[0]) - P::load(packet.d[0] + l);
+		P dy = P(p[1]) - P::load(packet.d[1] + l);
+		P dz = P(p[2]) - P::load(packet.d[2] + l);
+		P lambda[3];
+		for (int i = 0; i < 3; ++i)
+			lambda[i] = P::load(packet.M[3 * i] + l) * dx + P::load(packet.M[3 * i + 1] + l) * dy + P::load(packet.M[3 * i + 2] + l) * dz;
+		P last = P(1.0f) - lambda[0] - lambda[1] - lambda[2];
+		P lowest = min(min(lambda[0], lambda[1]), min(lambda[2], last));
+
+		int bits = maskBits(lt(P(-SHELL_POINT_EPSILON), lowest));
+		if (bits == 0)
+			continue;
+		int lane = 0;
+		while ((bits & (1 << lane)) == 0)
+			++lane;
+		float values[W];
+		for (int i = 0; i < 3; ++i) {
+			lambda[i].store(values);
+			barycentric[i] = values[lane];
+		}
+		last.store(values);
+		barycentric[3] = values[lane];
+		return l + lane;
+	}
+	return -1;
+}
+
+bool ShellPointLocator::locate(const Vector3f &p, ShellPoint &result) const {
+	result.tetrahedron = SHELL_POINT_OUTSIDE;
+	bool found = mBVH.traversePoint(p, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t packet = begin / 4; packet <= (end - 1) / 4; ++packet) {
+			int lane = findTetrahedron<PacketDefault>(mPackets[packet], p, result.barycentric);
+			if (lane >= 0) {
+				result.tetrahedron = mPackets[packet].tetrahedron[lane];
+				return true;
+			}
+		}
+		return false;
+	});
+	if (!found) {
+		result.barycentric.setZero();
+		result.uvw.setZero();
+		return false;
+	}
+
+	const MatrixXu &T = mShell->T();
+	const MatrixXf &UV = mShell->UV();
+	result.uvw.setZero();
+	for (int i = 0; i < 4; ++i)
+		result.uvw += result.barycentric[i] * UV.col(T(i, result.tetrahedron));
+	return true;
+}
+
+void ShellPointLocator::locate(const MatrixXf &points, std::vector<uint32_t> &tetrahedra, MatrixXf &barycentrics, MatrixXf &uvw) const {
+	uint32_t pointCount = (uint32_t)points.cols();
+	tetrahedra.resize(pointCount);
+	barycentrics.resize(4, pointCount);
+	uvw.resize(3, pointCount);
+
+	parallel_for(0u, pointCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		ShellPoint result;
+		for (uint32_t i = begin; i < end; ++i) {
+			locate(points.col(i), result);
+			tetrahedra[i] = result.tetrahedron;
+			barycentrics.col(i) = result.barycentric;
+			uvw.col(i) = result.uvw;
+		}
+	});
+}
+
+size_t ShellPointLocator::memoryUsage() const {
+	return mBVH.memoryUsage() + sizeof(TetrahedronPacket) * mPackets.size();
+}
@@ -0,0 +1,67 @@
+/*
+	shelllocator.h: Mapping of world space points inside the shell to texture space (u, v, w)
+
+	A point p inside tetrahedron (a, b, c, d) has the barycentric coordinates
+		(l0, l1, l2) = M * (p - d),  l3 = 1 - l0 - l1 - l2,  M = [a - d, b - d, c - d]^-1
+	and the texture coordinate l0 * uvw(a) + l1 * uvw(b) + l2 * uvw(c) + l3 * uvw(d).
+
+	ShellPointLocator precomputes M and d of every non-degenerate tetrahedron and stores them in
+	BVH leaf order, four tetrahedra per packet in structure of arrays layout, so one SIMD test
+	decides which tetrahedra of a leaf contain the point. The tetrahedra are found through a BVH
+	(bvh.h) over their bounding boxes.
+*/
+
+#pragma once
+
+#include "mycommon.h"
+#include "tetra.h"
+#include "bvh.h"
+
+using nanogui::MatrixXf;
+using nanogui::Vector3f;
+using Eigen::Vector4f;
+
+/* Tetrahedron index of points outside of the shell */
+#define SHELL_POINT_OUTSIDE 0xFFFFFFFFu
+
+/* Points within this barycentric distance of a tetrahedron count as inside, closes gaps on shared faces */
+#define SHELL_POINT_EPSILON 1e-5f
+
+/* Four tetrahedra in structure of arrays layout; unused lanes have NaN entries and contain no point */
+struct TetrahedronPacket {
+	float M[9][4];			// row-major inverse edge matrix
+	float d[3][4];			// fourth vertex
+	uint32_t tetrahedron[4];
+};
+
+struct ShellPoint {
+	uint32_t tetrahedron;	// SHELL_POINT_OUTSIDE if the point is not inside the shell
+	Vector4f barycentric;	// weights of the vertices T.col(tetrahedron)
+	Vector3f uvw;
+};
+
+class ShellPointLocator {
+public:
+	ShellPointLocator() : mShell(nullptr) { }
+
+	/* Precompute the inverse matrices and build the BVH; the shell is referenced, it has to outlive the locator */
+	void build(const TetrahedronMesh &shell);
+
+	/* Map one point */
+	bool locate(const Vector3f &p, ShellPoint &result) const;
+
+	/* Map the points (3 x N) in parallel: tetrahedra[i] is SHELL_POINT_OUTSIDE or the tetrahedron containing
+	   points.col(i), barycentrics (4 x N) and uvw (3 x N) are zero for points outside of the shell */
+	void locate(const MatrixXf &points, std::vector<uint32_t> &tetrahedra, MatrixXf &barycentrics, MatrixXf &uvw) const;
+
+	inline const BVH &bvh() const { return mBVH; }
+	inline uint32_t getTetrahedronCount() const { return (uint32_t)mBVH.indices().size(); }
+
+	/* Bytes used by the BVH and the tetrahedron packets */
+	size_t memoryUsage() const;
+
+private:
+	const TetrahedronMesh *mShell;
+	BVH mBVH;
+	std::vector<TetrahedronPacket> mPackets;
+};
@@ -0,0 +1,584 @@
+/*
+	shellmapscli.cpp: Headless batch front end running the whole shell maps pipeline
+
+	Chains the same steps as the "Open -> Generate -> Compute -> Construct -> Save" workflow of the
+	viewer without creating any window or OpenGL context, and reports time and peak memory per stage.
+*/
+
+#include "mycommon.h"
+#include "meshio.h"
+#include "meshstats.h"
+#include "normal.h"
+#include "tangent.h"
+#include "shellmapshelper.h"
+#include "shellbounds.h"
+#include "cornerkernel.h"
+#include "shellio.h"
+#include "adjacenttriangles.h"
+#include "stagecache.h"
+#include "implicitshell.h"
+#include "selfintersection.h"
+#include "safeoffset.h"
+#include "heightmap.h"
+#include "occupancy.h"
+#include "shellsweep.h"
+#include "parallel.h"
+
+#include <cstring>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+/* Peak resident set size of this process in bytes */
+static size_t peakMemoryUsage() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return (size_t)counters.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#if defined(__APPLE__)
+	return (size_t)usage.ru_maxrss;			// bytes on Mac OS
+#else
+	return (size_t)usage.ru_maxrss * 1024;	// kilobytes on Linux
+#endif
+#endif
+}
+
+/* Stages of small meshes take well below a millisecond, so they are timed in microseconds */
+static void reportStage(const std::string &stage, Timer<std::chrono::microseconds> &timer) {
+	std::cout << "[" << stage << "] took " << timeString(timer.reset() / 1000.0, true)
+		<< ", peak memory " << memString(peakMemoryUsage()) << std::endl;
+}
+
+/* Time the separate vertex normal and tangent passes and the fused pass with 1, 2, 4, .., 64 threads */
+static void reportScaling(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV) {
+	typedef Timer<std::chrono::microseconds> MicroTimer;
+	uint32_t threadCount = getThreadCount();
+	std::vector<uint32_t> threads;
+	std::vector<double> normalTimes, tangentTimes, fusedTimes;
+
+	for (uint32_t t = 1; t <= 64; t *= 2) {
+		MatrixXf N, DPDU, DPDV;
+		setThreadCount(t);
+
+		MicroTimer timer;
+		computeVertexNormals(F, V, N, true);
+		double normalTime = timer.reset() / 1000.0;
+		computeVertexTangents(F, V, UV, DPDU, DPDV, true);
+		double tangentTime = timer.reset() / 1000.0;
+		MeshStats stats;
+		computeVertexAttributes(F, V, UV, N, DPDU, DPDV, stats, true);
+		double fusedTime = timer.reset() / 1000.0;
+
+		threads.push_back(t);
+		normalTimes.push_back(normalTime);
+		tangentTimes.push_back(tangentTime);
+		fusedTimes.push_back(fusedTime);
+	}
+	setThreadCount(threadCount);
+
+	std::cout << "Scaling (hardware threads: " << std::thread::hardware_concurrency() << "):" << std::endl;
+	std::cout << std::setw(8) << "threads" << std::setw(14) << "normals" << std::setw(10) << "speedup"
+		<< std::setw(14) << "tangents" << std::setw(10) << "speedup"
+		<< std::setw(14) << "fused" << std::setw(10) << "speedup" << std::endl;
+	for (size_t i = 0; i < threads.size(); ++i) {
+		std::cout << std::setw(8) << threads[i]
+			<< std::setw(14) << timeString(normalTimes[i], true)
+			<< std::setw(9) << std::setprecision(2) << std::fixed << normalTimes[0] / normalTimes[i] << "x"
+			<< std::setw(14) << timeString(tangentTimes[i], true)
+			<< std::setw(9) << std::setprecision(2) << std::fixed << tangentTimes[0] / tangentTimes[i] << "x"
+			<< std::setw(14) << timeString(fusedTimes[i], true)
+			<< std::setw(9) << std::setprecision(2) << std::fixed << fusedTimes[0] / fusedTimes[i] << "x" << std::endl;
+	}
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout << std::setprecision(6);
+}
+
+/* Map a binary shell file and print its header and section table */
+static void printShellInfo(const std::string &filename, bool verify) {
+	Timer<std::chrono::microseconds> timer;
+	MappedShell shell(filename);
+	double openTime = timer.reset() / 1000.0;
+
+	const ShellFileHeader &header = shell.header();
+	std::cout << "\"" << filename << "\": version " << header.version << ", V=" << shell.getVertexCount()
+		<< ", T=" << shell.getTetrahedronCount() << ", " << memString(header.fileSize)
+		<< ", mapped in " << timeString(openTime, true) << std::endl;
+	for (uint32_t i = 0; i < shell.getSectionCount(); ++i) {
+		const ShellFileSection &section = shell.section(i);
+		std::cout << "   section " << section.id << ": " << section.rows << " x " << section.cols
+			<< " (type " << section.type << "), " << memString(section.size) << " at offset " << section.offset << std::endl;
+	}
+	if (shell.isCompressed())
+		std::cout << "   compressed vertex attributes" << std::endl;
+	if (shell.hasSweep()) {
+		std::cout << "   sweep over " << shell.getSweepCount() << " offsets:";
+		for (uint32_t i = 0; i < shell.getSweepCount(); ++i)
+			std::cout << " " << shell.sweepOffsets()(0, i);
+		std::cout << std::endl;
+	}
+
+	if (verify) {
+		bool valid = shell.verifyChecksums();
+		std::cout << "Checksums " << ((header.flags & SHELL_FILE_CHECKSUM) ? (valid ? "valid" : "INVALID") : "not stored")
+			<< " (took " << timeString(timer.reset() / 1000.0, true) << ")" << std::endl;
+		if (!valid)
+			throw std::runtime_error("Checksum mismatch in \"" + filename + "\"");
+	}
+}
+
+/* File name of shell i of a sweep, the index goes before the extension: shell.dat -> shell.2.dat */
+static std::string sweepFileName(const std::string &filename, uint32_t i) {
+	size_t dot = filename.find_last_of('.'), slash = filename.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return filename + "." + std::to_string(i);
+	return filename.substr(0, dot) + "." + std::to_string(i) + filename.substr(dot);
+}
+
+static void help() {
+	std::cout << "Syntax: shellmaps-cli [options] <input mesh (OBJ)>" << std::endl;
+	std::cout << "Options:" << std::endl;
+	std::cout << "   -o, --offset <value>   Offset distance of the offset surface (default: average edge length)" << std::endl;
+	std::cout << "   --sweep <o1,o2,...>    Build the shells for all offsets, sharing the adjacency, patterns, tetrahedra and" << std::endl;
+	std::cout << "                          vertex attributes; -B writes them into one file, -s one file per offset" << std::endl;
+	std::cout << "   --safe-offset          Clamp the offset per vertex where the offset surface would fold or approach" << std::endl;
+	std::cout << "                          other parts of the base surface" << std::endl;
+	std::cout << "   --offset-smoothing <n> Smoothing iterations of the clamped per vertex offsets (default: 0)" << std::endl;
+	std::cout << "   --height-map <image>   Offset each vertex by the maximum height around it in an image over the UV" << std::endl;
+	std::cout << "                          domain, the offset being the height of a white texel" << std::endl;
+	std::cout << "   --self-intersections   Report the faces whose offset triangles intersect each other or the base surface" << std::endl;
+	std::cout << "   -s, --shell <file>     Save the shell (tetrahedron mesh) in mitsuba format" << std::endl;
+	std::cout << "   -B, --binary <file>    Save the shell in the binary, memory mappable shell format" << std::endl;
+	std::cout << "   --occupancy <file>     Leave out the prisms without content: an image over the UV domain (texels" << std::endl;
+	std::cout << "                          above 0 are occupied) or a .txt file of \"u0 v0 [w0] u1 v1 [w1]\" boxes" << std::endl;
+	std::cout << "   --implicit             Keep the shell as base mesh, offsets and packed split patterns instead of" << std::endl;
+	std::cout << "                          explicit tetrahedra (needs about 2.5x less memory)" << std::endl;
+	std::cout << "   --compress             Store quantized positions/texcoords and quaternion tangent frames in the" << std::endl;
+	std::cout << "                          binary shell file (30 instead of 60 bytes per vertex), prints the error" << std::endl;
+	std::cout << "   --no-checksum          Do not store checksums in the binary shell file" << std::endl;
+	std::cout << "   --neighbors            Compute the tetrahedron neighbour table and store it in the binary shell file" << std::endl;
+	std::cout << "   --info <file>          Print the sections of a binary shell file and verify its checksums" << std::endl;
+	std::cout << "   -b, --bound <file>     Save the bounding mesh of the shell space as OBJ" << std::endl;
+	std::cout << "   -p, --pattern <solver> Split pattern solver: \"bounded-dfs\" (default), \"dfs\" or \"vertex-order\"" << std::endl;
+	std::cout << "   --search-budget <n>    Maximum number of faces visited by one bounded DFS repair (default: " << SPLIT_PATTERN_SEARCH_BUDGET << ")" << std::endl;
+	std::cout << "   -c, --cache <dir>      Reuse the mesh, normals, tangents, adjacency and patterns of earlier runs" << std::endl;
+	std::cout << "                          on the same input, stored in the given directory" << std::endl;
+	std::cout << "   -t, --threads <count>  Number of threads used for parallelizable computations" << std::endl;
+#if !defined(NDEBUG)
+	std::cout << "   --check-kernel         Compare the fused normal/tangent kernel with the serial passes on a mesh with" << std::endl;
+	std::cout << "                          degenerate faces" << std::endl;
+#endif
+	std::cout << "   --scaling              Report the scaling of normal/tangent computation over 1-64 threads" << std::endl;
+	std::cout << "   -h, --help             Display this message" << std::endl;
+}
+
+int main(int argc, char **argv) {
+	std::string input, shellFile, binaryFile, boundFile, infoFile, cacheDirectory, heightMapFile, occupancyFile;
+	float offset = -1.0f;
+	std::vector<float> sweep;
+	SPLIT_PATTERN_SOLVER solver = SPLIT_PATTERN_SOLVER_BOUNDED_DFS;
+	uint32_t searchBudget = SPLIT_PATTERN_SEARCH_BUDGET, offsetSmoothing = 0;
+	bool scaling = false, checksum = true, implicit = false, compress = false, neighbors = false, selfIntersections = false;
+	bool safeOffset = false;
+#if !defined(NDEBUG)
+	bool checkKernel = false;
+#endif
+
+	try {
+		for (int i = 1; i < argc; ++i) {
+			if (strcmp("--offset", argv[i]) == 0 || strcmp("-o", argv[i]) == 0) {
+				if (++i >= argc) {
+					std::cerr << "Missing offset argument!" << std::endl;
+					return -1;
+				}
+				char *end_ptr = nullptr;
+				offset = strtof(argv[i], &end_ptr);
+				if (*end_ptr != '\0' || offset < 0.0f)
+					throw std::runtime_error("Could not parse offset \"" + std::string(argv[i]) + "\"");
+			}
+			else if (strcmp("--sweep", argv[i]) == 0) {
+				if (++i >= argc) {
+					std::cerr << "Missing sweep offsets argument!" << std::endl;
+					return -1;
+				}
+				const char *begin = argv[i];
+				while (true) {
+					char *end_ptr = nullptr;
+					float value = strtof(begin, &end_ptr);
+					if (end_ptr == begin || (*end_ptr != ',' && *end_ptr != '\0') || value < 0.0f)
+						throw std::runtime_error("Could not parse sweep offsets \"" + std::string(argv[i]) + "\"");
+					sweep.push_back(value);
+					if (*end_ptr == '\0')
+						break;
+					begin = end_ptr + 1;
+				}
+			}
+			else if (strcmp("--safe-offset", argv[i]) == 0) {
+				safeOffset = true;
+			}
+			else if (strcmp("--offset-smoothing", argv[i]) == 0) {
+				if (++i >= argc) {
+					std::cerr << "Missing offset smoothing argument!" << std::endl;
+					return -1;
+				}
+				offsetSmoothing = str_to_uint32_t(argv[i]);
+			}
+			else if (strcmp("--height-map", argv[i]) == 0) {
+				if (++i >= argc) {
+					std::cerr << "Missing height map argument!" << std::endl;
+					return -1;
+				}
+				heightMapFile = argv[i];
+			}
+			else if (strcmp("--occupancy", argv[i]) == 0) {
+				if (++i >= argc) {
+					std::cerr << "Missing occupancy argument!" << std::endl;
+					return -1;
+				}
+				occupancyFile = argv[i];
+			}
+			else if (strcmp("--self-intersections", argv[i]) == 0) {
+				selfIntersections = true;
+			}
+			else if (strcmp("--shell", argv[i]) == 0 || strcmp("-s", argv[i]) == 0) {
+				if (++i >= argc) {
+					std::cerr << "Missing shell file argument!" << std::endl;
+					return -1;
+				}
+				shellFile = argv[i];
+			}
+			else if (strcmp("--binary", argv[i]) == 0 || strcmp("-B", argv[i]) == 0) {
+				if (++i >= argc) {
+					std::cerr << "Missing binary shell file argument!" << std::endl;
+					return -1;
+				}
+				binaryFile = argv[i];
+			}
+			else if (strcmp("--implicit", argv[i]) == 0) {
+				implicit = true;
+			}
+			else if (strcmp("--compress", argv[i]) == 0) {
+				compress = true;
+			}
+			else if (strcmp("--neighbors", argv[i]) == 0) {
+				neighbors = true;
+			}
+			else if (strcmp("--no-checksum", argv[i]) == 0) {
+				checksum = false;
+			}
+			else if (strcmp("--info", argv[i]) == 0) {
+				if (++i >= argc) {
+					std::cerr << "Missing shell file argument!" << std::endl;
+					return -1;
+				}
+				infoFile = argv[i];
+			}
+			else if (strcmp("--bound", argv[i]) == 0 || strcmp("-b", argv[i]) == 0) {
+				if (++i >= argc) {
+					std::cerr << "Missing bound file argument!" << std::endl;
+					return -1;
+				}
+				boundFile = argv[i];
+			}
+			else if (strcmp("--pattern", argv[i]) == 0 || strcmp("-p", argv[i]) == 0) {
+				if (++i >= argc) {
+					std::cerr << "Missing pattern solver argument!" << std::endl;
+					return -1;
+				}
+				if (strcmp("bounded-dfs", argv[i]) == 0)
+					solver = SPLIT_PATTERN_SOLVER_BOUNDED_DFS;
+				else if (strcmp("dfs", argv[i]) == 0)
+					solver = SPLIT_PATTERN_SOLVER_DFS;
+				else if (strcmp("vertex-order", argv[i]) == 0)
+					solver = SPLIT_PATTERN_SOLVER_VERTEX_ORDER;
+				else
+					throw std::runtime_error("Unknown pattern solver \"" + std::string(argv[i]) + "\"");
+			}
+			else if (strcmp("--search-budget", argv[i]) == 0) {
+				if (++i >= argc) {
+					std::cerr << "Missing search budget!" << std::endl;
+					return -1;
+				}
+				searchBudget = str_to_uint32_t(argv[i]);
+			}
+			else if (strcmp("--cache", argv[i]) == 0 || strcmp("-c", argv[i]) == 0) {
+				if (++i >= argc) {
+					std::cerr << "Missing cache directory argument!" << std::endl;
+					return -1;
+				}
+				cacheDirectory = argv[i];
+			}
+			else if (strcmp("--threads", argv[i]) == 0 || strcmp("-t", argv[i]) == 0) {
+				if (++i >= argc) {
+					std::cerr << "Missing thread count!" << std::endl;
+					return -1;
+				}
+				setThreadCount(str_to_uint32_t(argv[i]));
+			}
+#if !defined(NDEBUG)
+			else if (strcmp("--check-kernel", argv[i]) == 0) {
+				checkKernel = true;
+			}
+#endif
+			else if (strcmp("--scaling", argv[i]) == 0) {
+				scaling = true;
+			}
+			else if (strcmp("--help", argv[i]) == 0 || strcmp("-h", argv[i]) == 0) {
+				help();
+				return 0;
+			}
+			else {
+				if (strncmp(argv[i], "-", 1) == 0) {
+					std::cerr << "Invalid argument: \"" << argv[i] << "\"!" << std::endl;
+					help();
+					return -1;
+				}
+				input = argv[i];
+			}
+		}
+
+#if !defined(NDEBUG)
+		if (checkKernel) {
+			if (!checkCornerKernel())
+				return -1;
+			if (input.empty() && infoFile.empty())
+				return 0;
+		}
+#endif
+
+		if (!infoFile.empty()) {
+			printShellInfo(infoFile, true);
+			if (input.empty())
+				return 0;
+		}
+
+		if (input.empty()) {
+			help();
+			return -1;
+		}
+		if (implicit && !occupancyFile.empty())
+			throw std::runtime_error("--occupancy needs the explicit tetrahedra and cannot be combined with --implicit");
+		if (!sweep.empty() && (implicit || compress || safeOffset || selfIntersections || !occupancyFile.empty() || !boundFile.empty()))
+			throw std::runtime_error("--sweep cannot be combined with --implicit, --compress, --safe-offset, --self-intersections, "
+				"--occupancy or --bound");
+
+		Timer<> total;
+		Timer<std::chrono::microseconds> timer;
+		MatrixXu F, P;
+		MatrixXf V, UV, N, DPDU, DPDV;
+		StageCache cache(cacheDirectory);
+
+		uint64_t key = cache.objKey(input);
+		if (!cache.loadObj(key, F, V, UV)) {
+			loadObjShareVertexNotShareTexcoord(input, F, V, UV);
+			cache.storeObj(key, F, V, UV);
+		}
+		if (UV.cols() == 0)
+			throw std::runtime_error("Input mesh \"" + input + "\" has no texture coordinates!");
+		normalizeTexcoords(UV);
+		reportStage("load", timer);
+
+		MeshStats stats;
+		key = cache.vertexAttributesKey(F, V, UV, true);
+		if (!cache.loadVertexAttributes(key, N, DPDU, DPDV, stats)) {
+			computeVertexAttributes(F, V, UV, N, DPDU, DPDV, stats, true);
+			cache.storeVertexAttributes(key, N, DPDU, DPDV, stats);
+		}
+		reportStage("normals, tangents, stats", timer);
+
+		if (scaling) {
+			reportScaling(F, V, UV);
+			timer.reset();
+		}
+
+		if (offset < 0.0f)
+			offset = (float)stats.mAverageEdgeLength;
+		if (sweep.empty()) {
+			std::cout << "offset value: " << offset << std::endl;
+		}
+		else {
+			std::cout << "offset values:";
+			for (float value : sweep)
+				std::cout << " " << value;
+			std::cout << std::endl;
+		}
+
+		MatrixXu oF;
+		MatrixXf oV;
+		VectorXf offsets;
+		bool perVertexOffsets = safeOffset || !heightMapFile.empty();
+		if (safeOffset) {
+			computeSafeOffsets(F, V, N, offset, offsets, offsetSmoothing);
+			reportStage("safe offsets", timer);
+		}
+		if (!heightMapFile.empty()) {
+			MatrixXf heights;
+			VectorXf heightOffsets;
+			loadHeightMap(heightMapFile, heights);
+			/* A sweep scales the offsets of a height map for an offset of 1 */
+			computeHeightMapOffsets(F, UV, heights, sweep.empty() ? offset : 1.0f, heightOffsets);
+			offsets = safeOffset ? offsets.cwiseMin(heightOffsets) : heightOffsets;
+			reportStage("height map offsets", timer);
+		}
+		if (sweep.empty()) {
+			if (perVertexOffsets)
+				generateOffsetSurface(F, V, N, oF, oV, offsets);
+			else
+				generateOffsetSurface(F, V, N, oF, oV, offset);
+			reportStage("offset", timer);
+		}
+
+		if (selfIntersections) {
+			std::vector<uint32_t> intersectingFaces;
+			std::vector<uint8_t> intersectionFlags;
+			detectSelfIntersections(F, V, oV, intersectingFaces, intersectionFlags);
+			uint32_t offsetCount = 0, baseCount = 0;
+			for (uint32_t f : intersectingFaces) {
+				offsetCount += (intersectionFlags[f] & SELF_INTERSECTION_OFFSET) ? 1 : 0;
+				baseCount += (intersectionFlags[f] & SELF_INTERSECTION_BASE) ? 1 : 0;
+			}
+			std::cout << "Self-intersections: " << offsetCount << " faces intersect the offset surface, "
+				<< baseCount << " faces intersect between offset and base surface" << std::endl;
+			reportStage("self-intersections", timer);
+		}
+
+		/* The adjacency table is only needed to compute a pattern which is not cached, for the bound and the neighbours */
+		MatrixXi A;
+		MatrixXu8 AE;
+		uint64_t patternKey = cache.patternKey(F, solver, searchBudget);
+		bool patternCached = cache.loadPattern(patternKey, P);
+		if ((!patternCached && solver != SPLIT_PATTERN_SOLVER_VERTEX_ORDER) || !boundFile.empty() || neighbors) {
+			key = cache.adjacencyKey(F);
+			if (!cache.loadAdjacency(key, A, AE)) {
+				buildFaceAdjacencyTable(F, A, AE);
+				cache.storeAdjacency(key, A, AE);
+			}
+			reportStage("adjacency", timer);
+		}
+
+		if (!patternCached) {
+			computePrimsSplittingPattern(F, A, AE, P, solver, searchBudget);
+			cache.storePattern(patternKey, P);
+		}
+		reportStage("pattern", timer);
+
+		if (!sweep.empty()) {
+			ShellSweep shellSweep;
+			shellSweep.build(F, V, UV, N, DPDU, DPDV, P, sweep, offsets);
+			std::cout << "Shell sweep: " << memString(shellSweep.memoryUsage()) << " for " << shellSweep.getShellCount()
+				<< " shells" << std::endl;
+			reportStage("sweep", timer);
+
+			if (neighbors) {
+				computeTetrahedronNeighbors(F, A, shellSweep.shared());
+				reportStage("neighbors", timer);
+			}
+			if (!shellFile.empty()) {
+				TetrahedronMesh shell;
+				for (uint32_t i = 0; i < shellSweep.getShellCount(); ++i) {
+					shellSweep.shell(i, shell);
+					saveShellToMitsuba(sweepFileName(shellFile, i), shell);
+				}
+				reportStage("save shells", timer);
+			}
+			if (!binaryFile.empty()) {
+				saveShellSweepBinary(binaryFile, shellSweep, checksum);
+				reportStage("save binary shell", timer);
+			}
+
+			std::cout << "Total: " << timeString(total.value()) << ", peak memory "
+				<< memString(peakMemoryUsage()) << std::endl;
+			return 0;
+		}
+
+		TetrahedronMesh shell;
+		bool neighborsComputed = false;
+		if (implicit) {
+			/* Text output is generated from the implicit shell, the binary format and the neighbours need the explicit arrays */
+			ImplicitShell implicitShell;
+			if (perVertexOffsets)
+				implicitShell.set(F, V, UV, N, DPDU, DPDV, offsets, P);
+			else
+				implicitShell.set(F, V, UV, N, DPDU, DPDV, offset, P);
+			std::cout << "Implicit shell: " << memString(implicitShell.memoryUsage()) << " (V=" << implicitShell.getVertexCount()
+				<< ", T=" << implicitShell.getTetrahedronCount() << ")" << std::endl;
+			reportStage("construct", timer);
+
+			if (!shellFile.empty()) {
+				saveShellText(shellFile, implicitShell);
+				reportStage("save shell", timer);
+			}
+			if (!binaryFile.empty() || neighbors)
+				implicitShell.toTetrahedronMesh(shell);
+		}
+		else {
+			constructTetrahedronMeshSimple(F, V, oV, UV, N, DPDU, DPDV, P, shell);
+			std::cout << "Shell: " << memString(shell.memoryUsage()) << std::endl;
+			reportStage("construct", timer);
+
+			if (!occupancyFile.empty()) {
+				ShellOccupancy occupancy;
+				if (occupancyFile.size() >= 4 && occupancyFile.compare(occupancyFile.size() - 4, 4, ".txt") == 0) {
+					std::vector<AABB> boxes;
+					loadOccupancyBoxes(occupancyFile, boxes);
+					occupancy.setBoxes(boxes);
+				}
+				else {
+					MatrixXf bitmap;
+					loadHeightMap(occupancyFile, bitmap);
+					occupancy.setBitmap(bitmap);
+				}
+				/* The neighbours follow from the prisms of the full shell and are remapped */
+				if (neighbors) {
+					computeTetrahedronNeighbors(F, A, shell);
+					neighborsComputed = true;
+					reportStage("neighbors", timer);
+				}
+				applyShellOccupancy(occupancy, shell);
+				std::cout << "Sparse shell: " << memString(shell.memoryUsage()) << std::endl;
+				reportStage("occupancy", timer);
+			}
+
+			if (!shellFile.empty()) {
+				saveShellToMitsuba(shellFile, shell);
+				reportStage("save shell", timer);
+			}
+		}
+
+		/* Not hasNeighbors(), which is false for a sparse shell without prisms, whose table does not match F */
+		if (neighbors && !neighborsComputed) {
+			computeTetrahedronNeighbors(F, A, shell);
+			reportStage("neighbors", timer);
+		}
+
+		if (!binaryFile.empty()) {
+			saveShellBinary(binaryFile, shell, checksum, compress);
+			reportStage("save binary shell", timer);
+		}
+
+		if (!boundFile.empty()) {
+			MatrixXu boundF;
+			MatrixXf boundV;
+			generateShellBoundSimple(F, V, oV, A, boundF, boundV);
+			writeObj(boundFile, boundF, boundV);
+			reportStage("save bound", timer);
+		}
+
+		std::cout << "Total: " << timeString(total.value()) << ", peak memory "
+			<< memString(peakMemoryUsage()) << std::endl;
+	} catch (const std::exception &e) {
+		std::cerr << "Caught a fatal error: " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
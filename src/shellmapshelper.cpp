@@ -1,6 +1,8 @@
 #include "shellmapshelper.h"
 #include "normal.h"
 #include "adjacenttriangles.h"
+#include "parallel.h"
+#include "shellio.h"
 
 void generateOffsetSurface(const MatrixXu &F, const MatrixXf &V, MatrixXu &oF, MatrixXf &oV, const float offset) {
 	oF = F;
@@ -19,80 +21,236 @@ void generateOffsetSurface(const MatrixXu &F, const MatrixXf &V, const MatrixXf
 	oV = V;
 
 	// N: vertex normals
-	// Warning: ignore self-intersection here!!
+	// Warning: ignore self-intersection here!! (see detectSelfIntersections())
 	oV += offset * N;
 	std::cout << "--Generate offset mesh done." << std::endl;
 }
 
-void computePrimsSplittingPattern(const MatrixXu &F, MatrixXu &P) {
+void generateOffsetSurface(const MatrixXu &F, const MatrixXf &V, const MatrixXf &N, MatrixXu &oF, MatrixXf &oV, const VectorXf &offsets) {
+	if (offsets.size() != V.cols())
+		throw std::runtime_error("generateOffsetSurface(): expected one offset per vertex!");
+	std::cout << "--Generate offset mesh ..." << std::endl;
+	oF = F;
+	oV = V + N * offsets.asDiagonal();
+	std::cout << "--Generate offset mesh done." << std::endl;
+}
+
+/* Orient every prism diagonal from the base vertex with the lower index to the offset vertex with the higher index.
+	Edge i (p0->p1) of a triangle gets R (diagonal b0->o1) if p0 < p1 and F otherwise. An adjacent triangle walks the
+	shared edge in the opposite direction, so it always gets the opposite pattern, and no triangle can have three
+	increasing (RRR) or three decreasing (FFF) edges. */
+static void computePrimsSplittingPatternVertexOrder(const MatrixXu &F, MatrixXu &P) {
+	parallel_for(0u, (uint32_t) F.cols(), GRAIN_SIZE, [&F, &P](uint32_t begin, uint32_t end) {
+		for (uint32_t f = begin; f < end; ++f) {
+			for (int i = 0; i < 3; ++i) {
+				int j = (i == 2 ? 0 : i + 1);
+				P(i, f) = F(i, f) < F(j, f) ? SPLIT_PATTERN_R : SPLIT_PATTERN_F;
+			}
+		}
+	});
+}
+
+void computePrimsSplittingPattern(const MatrixXu &F, MatrixXu &P, SPLIT_PATTERN_SOLVER solver, uint32_t searchBudget) {
+	if (solver == SPLIT_PATTERN_SOLVER_VERTEX_ORDER) {
+		P.resize(F.rows(), F.cols());
+		std::cout << "--Compute prims splitting pattern (vertex order) ..." << std::endl;
+		computePrimsSplittingPatternVertexOrder(F, P);
+		std::cout << "++Compute prims splitting pattern done." << std::endl;
+		return;
+	}
+
+	MatrixXi A;		// A(i, f): triangle adjacent to edge i of triangle f, or -1
+	MatrixXu8 AE;	// AE(i, f): index of the shared edge inside triangle A(i, f)
+	buildFaceAdjacencyTable(F, A, AE);
+
+	computePrimsSplittingPattern(F, A, AE, P, solver, searchBudget);
+}
+
+void computePrimsSplittingPattern(const MatrixXu &F, const MatrixXi &A, const MatrixXu8 &AE, MatrixXu &P,
+	SPLIT_PATTERN_SOLVER solver, uint32_t searchBudget) {
 	P.resize(F.rows(), F.cols());
+
+	if (solver == SPLIT_PATTERN_SOLVER_VERTEX_ORDER) {
+		std::cout << "--Compute prims splitting pattern (vertex order) ..." << std::endl;
+		computePrimsSplittingPatternVertexOrder(F, P);
+		std::cout << "++Compute prims splitting pattern done." << std::endl;
+		return;
+	}
+
 //	P.setZero();	// Pattern = None
 	memset(P.data(), SPLIT_PATTERN_NONE, P.size() * sizeof(P(0, 0)));
 
 	std::cout << "--Compute prims splitting pattern ..." << std::endl;
 
-	EdgeToAdjacentTrianglesMap adjacentMap;
-	buildEdgeAdjacentTrianglesTable(F, adjacentMap);
+	/* Set the pattern of the neighbour's copy of edge i of triangle f */
+	auto setEdgePattern = [&A, &AE, &P](uint32_t f, int i, SPLIT_PATTERN p) {
+		P(AE(i, f), A(i, f)) = static_cast<uint32_t>(p);
+	};
 
-	/* Get edge pattern based on triangel and edge, supporting adjacent triangle query */
-	auto getEdgePattern = [&F, &P](uint32_t f, uint32_t p0, uint32_t p1) -> SPLIT_PATTERN { 
-		for (int i = 0; i < 3; ++i) {
-			int j = (i == 2 ? 0 : i + 1);
-			if ((F(i, f) == p0 && F(j, f) == p1) || (F(i, f) == p1 && F(j, f) == p0)) {
-				return static_cast<SPLIT_PATTERN>(P(i, f));
-			}
-		}
-		std::cerr << "Find Edge pattern error: the face does not have the input edge/points" << std::endl;
-		return SPLIT_PATTERN_NONE;
+	auto getAdjacentTriangles = [&A](uint32_t f, int adjacentTriangles[3]) {
+		for (int i = 0; i < 3; ++i) adjacentTriangles[i] = A(i, f);
 	};
 
-	auto setEdgePattern = [&F, &P](uint32_t f, uint32_t p0, uint32_t p1, SPLIT_PATTERN p) {
+	/* Get three share edge pattern of the three adjacent triangles */
+	auto getAdjacentEdgePatterns = [&A, &AE, &P](uint32_t f, SPLIT_PATTERN adjacentEdgePatterns[3]) {
 		for (int i = 0; i < 3; ++i) {
-			int j = (i == 2 ? 0 : i + 1);
-			if ((F(i, f) == p0 && F(j, f) == p1) || (F(i, f) == p1 && F(j, f) == p0)) {
-				P(i, f) = static_cast<uint32_t>(p);
-			}
+			adjacentEdgePatterns[i] = A(i, f) != -1 ? static_cast<SPLIT_PATTERN>(P(AE(i, f), A(i, f))) : SPLIT_PATTERN_NONE;
 		}
 	};
 
-	auto getAdjacentTriangles = [&F, &adjacentMap](uint32_t f, int adjacentTriangles[3]) {
-		uint32_t points[3] = { F(0, f), F(1, f), F(2, f) };
+	/* Get three edge patterns of one triangle */
+	auto getTriangleEdgePatterns = [&P](uint32_t f, SPLIT_PATTERN triangleEdgePatterns[3]) {
+		for (int i = 0; i < 3; ++i) triangleEdgePatterns[i] = static_cast<SPLIT_PATTERN>(P(i, f));
+	};
 
-		std::string edges[3];
-		for (int i = 0; i < 3; i++) {
-			int j = (i == 2) ? 0 : i + 1;
-			points[i] < points[j] ? (edges[i] = std::to_string(points[i]) + std::to_string(points[j]))
-				: (edges[i] = std::to_string(points[j]) + std::to_string(points[i]));
+	/* Try to solve the inconsistent (RRR or FFF) triangle f without searching, return false if this is not possible. */
+	auto solveInconsistencyLocally = [&P, &getAdjacentEdgePatterns, &getAdjacentTriangles, &getTriangleEdgePatterns, &setEdgePattern](uint32_t f) -> bool {
+		/* Can solve it directly by assigning another suitable pattern?
+		This can work if there exists free edges which have no adjacent triangle or have not been assign a splitting pattern. */
+		SPLIT_PATTERN adjacentEdgePatterns[3];
+		getAdjacentEdgePatterns(f, adjacentEdgePatterns);
+
+		uint8_t cN = 0;
+		int freeEdge = -1;	// It means there is no adjacent(or have not assign a pattern) triangle which share this edge
+		for (int i = 0; i < 3; i++) { 
+			if (adjacentEdgePatterns[i] == SPLIT_PATTERN_NONE) {
+				++cN;
+				freeEdge = i;
+				break;
+			}
 		}
 
-		adjacentTriangles[0] = adjacentTriangles[1] = adjacentTriangles[2] = -1;
-		for (int i = 0; i < 3; ++i) {
-			adjacentTriangles[i] = lookupEdgeAdjacentTriangle(f, points[i], points[i == 2 ? 0 : i + 1], adjacentMap);
+		if (cN > 0) {
+			// Solve it directly, just flip the pattern on free edge
+			if (P(freeEdge, f) == SPLIT_PATTERN_R) P(freeEdge, f) = SPLIT_PATTERN_F;
+			else  P(freeEdge, f) = SPLIT_PATTERN_R;
+
+			return true;
 		}
-	};
 
-	/* Get three share edge pattern of the three adjacent triangles */
-	auto getAdjacentEdgePatterns = [&F, &P, &adjacentMap, &getEdgePattern, &getAdjacentTriangles](uint32_t f, SPLIT_PATTERN adjacentEdgePatterns[3]) {
+		/* Or can solve it by just flipping one edge pattern of this and adjacent triangle?
+		For example:
+		This triangle: (FFF)(inconsistent), one adjacent triangle has edge patterns: (RRF), then the inconsistency can be solved by
+		flipping the share edge's pattern, the result is, this triangle(RFF), adjacent triangle(FRF).
+		*/
 		int adjacentTriangles[3];
 		getAdjacentTriangles(f, adjacentTriangles);
 
-		uint32_t points[3] = { F(0, f), F(1, f), F(2, f) };
+		// The adjacentTriangles here are  nonzero, check this explictly if results are not correct.
+		SPLIT_PATTERN ajacentTrianglesEdgePatterns[3][3];
+		for (int i = 0; i < 3; ++i)  getTriangleEdgePatterns(adjacentTriangles[i], ajacentTrianglesEdgePatterns[i]);
 
-		adjacentEdgePatterns[0] = adjacentEdgePatterns[1] = adjacentEdgePatterns[2] = SPLIT_PATTERN_NONE;
+		uint8_t rR;
+		if (P(0, f) == SPLIT_PATTERN_R) rR = 1;
+		else rR = 2;
+
+		int edgeId = -1;
+		int freeAdjacentTriangle = -1;
 		for (int i = 0; i < 3; ++i) {
-			if (adjacentTriangles[i] != -1) {
-				adjacentEdgePatterns[i] = getEdgePattern(adjacentTriangles[i], points[i], points[i == 2 ? 0 : i + 1]);
+			uint8_t cR = 0;
+			for (int j = 0; j < 3; ++j) { if (ajacentTrianglesEdgePatterns[i][j] == SPLIT_PATTERN_R) ++cR; }
+
+			if (cR == rR) {
+				edgeId = i;
+				freeAdjacentTriangle = adjacentTriangles[i];
+				break;
+			}
+		}
+
+		if (freeAdjacentTriangle >= 0) {
+			SPLIT_PATTERN p = static_cast<SPLIT_PATTERN>(P(edgeId, f));
+			SPLIT_PATTERN flip = (p == SPLIT_PATTERN_R ? SPLIT_PATTERN_F : SPLIT_PATTERN_R);
+
+			P(edgeId, f) = static_cast<uint32_t>(flip);
+			if (p == SPLIT_PATTERN_NONE) {
+				std::cerr << "Error: set an edge with pattern None! at adjacent face(" << freeAdjacentTriangle
+					<< ") when deal with face(" << f << ")." << std::endl;
+				std::cout << "Information: ----------------------" << std::endl;
+				std::cout << "edge patterns on face(" << f << ") are: (" << P(0, f) << P(1, f) << P(2, f) << ")." << std::endl;
+				std::cout << "edge patterns on adjacent face(" << freeAdjacentTriangle << ") are: (" << P(0, freeAdjacentTriangle) << P(1, freeAdjacentTriangle) << P(2, freeAdjacentTriangle) << ")." << std::endl;
+				std::cout << "-----------------------------------" << std::endl;
 			}
+			setEdgePattern(f, edgeId, p);
+
+			return true;
 		}
+
+		return false;
 	};
 
-	/* Get three edge patterns of one triangle */
-	auto getTriangleEdgePatterns = [&P](uint32_t f, SPLIT_PATTERN triangleEdgePatterns[3]) {
-		for (int i = 0; i < 3; ++i) triangleEdgePatterns[i] = static_cast<SPLIT_PATTERN>(P(i, f));
+	/* Flip edge i of triangle f together with the neighbour's copy of it */
+	auto flipEdgePattern = [&P, &setEdgePattern](uint32_t f, int i) {
+		SPLIT_PATTERN p = static_cast<SPLIT_PATTERN>(P(i, f));
+		SPLIT_PATTERN flip = (p == SPLIT_PATTERN_R ? SPLIT_PATTERN_F : SPLIT_PATTERN_R);
+
+		P(i, f) = static_cast<uint32_t>(flip);
+		setEdgePattern(f, i, p);
 	};
 
+	/* State of the bounded DFS search, allocated once and reused by every search. A face is visited in the
+	current search if its stamp equals the current epoch, so the buffer never has to be cleared. */
+	struct SearchFrame {
+		uint32_t f;
+		int child;		// edge leading to the child currently being searched, or -1
+	};
+	std::vector<uint32_t> visitedEpoch;
+	std::vector<SearchFrame> stack;
+	uint32_t epoch = 0;
+	if (solver == SPLIT_PATTERN_SOLVER_BOUNDED_DFS)
+		visitedEpoch.resize(F.cols(), 0);
+
+	/* Same search as the recursive solver, with an explicit stack and at most 'searchBudget' visited faces.
+	On failure, all flips done by the search are undone. */
+	auto solveInconsistencyIteratively = [&](uint32_t root) -> bool {
+		if (++epoch == 0) {
+			std::fill(visitedEpoch.begin(), visitedEpoch.end(), 0);
+			epoch = 1;
+		}
+
+		uint32_t visitedCount = 0;
+		stack.clear();
+		stack.push_back(SearchFrame{ root, -1 });
+
+		if (solveInconsistencyLocally(root)) return true;
+		visitedEpoch[root] = epoch, ++visitedCount;
+
+		while (!stack.empty()) {
+			SearchFrame &frame = stack.back();
+			uint32_t f = frame.f;
+
+			/* Coming back from a failed child: undo the flip leading to it */
+			if (frame.child >= 0) flipEdgePattern(f, frame.child);
+
+			int next = -1;
+			for (int i = frame.child + 1; i < 3; ++i) {
+				if (visitedEpoch[A(i, f)] != epoch) { next = i; break; }
+			}
+
+			if (next == -1) {
+				stack.pop_back();
+				continue;
+			}
+
+			frame.child = next;
+			flipEdgePattern(f, next);
+			uint32_t g = A(next, f);
+
+			if (solveInconsistencyLocally(g)) return true;
+
+			if (++visitedCount > searchBudget) {
+				for (size_t k = stack.size(); k-- > 0; ) flipEdgePattern(stack[k].f, stack[k].child);
+				return false;
+			}
+			visitedEpoch[g] = epoch;
+			stack.push_back(SearchFrame{ g, -1 });
+		}
+
+		return false;
+	};
+
+	bool searchFailed = false;
 	uint32_t trianglesCount = F.cols();
-	for (uint32_t f = 0; f < trianglesCount; ++f) {
+	for (uint32_t f = 0; f < trianglesCount && !searchFailed; ++f) {
 		SPLIT_PATTERN adjacentEdgePatterns[3];
 		getAdjacentEdgePatterns(f, adjacentEdgePatterns);
 
@@ -143,115 +301,62 @@ void computePrimsSplittingPattern(const MatrixXu &F, MatrixXu &P) {
 				P(0, f) = patterns[0], P(1, f) = patterns[1], P(2, f) = patterns[2];	// three Rs or thee Fs
 
 				// Solve inconsistency, RRR->RRF, FFF->FFR
+				if (solver == SPLIT_PATTERN_SOLVER_BOUNDED_DFS) {
+					if (!solveInconsistencyIteratively(f)) {
+						std::cout << "Split pattern search failed or exceeded its budget at face(" << f << "), fall back to vertex order pattern." << std::endl;
+						searchFailed = true;
+					}
+					return;
+				}
+
 				// DFS style to solve it
 				bool *visited = new bool[F.cols()];
 				memset(visited, false, sizeof(bool) * F.cols());
 
 				std::function<bool(uint32_t f)> solveInconsistencyRecursively;	// can not use auto below, must be declearation directly to capture
-				solveInconsistencyRecursively = [&F, &P, &adjacentMap, &visited, &solveInconsistencyRecursively,
-					&getAdjacentEdgePatterns, &getAdjacentTriangles, &getTriangleEdgePatterns, &setEdgePattern](uint32_t f) -> bool {
-
-					/* Can solve it directly by assigning another suitable pattern?
-					This can work if there exists free edges which have no adjacent triangle or have not been assign a splitting pattern. */
-					SPLIT_PATTERN adjacentEdgePatterns[3];
-					getAdjacentEdgePatterns(f, adjacentEdgePatterns);
-
-					uint8_t cN = 0;
-					int freeEdge = -1;	// It means there is no adjacent(or have not assign a pattern) triangle which share this edge
-					for (int i = 0; i < 3; i++) { 
-						if (adjacentEdgePatterns[i] == SPLIT_PATTERN_NONE) {
-							++cN;
-							freeEdge = i;
-							break;
-						}
-					}
+				solveInconsistencyRecursively = [&P, &visited, &solveInconsistencyRecursively,
+					&getAdjacentTriangles, &solveInconsistencyLocally, &setEdgePattern](uint32_t f) -> bool {
 
-					if (cN > 0) {
-						// Solve it directly, just flip the pattern on free edge
-						if (P(freeEdge, f) == SPLIT_PATTERN_R) P(freeEdge, f) = SPLIT_PATTERN_F;
-						else  P(freeEdge, f) = SPLIT_PATTERN_R;
+					if (solveInconsistencyLocally(f)) return true;
 
-						return true;
-					}
-					else {
-						/* Or can solve it by just flipping one edge pattern of this and adjacent triangle?
-						For example:
-						This triangle: (FFF)(inconsistent), one adjacent triangle has edge patterns: (RRF), then the inconsistency can be solved by
-						flipping the share edge's pattern, the result is, this triangle(RFF), adjacent triangle(FRF).
-						*/
-						int adjacentTriangles[3];
-						getAdjacentTriangles(f, adjacentTriangles);
-
-						// The adjacentTriangles here are  nonzero, check this explictly if results are not correct.
-						SPLIT_PATTERN ajacentTrianglesEdgePatterns[3][3];
-						for (int i = 0; i < 3; ++i)  getTriangleEdgePatterns(adjacentTriangles[i], ajacentTrianglesEdgePatterns[i]);
-
-						uint8_t rR;
-						if (P(0, f) == SPLIT_PATTERN_R) rR = 1;
-						else rR = 2;
-
-						int edgeId = -1;
-						int freeAdjacentTriangle = -1;
-						for (int i = 0; i < 3; ++i) {
-							uint8_t cR = 0;
-							for (int j = 0; j < 3; ++j) { if (ajacentTrianglesEdgePatterns[i][j] == SPLIT_PATTERN_R) ++cR; }
-
-							if (cR == rR) {
-								edgeId = i;
-								freeAdjacentTriangle = adjacentTriangles[i];
-								break;
-							}
-						}
+					int adjacentTriangles[3];
+					getAdjacentTriangles(f, adjacentTriangles);
 
-						if (freeAdjacentTriangle >= 0) {
-							SPLIT_PATTERN p = static_cast<SPLIT_PATTERN>(P(edgeId, f));
+					// Start DFS search, random flip one share edge's pattern of adjacent unvisited triangle
+					visited[f] = true;
+
+					for (int i = 0; i < 3; ++i) {
+						if (!visited[adjacentTriangles[i]]) {
+							SPLIT_PATTERN p = static_cast<SPLIT_PATTERN>(P(i, f));
 							SPLIT_PATTERN flip = (p == SPLIT_PATTERN_R ? SPLIT_PATTERN_F : SPLIT_PATTERN_R);
 
-							P(edgeId, f) = static_cast<uint32_t>(flip);
-							if (p == SPLIT_PATTERN_NONE) {
-								std::cerr << "Error: set an edge with pattern None! at adjacent face(" << freeAdjacentTriangle
-									<< ") when deal with face(" << f << ")." << std::endl;
-								std::cout << "Information: ----------------------" << std::endl;
-								std::cout << "edge patterns on face(" << f << ") are: (" << P(0, f) << P(1, f) << P(2, f) << ")." << std::endl;
-								std::cout << "edge patterns on adjacent face(" << freeAdjacentTriangle << ") are: (" << P(0, freeAdjacentTriangle) << P(1, freeAdjacentTriangle) << P(2, freeAdjacentTriangle) << ")." << std::endl;
-								std::cout << "-----------------------------------" << std::endl;
-							}
-							setEdgePattern(freeAdjacentTriangle, F(edgeId, f), F((edgeId == 2 ? 0 : edgeId + 1), f), p);
+							P(i, f) = static_cast<uint32_t>(flip);
+							setEdgePattern(f, i, p);
 
-							return true;
-						}
-						else {
-							// Start DFS search, random flip one share edge's pattern of adjacent unvisited triangle
-							visited[f] = true;
-
-							for (int i = 0; i < 3; ++i) {
-								if (!visited[adjacentTriangles[i]]) {
-									SPLIT_PATTERN p = static_cast<SPLIT_PATTERN>(P(i, f));
-									SPLIT_PATTERN flip = (p == SPLIT_PATTERN_R ? SPLIT_PATTERN_F : SPLIT_PATTERN_R);
-
-									P(i, f) = static_cast<uint32_t>(flip);
-									setEdgePattern(adjacentTriangles[i], F(i, f), F((i == 2 ? 0 : i + 1), f), p);
-
-									// check if occurs new inconsistency?
-									// it does make new inconsistency, since all possible sovling situations have been considered?!
-									if (solveInconsistencyRecursively(adjacentTriangles[i])) return true;
-									else {
-										P(i, f) = p;
-										setEdgePattern(adjacentTriangles[i], F(i, f), F((i == 2 ? 0 : i + 1), f), flip);
-									}
-								}
+							// check if occurs new inconsistency?
+							// it does make new inconsistency, since all possible sovling situations have been considered?!
+							if (solveInconsistencyRecursively(adjacentTriangles[i])) return true;
+							else {
+								P(i, f) = p;
+								setEdgePattern(f, i, flip);
 							}
-
-							return false;
 						}
 					}
+
+					return false;
 				};
 				solveInconsistencyRecursively(f);
+				delete[] visited;
 			}
 		};
 		assignSplittingPattern();
 	}
 
+	if (searchFailed) {
+		/* Consistent by construction, see computePrimsSplittingPatternVertexOrder */
+		computePrimsSplittingPatternVertexOrder(F, P);
+	}
+
 	/* Check if pattern P is consistency */
 	#if 1
 	std::cout << "check if the resulting pattern P is consistent(correct): " << std::endl;
@@ -318,103 +423,169 @@ void computePrimsSplittingPattern(const MatrixXu &F, MatrixXu &P) {
 void constructTetrahedronMeshSimple(const MatrixXu &bF, const MatrixXf &bV, const MatrixXf &oV,
 	const MatrixXf &bUV, const MatrixXf &bN, const MatrixXf &bDPDU, const MatrixXf &bDPDV,
 	const MatrixXu &P, TetrahedronMesh &tetrahedronMesh) {
-	MatrixXu F, T;	// T: tetra
-	MatrixXf V, N, UV, DPDU, DPDV;
-
 	std::cout << "--Construct tetrahedron mesh ..." << std::endl;
+	Timer<std::chrono::microseconds> timer;
+
+	/* Vertex v of the base layer is shell vertex v, of the offset layer bV.cols() + v */
+	uint32_t baseCount = bV.cols(), trianglesCount = bF.cols();
+	tetrahedronMesh.resize(2 * baseCount, 3 * trianglesCount);
+	MatrixXf &V = tetrahedronMesh.V(), &N = tetrahedronMesh.N(), &UV = tetrahedronMesh.UV();
+	MatrixXf &DPDU = tetrahedronMesh.DPDU(), &DPDV = tetrahedronMesh.DPDV();
+	MatrixXu &T = tetrahedronMesh.T();
+
+	/* Meshes without texcoords (e.g. in the viewer) have no tangents either, the shell leaves these arrays empty */
+	bool hasUV = bUV.cols() == (Eigen::Index)baseCount;
+	bool hasTangents = bDPDU.cols() == (Eigen::Index)baseCount && bDPDV.cols() == (Eigen::Index)baseCount;
+	if (!hasUV)
+		UV.resize(3, 0);
+	if (!hasTangents)
+		DPDU.resize(3, 0), DPDV.resize(3, 0);
+
+	parallel_for(0u, baseCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t v = begin; v < end; ++v) {
+			uint32_t o = baseCount + v;
+			V.col(v) = bV.col(v), V.col(o) = oV.col(v);
+			N.col(v) = N.col(o) = bN.col(v);
+			if (hasUV) {
+				UV.col(v) << bUV.col(v), 0.0f;
+				UV.col(o) << bUV.col(v), 1.0f;
+			}
+			if (hasTangents) {
+				DPDU.col(v) = DPDU.col(o) = bDPDU.col(v);
+				DPDV.col(v) = DPDV.col(o) = bDPDV.col(v);
+			}
+		}
+	});
+
+	/* Construct each of the three tetrahedra in a prism from the counter clockwise edge tag and the next counter
+	clockwise edge tag */
+	std::atomic<uint32_t> invalidPrisms(0);
+	parallel_for(0u, trianglesCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		uint32_t localInvalidPrisms = 0;
+		for (uint32_t f = begin; f < end; ++f) {
+			uint32_t p[3] = { P(0, f), P(1, f), P(2, f) };
+			/* Prism vertices of the corners i, j, k for i = 0, 1, 2, repeated to avoid the modulo */
+			uint32_t vertices[2][5] = {
+				{ bF(0, f), bF(1, f), bF(2, f), bF(0, f), bF(1, f) },
+				{ baseCount + bF(0, f), baseCount + bF(1, f), baseCount + bF(2, f), baseCount + bF(0, f), baseCount + bF(1, f) }
+			};
+			bool patternsValid = p[0] < SPLIT_PATTEN_COUNT && p[1] < SPLIT_PATTEN_COUNT && p[2] < SPLIT_PATTEN_COUNT;
+			bool valid = patternsValid;
 
-	MatrixXu oF;
-	oF.resize(bF.rows(), bF.cols());
-	oF.setConstant(bV.cols());
-	oF += bF;
-
-	MatrixXf bUV3, oUV3;
-	bUV3.resize(3, bUV.cols());
-	oUV3.resize(3, bUV.cols());
-	for (uint32_t uv = 0; uv < bUV.cols(); ++uv) {
-		bUV3.col(uv) << bUV.col(uv), 0.0f;
-		oUV3.col(uv) << bUV.col(uv), 1.0f;
-	}
+			for (int i = 0; i < 3; ++i) {
+				uint32_t t = 3 * f + i;	// tetrahedron id
+				const uint8_t *entry = patternsValid ? TETRAHEDRON_TABLE[p[i]][p[i == 2 ? 0 : i + 1]] : &INVALID_TETRAHEDRON;
+
+				if (entry[0] == INVALID_TETRAHEDRON) {
+					/* Leave a degenerate tetrahedron on the base vertex */
+					T.col(t).setConstant(vertices[0][i]);
+					valid = false;
+					continue;
+				}
+				for (int c = 0; c < 4; ++c)
+					T(c, t) = vertices[entry[c] / 3][i + entry[c] % 3];
+			}
+			if (!valid)
+				localInvalidPrisms++;
+		}
+		invalidPrisms += localInvalidPrisms;
+	});
 
-	auto combine = [](MatrixXf &dst, const MatrixXf &b, const MatrixXf &o) {
-		dst.resize(b.rows(), b.cols() + o.cols());
-		memcpy(dst.data(), b.data(), sizeof(b(0, 0)) * b.size());
-		memcpy(reinterpret_cast<uint8_t *>(dst.data()) + sizeof(float) * b.size(), o.data(), sizeof(float) * o.size());
-	};
+	if (invalidPrisms > 0)
+		std::cerr << "Invalid prism splitting pattern found. (" << invalidPrisms << " prisms)" << std::endl;
 
-	F.resize(bF.rows(), bF.cols() + oF.cols());
-	memcpy(F.data(), bF.data(), sizeof(uint32_t) * bF.size());
-	memcpy(reinterpret_cast<uint8_t *>(F.data()) + sizeof(uint32_t) * bF.size(), oF.data(), sizeof(uint32_t) * oF.size());
-	combine(V, bV, oV);
-	combine(N, bN, bN);
-	combine(UV, bUV3, oUV3);
-	combine(DPDU, bDPDU, bDPDU);
-	combine(DPDV, bDPDV, bDPDV);
-
-	auto constructTetrahedraFromPrimsSimple = [](const MatrixXu &F, const MatrixXu &oF, const MatrixXu &P, MatrixXu &T) {
-		uint32_t trianglesCount = F.cols();
-		T.resize(4, 3 * trianglesCount);
-
-		for (uint32_t f = 0; f < trianglesCount; ++f) { // for each trianlge of base mesh, that means, for each prim
-			uint32_t bP[3] = { F(0, f), F(1, f), F(2, f) };
-			uint32_t oP[3] = { oF(0, f), oF(1, f), oF(2, f) };
-			uint32_t p[3] = { P(0, f), P(1, f), P(2, f) };
+	double seconds = std::max<size_t>(timer.value(), 1) * 1e-6;
+	std::cout << "++Construct tetrahedron mesh done. (T=" << T.cols() << ", took " << timeString(seconds * 1000.0)
+		<< ", " << (uint64_t)(T.cols() / seconds) << " tets/s)" << std::endl;
+}
 
-			/* Construct each of the three tetrahedra in a prism by iterating counter clockwise edge tag and
-			the next counter clockwise edge tag. */
-			for (int i = 0; i < 3; ++i) {
-				int j = (i == 2 ? 0 : i + 1);
-				int k = (j == 2 ? 0 : j + 1);
-				uint32_t t = 3 * f + i;	// tehetradron id
+void constructTetrahedronMeshSimple(const MatrixXu &bF, const MatrixXf &bV, const MatrixXf &oV,
+	const MatrixXf &bUV, const MatrixXf &bN, const MatrixXf &bDPDU, const MatrixXf &bDPDV,
+	const MatrixXu &P, const ShellOccupancy &occupancy, TetrahedronMesh &tetrahedronMesh) {
+	constructTetrahedronMeshSimple(bF, bV, oV, bUV, bN, bDPDU, bDPDV, P, tetrahedronMesh);
+	if (occupancy.isEmpty())
+		return;
+	if (tetrahedronMesh.UV().cols() == 0)
+		std::cerr << "The mesh has no texcoords, the occupancy mask is ignored." << std::endl;
+	else
+		applyShellOccupancy(occupancy, tetrahedronMesh);
+}
 
-				if (SPLIT_PATTERN_F == static_cast<SPLIT_PATTERN>(p[i]) && SPLIT_PATTERN_F == static_cast<SPLIT_PATTERN>(p[j])) {
-					T(0, t) = oP[i], T(1, t) = bP[j], T(2, t) = oP[j], T(3, t) = bP[k];
-				}
-				else if (SPLIT_PATTERN_F == static_cast<SPLIT_PATTERN>(p[i]) && SPLIT_PATTERN_R == static_cast<SPLIT_PATTERN>(p[j])) {
-					T(0, t) = oP[i], T(1, t) = bP[j], T(2, t) = oP[j], T(3, t) = oP[k];
-				}
-				else if (SPLIT_PATTERN_R == static_cast<SPLIT_PATTERN>(p[i]) && SPLIT_PATTERN_R == static_cast<SPLIT_PATTERN>(p[j])) {
-					T(0, t) = bP[i], T(1, t) = bP[j], T(2, t) = oP[j], T(3, t) = oP[k];
-				}
-				else if (SPLIT_PATTERN_R == static_cast<SPLIT_PATTERN>(p[i]) && SPLIT_PATTERN_F == static_cast<SPLIT_PATTERN>(p[j])) {
-					T(0, t) = bP[i], T(1, t) = bP[j], T(2, t) = oP[j], T(3, t) = bP[k];
+/* Vertices of the face opposite of vertex k of tetrahedron t */
+static inline void tetrahedronFace(const MatrixXu &T, uint32_t t, int k, uint32_t face[3]) {
+	int n = 0;
+	for (int c = 0; c < 4; ++c)
+		if (c != k)
+			face[n++] = T(c, t);
+}
+
+/* Tetrahedron of the prism with the tetrahedra first .. first + 2, other than 'exclude', containing the face */
+static inline uint32_t findPrismTetrahedron(const MatrixXu &T, uint32_t first, uint32_t exclude, const uint32_t face[3]) {
+	for (uint32_t t = first; t < first + 3; ++t) {
+		if (t == exclude || T(0, t) == T(1, t))
+			continue;
+		int shared = 0;
+		for (int c = 0; c < 3; ++c)
+			shared += (T(0, t) == face[c] || T(1, t) == face[c] || T(2, t) == face[c] || T(3, t) == face[c]) ? 1 : 0;
+		if (shared == 3)
+			return t;
+	}
+	return TETRAHEDRON_BOUNDARY;
+}
+
+void computeTetrahedronNeighbors(const MatrixXu &bF, const MatrixXi &A, TetrahedronMesh &tetrahedronMesh) {
+	std::cout << "--Compute tetrahedron neighbors ..." << std::endl;
+	Timer<std::chrono::microseconds> timer;
+
+	uint32_t trianglesCount = bF.cols(), baseCount = tetrahedronMesh.getVertexCount() / 2;
+	const MatrixXu &T = tetrahedronMesh.T();
+	if (T.cols() != 3 * trianglesCount || A.cols() != trianglesCount)
+		throw std::runtime_error("computeTetrahedronNeighbors(): the shell does not match the base mesh!");
+	MatrixXu &TN = tetrahedronMesh.TN();
+	TN.resize(4, 3 * trianglesCount);
+
+	/* Edge i of a face joins the corners i and i + 1, indexed by the bit mask of its corners */
+	static const int EDGE_OF_CORNERS[8] = { -1, -1, -1, 0, -1, 2, 1, -1 };
+
+	parallel_for(0u, trianglesCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t f = begin; f < end; ++f) {
+			for (uint32_t t = 3 * f; t < 3 * f + 3; ++t) {
+				if (T(0, t) == T(1, t)) {
+					TN.col(t).setConstant(TETRAHEDRON_DEGENERATE);
+					continue;
 				}
-				else {
-					std::cerr << "Invalid prism splitting pattern found." << std::endl;
-					return;
+				for (int k = 0; k < 4; ++k) {
+					uint32_t face[3], offsetVertices = 0, corners = 0;
+					tetrahedronFace(T, t, k, face);
+					for (int c = 0; c < 3; ++c) {
+						bool offsetVertex = face[c] >= baseCount;
+						uint32_t v = offsetVertex ? face[c] - baseCount : face[c];
+						offsetVertices += offsetVertex ? 1 : 0;
+						for (int j = 0; j < 3; ++j)
+							if (bF(j, f) == v)
+								corners |= 1u << j;
+					}
+
+					if (offsetVertices == 0)
+						TN(k, t) = TETRAHEDRON_BASE_SURFACE;
+					else if (offsetVertices == 3)
+						TN(k, t) = TETRAHEDRON_OFFSET_SURFACE;
+					else if (corners == 7)
+						TN(k, t) = findPrismTetrahedron(T, 3 * f, t, face);
+					else {
+						/* Side quad of an edge, shared with the prism of the adjacent face */
+						int edge = EDGE_OF_CORNERS[corners];
+						int adjacent = edge >= 0 ? A(edge, f) : -1;
+						TN(k, t) = adjacent >= 0 ? findPrismTetrahedron(T, 3 * (uint32_t)adjacent, t, face) : TETRAHEDRON_BOUNDARY;
+					}
 				}
 			}
 		}
-	};
-	constructTetrahedraFromPrimsSimple(bF, oF, P, T);
+	});
 
-	tetrahedronMesh.setTetrahedronMesh(std::move(V), std::move(N), std::move(UV), std::move(DPDU), std::move(DPDV), std::move(T));
-	std::cout << "++Construct tetrahedron mesh done." << std::endl;
+	std::cout << "++Compute tetrahedron neighbors done. (took " << timeString(timer.value() / 1000.0) << ")" << std::endl;
 }
 
 void saveShellToMitsuba(const std::string &filename, const TetrahedronMesh &shell) {
-	std::cout << "Writing \"" << filename << "\" (V=" << shell.getVertexCount()
-		<< ", T=" << shell.getTetrahedronCount() << ") ..." << std::endl;
-	FILE *fout = fopen(filename.c_str(), "wt");
-
-	if (fout) {
-		uint32_t vertexCount = shell.getVertexCount(), tetrahedronCount = shell.getTetrahedronCount();
-		const MatrixXf &V = shell.V(), &UV = shell.UV(), &N = shell.N(), &DPDU = shell.DPDU(), &DPDV = shell.DPDV();
-		const MatrixXu &T = shell.T();
-
-		fprintf(fout, "%u %u\n", vertexCount, tetrahedronCount);
-		uint32_t i;
-		for (i = 0; i < vertexCount; ++i) {
-			fprintf(fout, "%f %f %f\n", V(0, i), V(1, i), V(2, i));
-			fprintf(fout, "%f %f %f\n", UV(0, i), UV(1, i), UV(2, i));
-			fprintf(fout, "%f %f %f\n", N(0, i), N(1, i), N(2, i));
-			fprintf(fout, "%f %f %f %f %f %f\n", DPDU(0, i), DPDU(1, i), DPDU(2, i), DPDV(0, i), DPDV(1, i), DPDV(2, i));
-		}
-		for (i = 0; i < tetrahedronCount; ++i) {
-			fprintf(fout, "%u %u %u %u\n", T(0, i), T(1, i), T(2, i), T(3, i));
-		}
-	}
-
-	fclose(fout);
-	std::cout << "Save shell done." << std::endl;
+	saveShellText(filename, shell);
 }
\ No newline at end of file
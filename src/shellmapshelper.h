@@ -2,12 +2,17 @@
 
 #include "mycommon.h"
 #include "tetra.h"
+#include "occupancy.h"
 
 using nanogui::MatrixXf;
 using nanogui::MatrixXu;
+using Eigen::MatrixXi;
+using Eigen::VectorXf;
 
 extern void generateOffsetSurface(const MatrixXu &F, const MatrixXf &V, MatrixXu &oF, MatrixXf &oV, const float offset);
 extern void generateOffsetSurface(const MatrixXu &F, const MatrixXf &V, const MatrixXf &N, MatrixXu &oF, MatrixXf &oV, const float offset);
+/* Same as above with one offset per vertex, e.g. from computeSafeOffsets() */
+extern void generateOffsetSurface(const MatrixXu &F, const MatrixXf &V, const MatrixXf &N, MatrixXu &oF, MatrixXf &oV, const VectorXf &offsets);
 
 enum SPLIT_PATTERN {
 	SPLIT_PATTERN_NONE = 0,
@@ -22,11 +27,65 @@ enum SPLIT_PATTERN {
 	P(0, i) = 2: edge0(p0->p1) in triangle i has splitting pattern F.
 	P(0, i) = 0: edge0(p0->p1) in triangle i has not assigend a pattern.
 */
-extern void computePrimsSplittingPattern(const MatrixXu &F, MatrixXu &P);
+enum SPLIT_PATTERN_SOLVER {
+	SPLIT_PATTERN_SOLVER_DFS = 0,		// greedy assignment in face order, inconsistent prisms are repaired by a recursive DFS search
+	SPLIT_PATTERN_SOLVER_VERTEX_ORDER,	// each diagonal goes from the lower to the higher vertex index, consistent by construction
+	SPLIT_PATTERN_SOLVER_BOUNDED_DFS,	// same as DFS with an explicit stack and a search budget, falls back to VERTEX_ORDER when exceeded
+	SPLIT_PATTERN_SOLVER_COUNT
+};
+
+/* Maximum number of faces a single bounded DFS repair may visit */
+#define SPLIT_PATTERN_SEARCH_BUDGET 4096
+
+extern void computePrimsSplittingPattern(const MatrixXu &F, MatrixXu &P, SPLIT_PATTERN_SOLVER solver = SPLIT_PATTERN_SOLVER_BOUNDED_DFS,
+	uint32_t searchBudget = SPLIT_PATTERN_SEARCH_BUDGET);
+
+/* Same as above, reusing the face adjacency table (A, AE) built by buildFaceAdjacencyTable */
+extern void computePrimsSplittingPattern(const MatrixXu &F, const MatrixXi &A, const MatrixXu8 &AE, MatrixXu &P,
+	SPLIT_PATTERN_SOLVER solver = SPLIT_PATTERN_SOLVER_BOUNDED_DFS, uint32_t searchBudget = SPLIT_PATTERN_SEARCH_BUDGET);
+
+/* Vertices of tetrahedron i in a prism, indexed by the split patterns (p[i], p[j]) of edge i and the next edge j.
+	Entries are 3 * layer + corner, where layer 0 is the base and 1 the offset triangle, and corner 0, 1, 2 stands for
+	the prism corners i, j, k = j + 1. Pairs containing SPLIT_PATTERN_NONE are invalid. */
+static const uint8_t INVALID_TETRAHEDRON = 0xFF;
+static const uint8_t TETRAHEDRON_TABLE[SPLIT_PATTEN_COUNT][SPLIT_PATTEN_COUNT][4] = {
+	{ { INVALID_TETRAHEDRON }, { INVALID_TETRAHEDRON }, { INVALID_TETRAHEDRON } },
+	{ { INVALID_TETRAHEDRON }, { 0, 1, 4, 5 } /* RR */, { 0, 1, 4, 2 } /* RF */ },
+	{ { INVALID_TETRAHEDRON }, { 3, 1, 4, 5 } /* FR */, { 3, 1, 4, 2 } /* FF */ },
+};
 
+/* Vertices of tetrahedron i (0, 1, 2) of the prism over the base triangle 'face' with the split patterns p, the offset
+	vertex of base vertex v is baseCount + v. Returns false if the prism has an invalid pattern, tet is then degenerate
+	on the base vertex face[i]. Gives the same tetrahedra as constructTetrahedronMeshSimple(). */
+inline bool prismTetrahedron(const uint32_t face[3], const uint32_t p[3], uint32_t baseCount, int i, uint32_t tet[4]) {
+	bool valid = p[0] < SPLIT_PATTEN_COUNT && p[1] < SPLIT_PATTEN_COUNT && p[2] < SPLIT_PATTEN_COUNT;
+	const uint8_t *entry = valid ? TETRAHEDRON_TABLE[p[i]][p[i == 2 ? 0 : i + 1]] : &INVALID_TETRAHEDRON;
+	if (entry[0] == INVALID_TETRAHEDRON) {
+		tet[0] = tet[1] = tet[2] = tet[3] = face[i];
+		return false;
+	}
+	for (int c = 0; c < 4; ++c) {
+		int corner = i + entry[c] % 3;
+		tet[c] = face[corner >= 3 ? corner - 3 : corner] + (entry[c] >= 3 ? baseCount : 0);
+	}
+	return true;
+}
+
+/* Without texcoords bUV, bDPDU and bDPDV are empty, and so are UV, DPDU and DPDV of the shell */
 extern void constructTetrahedronMeshSimple(const MatrixXu &bF, const MatrixXf &bV, const MatrixXf &oV,
 	const MatrixXf &bUV, const MatrixXf &bN, const MatrixXf &bDPDU, const MatrixXf &bDPDV,
 	const MatrixXu &P, TetrahedronMesh &tetrahedronMesh);
 
+/* Same as above, leaving out the prisms without content in occupancy (see applyShellOccupancy()) unless it is empty */
+extern void constructTetrahedronMeshSimple(const MatrixXu &bF, const MatrixXf &bV, const MatrixXf &oV,
+	const MatrixXf &bUV, const MatrixXf &bN, const MatrixXf &bDPDU, const MatrixXf &bDPDV,
+	const MatrixXu &P, const ShellOccupancy &occupancy, TetrahedronMesh &tetrahedronMesh);
+
+/* Fill the 4 x T neighbour table TN() of a shell built by constructTetrahedronMeshSimple() over the base faces bF, with
+	the face adjacency table A (see buildFaceAdjacencyTable). The neighbours follow from the prism structure: a face of
+	tetrahedron 3f + i is on the base or offset triangle of prism f, on the side quad of an edge of f and shared with a
+	tetrahedron of the adjacent prism, or shared with another tetrahedron of prism f. */
+extern void computeTetrahedronNeighbors(const MatrixXu &bF, const MatrixXi &A, TetrahedronMesh &tetrahedronMesh);
+
 /* Save tetrahedron mesh to file in mitsuba required format */
 extern void saveShellToMitsuba(const std::string &filename, const TetrahedronMesh &shell);
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include "shellsweep.h"
+#include "shellmapshelper.h"
+#include "shellio.h"
+#include "parallel.h"
+
+void ShellSweep::build(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV, const MatrixXf &N, const MatrixXf &DPDU,
+	const MatrixXf &DPDV, const MatrixXu &P, const std::vector<float> &offsets, const VectorXf &scales) {
+	if (offsets.empty())
+		throw std::runtime_error("ShellSweep::build(): no offsets given");
+	if (scales.size() != 0 && scales.size() != V.cols())
+		throw std::runtime_error("ShellSweep::build(): expected " + std::to_string(V.cols()) + " scales, got " + std::to_string(scales.size()));
+	std::cout << "--Build shell sweep over " << offsets.size() << " offsets ..." << std::endl;
+	Timer<std::chrono::microseconds> timer;
+	mBaseCount = (uint32_t)V.cols();
+	mOffsets = offsets;
+	uint32_t shellCount = (uint32_t)offsets.size();
+
+	/* All offset layers in one pass over the base vertices */
+	mOffsetLayers.resize(3, (size_t)shellCount * mBaseCount);
+	parallel_for(0u, mBaseCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t v = begin; v < end; ++v) {
+			Vector3f p = V.col(v), n = N.col(v) * (scales.size() != 0 ? scales(v) : 1.0f);
+			for (uint32_t i = 0; i < shellCount; ++i)
+				mOffsetLayers.col((size_t)i * mBaseCount + v) = p + offsets[i] * n;
+		}
+	});
+
+	constructTetrahedronMeshSimple(F, V, mOffsetLayers.leftCols(mBaseCount), UV, N, DPDU, DPDV, P, mShared);
+
+	std::cout << "++Build shell sweep done. (V=" << mShared.getVertexCount() << ", T=" << mShared.getTetrahedronCount()
+		<< " per shell, took " << timeString(timer.value() / 1000.0) << ")" << std::endl;
+}
+
+void ShellSweep::clear() {
+	mBaseCount = 0;
+	mOffsets.clear();
+	mShared = TetrahedronMesh();
+	mOffsetLayers.resize(0, 0);
+}
+
+void ShellSweep::shell(uint32_t i, TetrahedronMesh &shell) const {
+	if (i >= getShellCount())
+		throw std::runtime_error("ShellSweep::shell(): shell " + std::to_string(i) + " out of range");
+	shell = mShared;
+	shell.V().rightCols(mBaseCount) = mOffsetLayers.middleCols((size_t)i * mBaseCount, mBaseCount);
+}
+
+void saveShellSweepBinary(const std::string &filename, const ShellSweep &sweep, bool checksum) {
+	const TetrahedronMesh &shared = sweep.shared();
+	std::cout << "Writing \"" << filename << "\" (V=" << shared.getVertexCount() << ", T=" << shared.getTetrahedronCount()
+		<< ", " << sweep.getShellCount() << " offsets) ..." << std::endl;
+
+	ShellFileWriter writer(shared.getVertexCount(), shared.getTetrahedronCount());
+	writer.addSection(SHELL_SECTION_V, shared.V());
+	writer.addSection(SHELL_SECTION_UV, shared.UV());
+	writer.addSection(SHELL_SECTION_N, shared.N());
+	writer.addSection(SHELL_SECTION_DPDU, shared.DPDU());
+	writer.addSection(SHELL_SECTION_DPDV, shared.DPDV());
+	writer.addSection(SHELL_SECTION_T, shared.T());
+	if (shared.hasNeighbors())
+		writer.addSection(SHELL_SECTION_TN, shared.TN());
+	writer.addSection(SHELL_SECTION_SWEEP_OFFSETS, SHELL_TYPE_FLOAT32, 1, sweep.getShellCount(), sweep.offsets().data());
+	/* The offset layer of shell 0 is already in SHELL_SECTION_V */
+	size_t layerSize = 3 * (size_t)sweep.getBaseVertexCount();
+	writer.addSection(SHELL_SECTION_SWEEP_LAYERS, SHELL_TYPE_FLOAT32, 3, (uint64_t)(sweep.getShellCount() - 1) * sweep.getBaseVertexCount(),
+		sweep.offsetLayers().data() + layerSize);
+	writer.write(filename, checksum);
+
+	std::cout << "Save shell done." << std::endl;
+}
@@ -0,0 +1,63 @@
+/*
+	shellsweep.h: Shells of one base mesh for a list of offsets
+
+	Of a shell built by constructTetrahedronMeshSimple() only the positions of the offset layer depend
+	on the offset: the tetrahedra follow from F and the split patterns P, the texcoords, normals and
+	tangents are those of the base vertices, and so is the neighbour table. Trying several offsets
+	therefore needs the adjacency, P and the shared arrays only once.
+
+	A ShellSweep keeps one shared shell, built for the first offset, and the offset layers of all shells
+	in one 3 x (shellCount * baseCount) matrix, computed in one parallel pass over the base vertices.
+	Shell i has the base positions of the shared shell and offset layer i. The binary file stores the
+	shared shell as usual, which readers unaware of sweeps see as the first shell, followed by the
+	offsets and the offset layers of the other shells (MappedShell::sweepShell()).
+*/
+
+#pragma once
+
+#include "mycommon.h"
+#include "tetra.h"
+
+#include <vector>
+
+using nanogui::MatrixXu;
+using nanogui::MatrixXf;
+using Eigen::VectorXf;
+
+class ShellSweep {
+public:
+	ShellSweep() : mBaseCount(0) { }
+
+	/* Build the shells over the base mesh (F, V, UV, N, DPDU, DPDV) with split patterns P for all offsets. With scales,
+		offset vertex v of shell i is V.col(v) + offsets[i] * scales(v) * N.col(v), e.g. with scales from
+		computeHeightMapOffsets() for an offset of 1. */
+	void build(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV, const MatrixXf &N, const MatrixXf &DPDU,
+		const MatrixXf &DPDV, const MatrixXu &P, const std::vector<float> &offsets, const VectorXf &scales = VectorXf());
+	void clear();
+
+	inline uint32_t getShellCount() const { return (uint32_t)mOffsets.size(); }
+	inline uint32_t getBaseVertexCount() const { return mBaseCount; }
+	inline const std::vector<float> &offsets() const { return mOffsets; }
+
+	/* Shell of the first offset, holding the arrays all shells share; neighbours computed for it hold for all */
+	inline const TetrahedronMesh &shared() const { return mShared; }
+	inline TetrahedronMesh &shared() { return mShared; }
+
+	/* 3 x (shellCount * baseCount), the offset layer of shell i are the columns i * baseCount .. (i + 1) * baseCount - 1 */
+	inline const MatrixXf &offsetLayers() const { return mOffsetLayers; }
+
+	/* Copy shell i into a tetrahedron mesh */
+	void shell(uint32_t i, TetrahedronMesh &shell) const;
+
+	/* Bytes used by the shared shell and the offset layers */
+	inline size_t memoryUsage() const { return mShared.memoryUsage() + sizeof(float) * (size_t)mOffsetLayers.size(); }
+
+private:
+	uint32_t mBaseCount;
+	std::vector<float> mOffsets;
+	TetrahedronMesh mShared;
+	MatrixXf mOffsetLayers;
+};
+
+/* Save all shells of the sweep in one binary shell file, sharing everything but the offset layers */
+extern void saveShellSweepBinary(const std::string &filename, const ShellSweep &sweep, bool checksum = true);
@@ -0,0 +1,262 @@
+#include "shelltraversal.h"
+#include "parallel.h"
+
+#include <cmath>
+
+/* Vertices of face k (opposite of vertex k) of a positively oriented tetrahedron, counter clockwise seen from outside */
+static const int TETRAHEDRON_FACE_VERTICES[4][3] = { { 1, 2, 3 }, { 0, 3, 2 }, { 0, 1, 3 }, { 0, 2, 1 } };
+
+/* Barycentric coordinates of a point on the boundary tolerated by the entry test, closes cracks along edges */
+#define BOUNDARY_HIT_EPSILON 1e-6f
+
+/* Vertex slots of face k of tetrahedron t in outward orientation */
+static inline void outwardFace(const MatrixXu &T, const MatrixXf &V, uint32_t t, int k, int slots[3]) {
+	Vector3f v0 = V.col(T(0, t));
+	Eigen::Matrix3f E;
+	E << V.col(T(1, t)) - v0, V.col(T(2, t)) - v0, V.col(T(3, t)) - v0;
+	bool positive = E.determinant() >= 0.0f;
+	slots[0] = TETRAHEDRON_FACE_VERTICES[k][0];
+	slots[1] = TETRAHEDRON_FACE_VERTICES[k][positive ? 1 : 2];
+	slots[2] = TETRAHEDRON_FACE_VERTICES[k][positive ? 2 : 1];
+}
+
+void ShellRayTraversal::build(const TetrahedronMesh &shell) {
+	if (!shell.hasNeighbors())
+		throw std::runtime_error("ShellRayTraversal::build(): the shell has no neighbour table!");
+	mShell = &shell;
+	const MatrixXu &T = shell.T(), &TN = shell.TN();
+	const MatrixXf &V = shell.V();
+	uint32_t tetrahedronCount = shell.getTetrahedronCount();
+
+	mBoundaryFaces.clear();
+	for (uint32_t t = 0; t < tetrahedronCount; ++t)
+		for (int k = 0; k < 4; ++k)
+			if (!isTetrahedronNeighbor(TN(k, t)) && TN(k, t) != TETRAHEDRON_DEGENERATE)
+				mBoundaryFaces.push_back(4 * t + k);
+
+	uint32_t faceCount = (uint32_t)mBoundaryFaces.size();
+	std::vector<AABB> bounds(faceCount);
+	parallel_for(0u, faceCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			uint32_t t = mBoundaryFaces[i] / 4, k = mBoundaryFaces[i] % 4;
+			for (int c = 0; c < 4; ++c)
+				if (c != (int)k)
+					bounds[i].expandBy(V.col(T(c, t)));
+		}
+	});
+	mBVH.build(bounds);
+}
+
+bool ShellRayTraversal::findBoundaryHit(const Ray &ray, float tMin, bool enteringOnly, BoundaryHit &hit) const {
+	const MatrixXu &T = mShell->T();
+	const MatrixXf &V = mShell->V(), &UV = mShell->UV();
+	const std::vector<uint32_t> &indices = mBVH.indices();
+	bool found = false;
+
+	Ray bounded(ray.o, ray.d, tMin, ray.maxt);
+	mBVH.traverseRay(bounded, ray.maxt, [&](uint32_t begin, uint32_t end, float &maxt) {
+		for (uint32_t i = begin; i < end; ++i) {
+			uint32_t code = mBoundaryFaces[indices[i]], t = code / 4;
+			int k = (int)(code % 4), slots[3];
+			outwardFace(T, V, t, k, slots);
+			Vector3f a = V.col(T(slots[0], t)), e1 = V.col(T(slots[1], t)) - a, e2 = V.col(T(slots[2], t)) - a;
+
+			/* Moeller-Trumbore, both orientations */
+			Vector3f pvec = ray.d.cross(e2);
+			float det = e1.dot(pvec);
+			if (det == 0.0f)
+				continue;
+			float invDet = 1.0f / det;
+			Vector3f tvec = ray.o - a;
+			float u = tvec.dot(pvec) * invDet;
+			if (u < -BOUNDARY_HIT_EPSILON || u > 1.0f + BOUNDARY_HIT_EPSILON)
+				continue;
+			Vector3f qvec = tvec.cross(e1);
+			float v = ray.d.dot(qvec) * invDet;
+			if (v < -BOUNDARY_HIT_EPSILON || u + v > 1.0f + BOUNDARY_HIT_EPSILON)
+				continue;
+			float distance = e2.dot(qvec) * invDet;
+			if (!(distance > tMin && distance <= maxt))
+				continue;
+			bool entering = ray.d.dot(e1.cross(e2)) < 0.0f;
+			if (enteringOnly && !entering)
+				continue;
+
+			maxt = distance;
+			found = true;
+			hit.tetrahedron = t;
+			hit.face = k;
+			hit.t = distance;
+			hit.entering = entering;
+			hit.uvw = (1.0f - u - v) * UV.col(T(slots[0], t)) + u * UV.col(T(slots[1], t)) + v * UV.col(T(slots[2], t));
+		}
+		return false;
+	});
+	return found;
+}
+
+float ShellRayTraversal::walk(const Ray &ray, uint32_t t, int face, float tEnter, const Vector3f &uvwEnter, float tEnd,
+	std::vector<ShellRaySegment> &segments) const {
+	const MatrixXu &T = mShell->T(), &TN = mShell->TN();
+	const MatrixXf &V = mShell->V(), &UV = mShell->UV();
+	float invLength2 = 1.0f / ray.d.squaredNorm();
+	Vector3f uvw = uvwEnter;
+
+	for (uint32_t step = 0; step <= mShell->getTetrahedronCount(); ++step) {
+		/* Pluecker products of the ray with the edges (i, j): pi[i][j] = d . ((v_i - o) x (v_j - o)) */
+		Vector3f relative[4];
+		for (int i = 0; i < 4; ++i)
+			relative[i] = V.col(T(i, t)) - ray.o;
+		float pi[4][4];
+		for (int i = 0; i < 4; ++i) {
+			pi[i][i] = 0.0f;
+			for (int j = i + 1; j < 4; ++j) {
+				pi[i][j] = ray.d.dot(relative[i].cross(relative[j]));
+				pi[j][i] = -pi[i][j];
+			}
+		}
+
+		/* The exit face has all three products non-negative in outward orientation, take the most robust one */
+		int exitFace = -1, exitSlots[3] = { 0, 0, 0 };
+		float best = -std::numeric_limits<float>::infinity(), weights[3] = { 0.0f, 0.0f, 0.0f };
+		for (int k = 0; k < 4; ++k) {
+			if (k == face)
+				continue;
+			int slots[3];
+			outwardFace(T, V, t, k, slots);
+			float w[3] = { pi[slots[1]][slots[2]], pi[slots[2]][slots[0]], pi[slots[0]][slots[1]] };
+			float lowest = std::min(w[0], std::min(w[1], w[2]));
+			if (lowest > best) {
+				best = lowest;
+				exitFace = k;
+				for (int c = 0; c < 3; ++c) {
+					exitSlots[c] = slots[c];
+					weights[c] = std::max(w[c], 0.0f);
+				}
+			}
+		}
+
+		float sum = weights[0] + weights[1] + weights[2];
+		if (!(sum > 0.0f)) {
+			weights[0] = weights[1] = weights[2] = 1.0f;
+			sum = 3.0f;
+		}
+		Vector3f point = Vector3f::Zero(), uvwExit = Vector3f::Zero();
+		for (int c = 0; c < 3; ++c) {
+			point += (weights[c] / sum) * relative[exitSlots[c]];
+			uvwExit += (weights[c] / sum) * UV.col(T(exitSlots[c], t));
+		}
+		float tExit = std::max(tEnter, point.dot(ray.d) * invLength2);
+
+		ShellRaySegment segment;
+		segment.tetrahedron = t;
+		segment.tEnter = tEnter;
+		segment.uvwEnter = uvw;
+		if (tExit >= tEnd) {
+			float alpha = tExit > tEnter ? (tEnd - tEnter) / (tExit - tEnter) : 0.0f;
+			segment.tExit = tEnd;
+			segment.uvwExit = uvw + alpha * (uvwExit - uvw);
+			segments.push_back(segment);
+			return tEnd;
+		}
+		segment.tExit = tExit;
+		segment.uvwExit = uvwExit;
+		segments.push_back(segment);
+
+		uint32_t next = TN(exitFace, t);
+		if (!isTetrahedronNeighbor(next))
+			return tExit;
+
+		/* Entry face of the neighbour: opposite of its vertex not on the shared face */
+		face = 0;
+		for (int c = 0; c < 4; ++c) {
+			uint32_t v = T(c, next);
+			if (v != T(exitSlots[0], t) && v != T(exitSlots[1], t) && v != T(exitSlots[2], t))
+				face = c;
+		}
+		t = next;
+		tEnter = tExit;
+		uvw = uvwExit;
+	}
+	return tEnter;
+}
+
+uint32_t ShellRayTraversal::traverse(const Ray &ray, std::vector<ShellRaySegment> &segments) const {
+	size_t first = segments.size();
+	if (mBoundaryFaces.empty() || !(ray.mint <= ray.maxt))
+		return 0;
+
+	/* The first crossing may lie beyond maxt if the ray ends inside the shell */
+	BoundaryHit hit;
+	Ray unbounded(ray.o, ray.d, ray.mint, std::numeric_limits<float>::infinity());
+	if (!findBoundaryHit(unbounded, std::nextafter(ray.mint, -std::numeric_limits<float>::infinity()), false, hit) ||
+		(hit.entering && hit.t > ray.maxt))
+		return 0;
+
+	float tCurrent;
+	if (hit.entering) {
+		tCurrent = walk(ray, hit.tetrahedron, hit.face, hit.t, hit.uvw, ray.maxt, segments);
+	}
+	else {
+		/* The ray starts inside: walk back from where it leaves the shell to its origin */
+		Ray backward(ray.o, -ray.d);
+		std::vector<ShellRaySegment> reversed;
+		walk(backward, hit.tetrahedron, hit.face, -hit.t, hit.uvw, -ray.mint, reversed);
+		for (auto it = reversed.rbegin(); it != reversed.rend(); ++it) {
+			ShellRaySegment segment;
+			segment.tetrahedron = it->tetrahedron;
+			segment.tEnter = -it->tExit;
+			segment.tExit = -it->tEnter;
+			segment.uvwEnter = it->uvwExit;
+			segment.uvwExit = it->uvwEnter;
+			/* Clip at maxt */
+			if (segment.tEnter >= ray.maxt)
+				break;
+			if (segment.tExit > ray.maxt) {
+				float alpha = (ray.maxt - segment.tEnter) / (segment.tExit - segment.tEnter);
+				segment.uvwExit = segment.uvwEnter + alpha * (segment.uvwExit - segment.uvwEnter);
+				segment.tExit = ray.maxt;
+			}
+			segments.push_back(segment);
+		}
+		tCurrent = hit.t;
+	}
+
+	/* Enter again after leaving the shell */
+	while (tCurrent < ray.maxt && findBoundaryHit(ray, tCurrent, true, hit))
+		tCurrent = walk(ray, hit.tetrahedron, hit.face, hit.t, hit.uvw, ray.maxt, segments);
+
+	return (uint32_t)(segments.size() - first);
+}
+
+void ShellRayTraversal::traverse(const std::vector<Ray> &rays, std::vector<uint32_t> &offsets, std::vector<ShellRaySegment> &segments) const {
+	uint32_t rayCount = (uint32_t)rays.size();
+	uint32_t blockCount = (rayCount + GRAIN_SIZE - 1) / GRAIN_SIZE;
+	std::vector<std::vector<ShellRaySegment>> blockSegments(blockCount);
+	offsets.resize(rayCount + 1);
+	offsets[0] = 0;
+
+	parallel_for(0u, rayCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		std::vector<ShellRaySegment> &local = blockSegments[begin / GRAIN_SIZE];
+		for (uint32_t i = begin; i < end; ++i)
+			offsets[i + 1] = traverse(rays[i], local);
+	});
+
+	std::vector<size_t> blockOffsets(blockCount + 1, 0);
+	for (uint32_t block = 0; block < blockCount; ++block)
+		blockOffsets[block + 1] = blockOffsets[block] + blockSegments[block].size();
+	for (uint32_t i = 0; i < rayCount; ++i)
+		offsets[i + 1] += offsets[i];
+
+	segments.resize(blockOffsets[blockCount]);
+	parallel_for(0u, blockCount, 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t block = begin; block < end; ++block) {
+			std::copy(blockSegments[block].begin(), blockSegments[block].end(), segments.begin() + blockOffsets[block]);
+			std::vector<ShellRaySegment>().swap(blockSegments[block]);
+		}
+	});
+}
+
+size_t ShellRayTraversal::memoryUsage() const {
+	return mBVH.memoryUsage() + sizeof(uint32_t) * mBoundaryFaces.size();
+}
@@ -0,0 +1,74 @@
+/*
+	shelltraversal.h: Walking rays through the tetrahedra of a shell
+
+	A ray enters the shell through a boundary face (base surface, offset surface or a side face over
+	a boundary edge), found with a BVH over these faces. From there it walks from tetrahedron to
+	tetrahedron through the neighbour table TN(): the exit face of the current tetrahedron is the one
+	whose three edges the ray passes on the same side of, decided by the signs of the permuted inner
+	products of the Pluecker coordinates of the ray and the edges. The same products are the
+	barycentric coordinates of the exit point on the face, which give its (u, v, w). Leaving through a
+	boundary face, the ray may enter the shell again further on.
+
+	A ray starting inside the shell first crosses the boundary leaving it; the tetrahedra between its
+	origin and that face are found by walking back from there.
+
+	The cost per ray is one BVH query per entry into the shell plus a constant per tetrahedron crossed.
+	uvw is affine inside a tetrahedron, so it varies linearly between the entry and exit of a segment.
+*/
+
+#pragma once
+
+#include "mycommon.h"
+#include "tetra.h"
+#include "bvh.h"
+
+using nanogui::MatrixXu;
+using nanogui::Vector3f;
+
+/* Part of a ray inside one tetrahedron */
+struct ShellRaySegment {
+	uint32_t tetrahedron;
+	float tEnter, tExit;
+	Vector3f uvwEnter, uvwExit;
+};
+
+class ShellRayTraversal {
+public:
+	ShellRayTraversal() : mShell(nullptr) { }
+
+	/* Build the BVH over the boundary faces; the shell needs its neighbour table (computeTetrahedronNeighbors())
+	   and is referenced, it has to outlive the traversal */
+	void build(const TetrahedronMesh &shell);
+
+	/* Append the segments of the ray within [ray.mint, ray.maxt] in order, returns their number */
+	uint32_t traverse(const Ray &ray, std::vector<ShellRaySegment> &segments) const;
+
+	/* Traverse the rays in parallel, the segments of rays[i] are segments[offsets[i]] .. segments[offsets[i + 1] - 1] */
+	void traverse(const std::vector<Ray> &rays, std::vector<uint32_t> &offsets, std::vector<ShellRaySegment> &segments) const;
+
+	inline uint32_t getBoundaryFaceCount() const { return (uint32_t)mBoundaryFaces.size(); }
+
+	/* Bytes used by the BVH and the boundary faces */
+	size_t memoryUsage() const;
+
+private:
+	struct BoundaryHit {
+		uint32_t tetrahedron;
+		int face;
+		float t;
+		bool entering;
+		Vector3f uvw;
+	};
+
+	/* Closest boundary crossing with t in (tMin, maxt], only entering ones if enteringOnly */
+	bool findBoundaryHit(const Ray &ray, float tMin, bool enteringOnly, BoundaryHit &hit) const;
+
+	/* Walk from tetrahedron t entered through face 'face' at tEnter until the ray leaves the shell or passes tEnd,
+	   returns the exit distance */
+	float walk(const Ray &ray, uint32_t t, int face, float tEnter, const Vector3f &uvwEnter, float tEnd,
+		std::vector<ShellRaySegment> &segments) const;
+
+	const TetrahedronMesh *mShell;
+	BVH mBVH;
+	std::vector<uint32_t> mBoundaryFaces;		// 4 * tetrahedron + face
+};
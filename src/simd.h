@@ -0,0 +1,159 @@
+/*
+	simd.h: Thin packet wrappers over AVX2, SSE2 and plain floats
+
+	Kernels are written once as templates over the packet type P and instantiated for every
+	instruction set. All packets provide the same operators and free functions; P::Mask is the
+	result of a comparison and is consumed by select() and maskBits().
+
+	This header deliberately does not depend on Eigen or the standard library containers, so it
+	can be included by translation units compiled with different instruction set flags. All of it
+	is in an anonymous namespace: every translation unit keeps its own copies of the packets and
+	functions, so out-of-line copies emitted with AVX2 enabled (e.g. at -O0) can never be picked by
+	the linker for SSE2 or scalar callers. For the same reason scalar code uses sqrtf() and fabsf()
+	of the C library rather than the inline overloads of std::.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+
+#if defined(__AVX2__)
+#define SHELLMAPS_HAS_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SHELLMAPS_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+/* Scalar fallback, one lane */
+struct PacketScalar {
+	enum { Width = 1 };
+	typedef bool Mask;
+
+	float v;
+
+	inline PacketScalar() { }
+	inline PacketScalar(float f) : v(f) { }
+
+	static inline PacketScalar load(const float *p) { return PacketScalar(*p); }
+	inline void store(float *p) const { *p = v; }
+	static inline PacketScalar gather(const float *base, const uint32_t *index, uint32_t stride, uint32_t offset) {
+		return PacketScalar(base[index[0] * stride + offset]);
+	}
+};
+
+inline PacketScalar operator+(const PacketScalar &a, const PacketScalar &b) { return PacketScalar(a.v + b.v); }
+inline PacketScalar operator-(const PacketScalar &a, const PacketScalar &b) { return PacketScalar(a.v - b.v); }
+inline PacketScalar operator*(const PacketScalar &a, const PacketScalar &b) { return PacketScalar(a.v * b.v); }
+inline PacketScalar operator/(const PacketScalar &a, const PacketScalar &b) { return PacketScalar(a.v / b.v); }
+inline PacketScalar operator-(const PacketScalar &a) { return PacketScalar(-a.v); }
+inline PacketScalar sqrt(const PacketScalar &a) { return PacketScalar(sqrtf(a.v)); }
+inline PacketScalar abs(const PacketScalar &a) { return PacketScalar(fabsf(a.v)); }
+inline PacketScalar min(const PacketScalar &a, const PacketScalar &b) { return PacketScalar(b.v < a.v ? b.v : a.v); }
+inline PacketScalar max(const PacketScalar &a, const PacketScalar &b) { return PacketScalar(a.v < b.v ? b.v : a.v); }
+inline bool lt(const PacketScalar &a, const PacketScalar &b) { return a.v < b.v; }
+inline bool eq(const PacketScalar &a, const PacketScalar &b) { return a.v == b.v; }
+inline PacketScalar select(bool mask, const PacketScalar &a, const PacketScalar &b) { return mask ? a : b; }
+inline int maskBits(bool mask) { return mask ? 1 : 0; }
+
+#if defined(SHELLMAPS_HAS_SSE2)
+/* SSE2, four lanes */
+struct PacketSSE {
+	enum { Width = 4 };
+	typedef PacketSSE Mask;
+
+	__m128 v;
+
+	inline PacketSSE() { }
+	inline PacketSSE(__m128 v) : v(v) { }
+	inline PacketSSE(float f) : v(_mm_set1_ps(f)) { }
+
+	static inline PacketSSE load(const float *p) { return PacketSSE(_mm_loadu_ps(p)); }
+	inline void store(float *p) const { _mm_storeu_ps(p, v); }
+	static inline PacketSSE gather(const float *base, const uint32_t *index, uint32_t stride, uint32_t offset) {
+		return PacketSSE(_mm_setr_ps(base[index[0] * stride + offset], base[index[1] * stride + offset],
+			base[index[2] * stride + offset], base[index[3] * stride + offset]));
+	}
+};
+
+inline PacketSSE operator+(const PacketSSE &a, const PacketSSE &b) { return PacketSSE(_mm_add_ps(a.v, b.v)); }
+inline PacketSSE operator-(const PacketSSE &a, const PacketSSE &b) { return PacketSSE(_mm_sub_ps(a.v, b.v)); }
+inline PacketSSE operator*(const PacketSSE &a, const PacketSSE &b) { return PacketSSE(_mm_mul_ps(a.v, b.v)); }
+inline PacketSSE operator/(const PacketSSE &a, const PacketSSE &b) { return PacketSSE(_mm_div_ps(a.v, b.v)); }
+inline PacketSSE operator-(const PacketSSE &a) { return PacketSSE(_mm_xor_ps(a.v, _mm_set1_ps(-0.0f))); }
+inline PacketSSE sqrt(const PacketSSE &a) { return PacketSSE(_mm_sqrt_ps(a.v)); }
+inline PacketSSE abs(const PacketSSE &a) { return PacketSSE(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)); }
+inline PacketSSE min(const PacketSSE &a, const PacketSSE &b) { return PacketSSE(_mm_min_ps(a.v, b.v)); }
+inline PacketSSE max(const PacketSSE &a, const PacketSSE &b) { return PacketSSE(_mm_max_ps(a.v, b.v)); }
+inline PacketSSE lt(const PacketSSE &a, const PacketSSE &b) { return PacketSSE(_mm_cmplt_ps(a.v, b.v)); }
+inline PacketSSE eq(const PacketSSE &a, const PacketSSE &b) { return PacketSSE(_mm_cmpeq_ps(a.v, b.v)); }
+inline PacketSSE select(const PacketSSE &mask, const PacketSSE &a, const PacketSSE &b) {
+	return PacketSSE(_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)));
+}
+inline int maskBits(const PacketSSE &mask) { return _mm_movemask_ps(mask.v); }
+#endif
+
+#if defined(SHELLMAPS_HAS_AVX2)
+/* AVX2, eight lanes */
+struct PacketAVX2 {
+	enum { Width = 8 };
+	typedef PacketAVX2 Mask;
+
+	__m256 v;
+
+	inline PacketAVX2() { }
+	inline PacketAVX2(__m256 v) : v(v) { }
+	inline PacketAVX2(float f) : v(_mm256_set1_ps(f)) { }
+
+	static inline PacketAVX2 load(const float *p) { return PacketAVX2(_mm256_loadu_ps(p)); }
+	inline void store(float *p) const { _mm256_storeu_ps(p, v); }
+	static inline PacketAVX2 gather(const float *base, const uint32_t *index, uint32_t stride, uint32_t offset) {
+		__m256i i = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(index));
+		i = _mm256_add_epi32(_mm256_mullo_epi32(i, _mm256_set1_epi32((int) stride)), _mm256_set1_epi32((int) offset));
+		return PacketAVX2(_mm256_i32gather_ps(base, i, 4));
+	}
+};
+
+inline PacketAVX2 operator+(const PacketAVX2 &a, const PacketAVX2 &b) { return PacketAVX2(_mm256_add_ps(a.v, b.v)); }
+inline PacketAVX2 operator-(const PacketAVX2 &a, const PacketAVX2 &b) { return PacketAVX2(_mm256_sub_ps(a.v, b.v)); }
+inline PacketAVX2 operator*(const PacketAVX2 &a, const PacketAVX2 &b) { return PacketAVX2(_mm256_mul_ps(a.v, b.v)); }
+inline PacketAVX2 operator/(const PacketAVX2 &a, const PacketAVX2 &b) { return PacketAVX2(_mm256_div_ps(a.v, b.v)); }
+inline PacketAVX2 operator-(const PacketAVX2 &a) { return PacketAVX2(_mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f))); }
+inline PacketAVX2 sqrt(const PacketAVX2 &a) { return PacketAVX2(_mm256_sqrt_ps(a.v)); }
+inline PacketAVX2 abs(const PacketAVX2 &a) { return PacketAVX2(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)); }
+inline PacketAVX2 min(const PacketAVX2 &a, const PacketAVX2 &b) { return PacketAVX2(_mm256_min_ps(a.v, b.v)); }
+inline PacketAVX2 max(const PacketAVX2 &a, const PacketAVX2 &b) { return PacketAVX2(_mm256_max_ps(a.v, b.v)); }
+inline PacketAVX2 lt(const PacketAVX2 &a, const PacketAVX2 &b) { return PacketAVX2(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+inline PacketAVX2 eq(const PacketAVX2 &a, const PacketAVX2 &b) { return PacketAVX2(_mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ)); }
+inline PacketAVX2 select(const PacketAVX2 &mask, const PacketAVX2 &a, const PacketAVX2 &b) {
+	return PacketAVX2(_mm256_blendv_ps(b.v, a.v, mask.v));
+}
+inline int maskBits(const PacketAVX2 &mask) { return _mm256_movemask_ps(mask.v); }
+#endif
+
+/* Packet usable in every translation unit, the AVX2 packet needs a runtime check of the CPU */
+#if defined(SHELLMAPS_HAS_SSE2)
+typedef PacketSSE PacketDefault;
+#else
+typedef PacketScalar PacketDefault;
+#endif
+
+/* Same polynomial and operation order as fast_acos() in mycommon.h */
+template <typename P> inline P packetFastAcos(P x) {
+	P negate = select(lt(x, P(0.0f)), P(1.0f), P(0.0f));
+	x = abs(x);
+	P ret = -0.0187293f;
+	ret = ret * x; ret = ret + 0.0742610f;
+	ret = ret * x; ret = ret - 0.2121144f;
+	ret = ret * x; ret = ret + 1.5707288f;
+	ret = ret * sqrt(P(1.0f) - x);
+	ret = ret - P(2.0f) * negate * ret;
+	return negate * P(3.14159265358979323846f) + ret;
+}
+
+}
@@ -0,0 +1,301 @@
+#include "stagecache.h"
+#include "mmapfile.h"
+#include "parallel.h"
+
+#include <cstring>
+#include <cstdio>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <direct.h>
+#endif
+
+/* Bytes hashed per task by hashData() */
+#define HASH_BLOCK_SIZE (1 << 20)
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/* Finalizer of MurmurHash3 */
+static inline uint64_t fmix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+/* One lane of the MurmurHash3 (x64) body over 8 byte words */
+static uint64_t hashBlock(const uint8_t *data, size_t size, uint64_t seed) {
+	const uint64_t c1 = 0x87c37b91114253d5ull, c2 = 0x4cf5ad432745937full;
+	uint64_t hash = seed;
+	size_t words = size / 8;
+	for (size_t i = 0; i < words; ++i) {
+		uint64_t k;
+		memcpy(&k, data + 8 * i, 8);
+		k *= c1; k = rotl64(k, 31); k *= c2;
+		hash ^= k;
+		hash = rotl64(hash, 27) * 5 + 0x52dce729;
+	}
+	if (size % 8) {
+		uint64_t k = 0;
+		memcpy(&k, data + 8 * words, size % 8);
+		k *= c1; k = rotl64(k, 31); k *= c2;
+		hash ^= k;
+	}
+	return fmix64(hash ^ size);
+}
+
+uint64_t hashData(const void *data, size_t size, uint64_t seed) {
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+	uint32_t blockCount = (uint32_t)((size + HASH_BLOCK_SIZE - 1) / HASH_BLOCK_SIZE);
+	std::vector<uint64_t> blockHashes(blockCount);
+
+	parallel_for(0, blockCount, 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t block = begin; block < end; ++block) {
+			size_t offset = (size_t)block * HASH_BLOCK_SIZE;
+			blockHashes[block] = hashBlock(bytes + offset, std::min<size_t>(HASH_BLOCK_SIZE, size - offset), seed + block);
+		}
+	});
+
+	uint64_t hash = fmix64(seed ^ size);
+	for (uint64_t blockHash : blockHashes)
+		hash = fmix64(hashCombine(hash, blockHash));
+	return hash;
+}
+
+uint64_t hashFile(const std::string &filename) {
+	MemoryMappedFile file(filename);
+	file.adviseSequential();
+	return hashData(file.data(), file.size());
+}
+
+static bool isDirectory(const std::string &path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFDIR) != 0;
+}
+
+static bool fileExists(const std::string &path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFREG) != 0;
+}
+
+void StageCache::open(const std::string &directory) {
+	mDirectory = directory;
+	while (mDirectory.size() > 1 && (mDirectory.back() == '/' || mDirectory.back() == '\\'))
+		mDirectory.pop_back();
+	if (mDirectory.empty() || isDirectory(mDirectory))
+		return;
+
+#if defined(_WIN32)
+	int result = _mkdir(mDirectory.c_str());
+#else
+	int result = mkdir(mDirectory.c_str(), 0755);
+#endif
+	if (result != 0 && !isDirectory(mDirectory))
+		throw std::runtime_error("Unable to create cache directory \"" + mDirectory + "\"!");
+}
+
+uint64_t StageCache::stageKey(const std::string &stage, uint64_t hash) const {
+	uint64_t key = hashData(stage.data(), stage.size(), STAGE_CACHE_VERSION);
+	return hashCombine(key, hash);
+}
+
+uint64_t StageCache::objKey(const std::string &filename) const {
+	if (!isEnabled())
+		return 0;
+	return stageKey("obj", hashFile(filename));
+}
+
+uint64_t StageCache::vertexAttributesKey(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV, bool angleWeight) const {
+	if (!isEnabled())
+		return 0;
+	uint64_t hash = hashMatrix(UV, hashMatrix(V, hashMatrix(F)));
+	return stageKey("attributes", hashCombine(hash, angleWeight ? 1 : 0));
+}
+
+uint64_t StageCache::adjacencyKey(const MatrixXu &F) const {
+	if (!isEnabled())
+		return 0;
+	return stageKey("adjacency", hashMatrix(F));
+}
+
+uint64_t StageCache::patternKey(const MatrixXu &F, SPLIT_PATTERN_SOLVER solver, uint32_t searchBudget) const {
+	if (!isEnabled())
+		return 0;
+	uint64_t hash = hashCombine(hashMatrix(F), (uint64_t)solver);
+	return stageKey("pattern", hashCombine(hash, searchBudget));
+}
+
+std::string StageCache::entryPath(const std::string &stage, uint64_t key) const {
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+	return mDirectory + "/" + stage + "-" + name + ".cache";
+}
+
+bool StageCache::lookup(const std::string &stage, uint64_t key, MappedShell &entry) const {
+	if (!isEnabled())
+		return false;
+	std::string path = entryPath(stage, key);
+	if (!fileExists(path))
+		return false;
+	try {
+		entry.open(path, true);
+	} catch (const std::exception &e) {
+		std::cerr << "Ignoring damaged cache entry: " << e.what() << std::endl;
+		return false;
+	}
+	std::cout << "Using cached " << stage << " \"" << path << "\"" << std::endl;
+	return true;
+}
+
+void StageCache::store(const std::string &stage, uint64_t key, const ShellFileWriter &writer) const {
+	if (!isEnabled())
+		return;
+	std::string path = entryPath(stage, key);
+	std::string temporary = path + ".tmp" + std::to_string(
+		(unsigned long long)std::chrono::high_resolution_clock::now().time_since_epoch().count());
+	try {
+		writer.write(temporary, true);
+#if defined(_WIN32)
+		remove(path.c_str());
+#endif
+		if (rename(temporary.c_str(), path.c_str()) != 0)
+			throw std::runtime_error("Unable to rename \"" + temporary + "\" to \"" + path + "\"");
+	} catch (const std::exception &e) {
+		remove(temporary.c_str());
+		std::cerr << "Unable to store cache entry: " << e.what() << std::endl;
+	}
+}
+
+/* Copy section 'id' of an entry, which has to have the given type and number of rows */
+template <typename Matrix> static void readSection(const MappedShell &entry, uint32_t id, uint32_t type, uint32_t rows, Matrix &M) {
+	const ShellFileSection *section = entry.findSection(id);
+	if (!section || section->type != type || section->rows != rows)
+		throw std::runtime_error("section " + std::to_string(id) + " is missing or has an unexpected layout");
+	M.resize(rows, (Eigen::DenseIndex)section->cols);
+	if (section->size > 0)
+		memcpy(M.data(), entry.sectionData(*section), (size_t)section->size);
+}
+
+/* Run the copies of a lookup, a failing one turns the hit into a miss */
+template <typename Body> static bool readEntry(const std::string &stage, const Body &body) {
+	try {
+		body();
+		return true;
+	} catch (const std::exception &e) {
+		std::cerr << "Ignoring damaged cache entry of " << stage << ": " << e.what() << std::endl;
+		return false;
+	}
+}
+
+bool StageCache::loadObj(uint64_t key, MatrixXu &F, MatrixXf &V, MatrixXf &UV) const {
+	MappedShell entry;
+	if (!lookup("obj", key, entry))
+		return false;
+	return readEntry("obj", [&]() {
+		readSection(entry, 0, SHELL_TYPE_UINT32, 3, F);
+		readSection(entry, 1, SHELL_TYPE_FLOAT32, 3, V);
+		readSection(entry, 2, SHELL_TYPE_FLOAT32, 2, UV);
+		if (UV.cols() != 0 && UV.cols() != V.cols())
+			throw std::runtime_error("texcoord count does not match the vertex count");
+	});
+}
+
+void StageCache::storeObj(uint64_t key, const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV) const {
+	if (!isEnabled())
+		return;
+	ShellFileWriter writer((uint32_t)V.cols(), 0);
+	writer.addSection(0, F);
+	writer.addSection(1, V);
+	writer.addSection(2, SHELL_TYPE_FLOAT32, 2, (uint64_t)UV.cols(), UV.data());
+	store("obj", key, writer);
+}
+
+bool StageCache::loadVertexAttributes(uint64_t key, MatrixXf &N, MatrixXf &DPDU, MatrixXf &DPDV, MeshStats &stats) const {
+	MappedShell entry;
+	if (!lookup("attributes", key, entry))
+		return false;
+	return readEntry("attributes", [&]() {
+		readSection(entry, 0, SHELL_TYPE_FLOAT32, 3, N);
+		readSection(entry, 1, SHELL_TYPE_FLOAT32, 3, DPDU);
+		readSection(entry, 2, SHELL_TYPE_FLOAT32, 3, DPDV);
+
+		double values[13];
+		const ShellFileSection *section = entry.findSection(3);
+		if (!section || section->type != SHELL_TYPE_FLOAT64 || section->rows != 13 || section->cols != 1)
+			throw std::runtime_error("unexpected mesh statistics");
+		memcpy(values, entry.sectionData(*section), sizeof(values));
+		for (int i = 0; i < 3; ++i) {
+			stats.mAABB.min[i] = (float)values[i];
+			stats.mAABB.max[i] = (float)values[3 + i];
+			stats.mWeightedCenter[i] = (float)values[6 + i];
+		}
+		stats.mSurfaceArea = values[9];
+		stats.mMaximumEdgeLength = values[10];
+		stats.mMinimumEdgeLength = values[11];
+		stats.mAverageEdgeLength = values[12];
+	});
+}
+
+void StageCache::storeVertexAttributes(uint64_t key, const MatrixXf &N, const MatrixXf &DPDU, const MatrixXf &DPDV, const MeshStats &stats) const {
+	if (!isEnabled())
+		return;
+	double values[13];
+	for (int i = 0; i < 3; ++i) {
+		values[i] = stats.mAABB.min[i];
+		values[3 + i] = stats.mAABB.max[i];
+		values[6 + i] = stats.mWeightedCenter[i];
+	}
+	values[9] = stats.mSurfaceArea;
+	values[10] = stats.mMaximumEdgeLength;
+	values[11] = stats.mMinimumEdgeLength;
+	values[12] = stats.mAverageEdgeLength;
+
+	ShellFileWriter writer((uint32_t)N.cols(), 0);
+	writer.addSection(0, N);
+	writer.addSection(1, DPDU);
+	writer.addSection(2, DPDV);
+	writer.addSection(3, SHELL_TYPE_FLOAT64, 13, 1, values);
+	store("attributes", key, writer);
+}
+
+bool StageCache::loadAdjacency(uint64_t key, MatrixXi &A, MatrixXu8 &AE) const {
+	MappedShell entry;
+	if (!lookup("adjacency", key, entry))
+		return false;
+	return readEntry("adjacency", [&]() {
+		readSection(entry, 0, SHELL_TYPE_INT32, 3, A);
+		readSection(entry, 1, SHELL_TYPE_UINT8, 3, AE);
+		if (A.cols() != AE.cols())
+			throw std::runtime_error("inconsistent adjacency tables");
+	});
+}
+
+void StageCache::storeAdjacency(uint64_t key, const MatrixXi &A, const MatrixXu8 &AE) const {
+	if (!isEnabled())
+		return;
+	ShellFileWriter writer(0, 0);
+	writer.addSection(0, A);
+	writer.addSection(1, AE);
+	store("adjacency", key, writer);
+}
+
+bool StageCache::loadPattern(uint64_t key, MatrixXu &P) const {
+	MappedShell entry;
+	if (!lookup("pattern", key, entry))
+		return false;
+	return readEntry("pattern", [&]() {
+		readSection(entry, 0, SHELL_TYPE_UINT32, 3, P);
+	});
+}
+
+void StageCache::storePattern(uint64_t key, const MatrixXu &P) const {
+	if (!isEnabled())
+		return;
+	ShellFileWriter writer(0, 0);
+	writer.addSection(0, P);
+	store("pattern", key, writer);
+}
@@ -0,0 +1,91 @@
+/*
+	stagecache.h: Persistent, content addressed cache of pipeline stage outputs
+
+	Every entry holds the outputs of one stage for one set of inputs and parameters. Its key is a hash
+	of exactly those (e.g. hash(F) for the adjacency table, hash(F, V, UV) for normals and tangents),
+	so changing the offset reuses everything up to the offset surface, while editing the mesh misses
+	every stage depending on it. Entries are files of the binary shell container (see shellio.h),
+	section i holding output i, named "<stage>-<key>.cache" inside the cache directory.
+
+	A disabled cache (empty directory) misses every lookup and ignores every store. Damaged entries
+	count as misses, failing stores only print a warning.
+*/
+
+#pragma once
+
+#include "mycommon.h"
+#include "meshstats.h"
+#include "shellmapshelper.h"
+#include "shellio.h"
+
+using nanogui::MatrixXf;
+using nanogui::MatrixXu;
+using Eigen::MatrixXi;
+
+/* Bump when the output of a cached stage changes, older entries are ignored afterwards */
+#define STAGE_CACHE_VERSION 1
+
+/* Hash of a block of memory, blocks of 1 MiB are hashed in parallel */
+extern uint64_t hashData(const void *data, size_t size, uint64_t seed = 0);
+
+/* Hash of the contents of a file */
+extern uint64_t hashFile(const std::string &filename);
+
+inline uint64_t hashCombine(uint64_t hash, uint64_t value) {
+	hash ^= value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+	return hash;
+}
+
+/* Hash of the shape and the elements of a matrix */
+template <typename Matrix> uint64_t hashMatrix(const Matrix &M, uint64_t seed = 0) {
+	uint64_t shape[2] = { (uint64_t)M.rows(), (uint64_t)M.cols() };
+	return hashData(M.data(), sizeof(typename Matrix::Scalar) * (size_t)M.size(), hashData(shape, sizeof(shape), seed));
+}
+
+class StageCache {
+public:
+	StageCache() { }
+	explicit StageCache(const std::string &directory) { open(directory); }
+
+	/* Use the given directory (created if it does not exist), an empty string disables the cache */
+	void open(const std::string &directory);
+
+	inline bool isEnabled() const { return !mDirectory.empty(); }
+	inline const std::string &directory() const { return mDirectory; }
+
+	/* Keys of the stages, 0 if the cache is disabled */
+	uint64_t objKey(const std::string &filename) const;
+	uint64_t vertexAttributesKey(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV, bool angleWeight) const;
+	uint64_t adjacencyKey(const MatrixXu &F) const;
+	uint64_t patternKey(const MatrixXu &F, SPLIT_PATTERN_SOLVER solver, uint32_t searchBudget) const;
+
+	/* loadObjShareVertexNotShareTexcoord() */
+	bool loadObj(uint64_t key, MatrixXu &F, MatrixXf &V, MatrixXf &UV) const;
+	void storeObj(uint64_t key, const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV) const;
+
+	/* computeVertexAttributes(), i.e. the vertex normals and tangents and the mesh statistics */
+	bool loadVertexAttributes(uint64_t key, MatrixXf &N, MatrixXf &DPDU, MatrixXf &DPDV, MeshStats &stats) const;
+	void storeVertexAttributes(uint64_t key, const MatrixXf &N, const MatrixXf &DPDU, const MatrixXf &DPDV, const MeshStats &stats) const;
+
+	/* buildFaceAdjacencyTable() */
+	bool loadAdjacency(uint64_t key, MatrixXi &A, MatrixXu8 &AE) const;
+	void storeAdjacency(uint64_t key, const MatrixXi &A, const MatrixXu8 &AE) const;
+
+	/* computePrimsSplittingPattern() */
+	bool loadPattern(uint64_t key, MatrixXu &P) const;
+	void storePattern(uint64_t key, const MatrixXu &P) const;
+
+	/* Path of the entry of a stage */
+	std::string entryPath(const std::string &stage, uint64_t key) const;
+
+	/* Map the entry of a stage, false if there is none or it is damaged */
+	bool lookup(const std::string &stage, uint64_t key, MappedShell &entry) const;
+
+	/* Write the entry of a stage through a temporary file, so readers never see partial entries */
+	void store(const std::string &stage, uint64_t key, const ShellFileWriter &writer) const;
+
+private:
+	uint64_t stageKey(const std::string &stage, uint64_t hash) const;
+
+	std::string mDirectory;
+};
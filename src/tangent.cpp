@@ -1,73 +1,97 @@
 #include "tangent.h"
+#include "adjacenttriangles.h"
+#include "parallel.h"
 
 void computeVertexTangents(const MatrixXu &F, const MatrixXf &V, const MatrixXf &UV, MatrixXf &DPDU, MatrixXf &DPDV, bool angleWeight) {
 	std::cout << "--Computing tangent spaces ..." << std::endl;
-	DPDU.resize(V.rows(), V.cols());
-	DPDU.setZero();
-	DPDV.resize(V.rows(), V.cols());
-	DPDV.setZero();
 
 	using nanogui::Vector2f;
 	const float RCPOVERFLOW_FLT = 2.93873587705571876e-39f;
 
+	/* Compute the contribution of every corner in parallel, column 3 * f + i belongs to vertex F(i, f) */
 	uint32_t trianglesCount = F.cols();
-	for (uint32_t f = 0; f < trianglesCount; ++f) {
-		for (int i = 0; i < 3; ++i) {
-			Vector3f v0 = V.col(F(i, f)),
-	     			 v1 = V.col(F((i + 1) % 3, f)),
-				     v2 = V.col(F((i + 2) % 3, f));
-			Vector2f uv0 = UV.col(F(i, f)),
-				     uv1 = UV.col(F((i + 1) % 3, f)),
-				     uv2 = UV.col(F((i + 2) % 3, f));
-
-			Vector3f dP1 = v1 - v0, dP2 = v2 - v0;
-			Vector2f dUV1 = uv1 - uv0, dUV2 = uv2 - uv0;
-			Vector3f n = dP1.cross(dP2);
-			float length = n.norm();
-
-			Vector3f dpdu, dpdv;
-
-			float determinant = dUV1.x() * dUV2.y() - dUV1.y() * dUV2.x();
-			if (determinant == 0) {
-				coordinate_system(n / length, dpdu, dpdv);
+	MatrixXf CU(3, 3 * trianglesCount), CV(3, 3 * trianglesCount);
+
+	parallel_for(0u, trianglesCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t f = begin; f < end; ++f) {
+			for (int i = 0; i < 3; ++i) {
+				Vector3f v0 = V.col(F(i, f)),
+						 v1 = V.col(F((i + 1) % 3, f)),
+						 v2 = V.col(F((i + 2) % 3, f));
+				Vector2f uv0 = UV.col(F(i, f)),
+						 uv1 = UV.col(F((i + 1) % 3, f)),
+						 uv2 = UV.col(F((i + 2) % 3, f));
+
+				Vector3f dP1 = v1 - v0, dP2 = v2 - v0;
+				Vector2f dUV1 = uv1 - uv0, dUV2 = uv2 - uv0;
+				Vector3f n = dP1.cross(dP2);
+				float length = n.norm();
+
+				Vector3f dpdu, dpdv;
+
+				float determinant = dUV1.x() * dUV2.y() - dUV1.y() * dUV2.x();
+				if (determinant == 0) {
+					coordinate_system(n / length, dpdu, dpdv);
+				}
+				else {
+					float invDet = 1.0f / determinant;
+					dpdu = ( dUV2.y() * dP1 - dUV1.y() * dP2) * invDet;
+					dpdv = (-dUV2.x() * dP1 + dUV1.x() * dP2) * invDet;
+				}
+
+				float angle = fast_acos(dP1.dot(dP2) / std::sqrt(dP1.squaredNorm() * dP2.squaredNorm()));
+				if (angleWeight) {
+					CU.col(3 * f + i) = dpdu * angle;
+					CV.col(3 * f + i) = dpdv * angle;
+				}
+				else {
+					CU.col(3 * f + i) = dpdu;
+					CV.col(3 * f + i) = dpdv;
+				}
 			}
-			else {
-				float invDet = 1.0f / determinant;
-				dpdu = ( dUV2.y() * dP1 - dUV1.y() * dP2) * invDet;
-				dpdv = (-dUV2.x() * dP1 + dUV1.x() * dP2) * invDet;
+		}
+	});
+
+	/* Gather per vertex in ascending corner order (= serial summation order, independent of the thread count) */
+	uint32_t vertexCount = V.cols();
+	std::vector<uint32_t> offsets, corners;
+	buildVertexCornerTable(F, vertexCount, offsets, corners);
+	DPDU.resize(V.rows(), V.cols());
+	DPDV.resize(V.rows(), V.cols());
+	std::atomic<uint32_t> unhandled(0);
+
+	parallel_for(0u, vertexCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		uint32_t localUnhandled = 0;
+		for (uint32_t v = begin; v < end; ++v) {
+			DPDU.col(v).setZero();
+			DPDV.col(v).setZero();
+			for (uint32_t k = offsets[v]; k < offsets[v + 1]; ++k) {
+				DPDU.col(v) += CU.col(corners[k]);
+				DPDV.col(v) += CV.col(corners[k]);
 			}
 
-			float angle = fast_acos(dP1.dot(dP2) / std::sqrt(dP1.squaredNorm() * dP2.squaredNorm()));
-			if (angleWeight) {
-				DPDU.col(F(i, f)) += dpdu * angle;
-				DPDV.col(F(i, f)) += dpdv * angle;
+			float norm = DPDU.col(v).norm();
+			if (norm < RCPOVERFLOW_FLT) {
+				// ...
+				localUnhandled++;
 			}
 			else {
-				DPDU.col(F(i, f)) += dpdu;
-				DPDV.col(F(i, f)) += dpdv;
+				DPDU.col(v) /= norm;
 			}
-		}
-	}
 
-	uint32_t vertexCount = V.cols();
-	for (uint32_t v = 0; v < vertexCount; ++v) {
-		float norm = DPDU.col(v).norm();
-		if (norm < RCPOVERFLOW_FLT) {
-			// ...
-			std::cout << "unhandle case in computing tangent." << std::endl;
-		}
-		else {
-			DPDU.col(v) /= norm;
+			norm = DPDV.col(v).norm();
+			if (norm < RCPOVERFLOW_FLT) {
+				localUnhandled++;
+			}
+			else {
+				DPDV.col(v) /= norm;
+			}
 		}
+		unhandled += localUnhandled;
+	});
 
-		norm = DPDV.col(v).norm();
-		if (norm < RCPOVERFLOW_FLT) {
-			std::cout << "unhandle case in computing tangent." << std::endl;
-		}
-		else {
-			DPDV.col(v) /= norm;
-		}
-	}
+	if (unhandled > 0)
+		std::cout << "unhandle case in computing tangent. (" << unhandled << " degenerate tangents)" << std::endl;
 	std::cout << "++Computing tangent spaces done." << std::endl;
 }
 
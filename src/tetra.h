@@ -5,6 +5,17 @@
 
 using nanogui::MatrixXu;
 using nanogui::MatrixXf;
+using nanogui::Vector3f;
+
+typedef Eigen::Matrix<uint32_t, 4, 1> Vector4u;
+
+/* Tags of TN() entries without a neighbouring tetrahedron, see computeTetrahedronNeighbors() */
+#define TETRAHEDRON_BASE_SURFACE 0xFFFFFFFCu		// face on the base surface
+#define TETRAHEDRON_OFFSET_SURFACE 0xFFFFFFFDu	// face on the offset surface
+#define TETRAHEDRON_BOUNDARY 0xFFFFFFFEu			// side face over a boundary edge of the base mesh
+#define TETRAHEDRON_DEGENERATE 0xFFFFFFFFu		// all faces of a degenerate tetrahedron (invalid split pattern)
+
+inline bool isTetrahedronNeighbor(uint32_t entry) { return entry < TETRAHEDRON_BASE_SURFACE; }
 
 class TetrahedronMesh {
 public:
@@ -14,6 +25,8 @@ public:
 		mVtxTexcoord.resize(0, 0);
 		mVtxNormal.resize(0, 0);
 		mTetra.resize(0, 0);
+		mTetraNeighbors.resize(0, 0);
+		mTetraOccupancy.resize(0, 0);
 		mVtxTangentDpdu.resize(0, 0);
 		mVtxTangentDpdv.resize(0, 0);
 	}
@@ -24,6 +37,8 @@ public:
 		mVtxTexcoord.resize(0, 0);
 		mVtxNormal.resize(0, 0);
 		mTetra.resize(0, 0);
+		mTetraNeighbors.resize(0, 0);
+		mTetraOccupancy.resize(0, 0);
 		mVtxTangentDpdu.resize(0, 0);
 		mVtxTangentDpdv.resize(0, 0);
 	}
@@ -35,6 +50,21 @@ public:
 		mVtxPosition = std::move(V), mVtxNormal = std::move(N), mVtxTexcoord = std::move(UV);
 		mVtxTangentDpdu = std::move(DPDU), mVtxTangentDpdv = std::move(DPDV);
 		mTetra = std::move(T);
+		mTetraNeighbors.resize(0, 0);
+		mTetraOccupancy.resize(0, 0);
+	}
+
+	/* Allocate all buffers for in-place construction, the contents are undefined. The optional neighbour table and
+	   occupancy bits are cleared. */
+	void resize(uint32_t vertexCount, uint32_t tetrahedronCount) {
+		mVertexCount = vertexCount;
+		mTetrahedronCount = tetrahedronCount;
+
+		mVtxPosition.resize(3, vertexCount), mVtxNormal.resize(3, vertexCount), mVtxTexcoord.resize(3, vertexCount);
+		mVtxTangentDpdu.resize(3, vertexCount), mVtxTangentDpdv.resize(3, vertexCount);
+		mTetra.resize(4, tetrahedronCount);
+		mTetraNeighbors.resize(0, 0);
+		mTetraOccupancy.resize(0, 0);
 	}
 
 	inline uint32_t getVertexCount() const { return mVertexCount; }
@@ -48,9 +78,45 @@ public:
 
 	inline const MatrixXu& T() const { return mTetra; }
 
+	/* 4 x T, TN(k, t) is the tetrahedron sharing the face opposite of vertex T(k, t), or a TETRAHEDRON_* tag.
+	   Empty unless computed by computeTetrahedronNeighbors(). */
+	inline const MatrixXu& TN() const { return mTetraNeighbors; }
+	inline bool hasNeighbors() const { return mTetraNeighbors.cols() == mTetra.cols() && mTetra.cols() > 0; }
+
+	/* 1 x ceil(T / 8), bit t % 8 of byte t / 8 is set if tetrahedron t overlaps the shell content.
+	   Empty unless the shell was made sparse by applyShellOccupancy(). Only box masks tell the tetrahedra
+	   of a prism apart, a bitmap mask sets the bits of all kept tetrahedra. */
+	inline const MatrixXu8& O() const { return mTetraOccupancy; }
+	inline bool hasOccupancy() const { return mTetraOccupancy.size() == (mTetra.cols() + 7) / 8 && mTetra.cols() > 0; }
+	inline bool isOccupied(uint32_t t) const { return (mTetraOccupancy(0, t / 8) >> (t % 8)) & 1; }
+
+	inline MatrixXf& V() { return mVtxPosition; }
+	inline MatrixXf& UV() { return mVtxTexcoord; }
+	inline MatrixXf& N() { return mVtxNormal; }
+	inline MatrixXf& DPDU() { return mVtxTangentDpdu; }
+	inline MatrixXf& DPDV() { return mVtxTangentDpdv; }
+	inline MatrixXu& T() { return mTetra; }
+	inline MatrixXu& TN() { return mTetraNeighbors; }
+	inline MatrixXu8& O() { return mTetraOccupancy; }
+
+	/* Per element accessors, also provided by ImplicitShell */
+	inline Vector3f position(uint32_t v) const { return mVtxPosition.col(v); }
+	inline Vector3f texcoord(uint32_t v) const { return mVtxTexcoord.col(v); }
+	inline Vector3f normal(uint32_t v) const { return mVtxNormal.col(v); }
+	inline Vector3f dpdu(uint32_t v) const { return mVtxTangentDpdu.col(v); }
+	inline Vector3f dpdv(uint32_t v) const { return mVtxTangentDpdv.col(v); }
+	inline Vector4u tetrahedron(uint32_t t) const { return mTetra.col(t); }
+
+	/* Bytes used by the vertex and tetrahedron arrays */
+	inline size_t memoryUsage() const {
+		return sizeof(float) * (size_t)(mVtxPosition.size() + mVtxTexcoord.size() + mVtxNormal.size() +
+			mVtxTangentDpdu.size() + mVtxTangentDpdv.size()) + sizeof(uint32_t) * (size_t)(mTetra.size() + mTetraNeighbors.size()) + (size_t)mTetraOccupancy.size();
+	}
+
 protected:
 	uint32_t mVertexCount, mTetrahedronCount;
 	MatrixXf mVtxPosition, mVtxTexcoord, mVtxNormal;
 	MatrixXf mVtxTangentDpdu, mVtxTangentDpdv;
-	MatrixXu mTetra;
+	MatrixXu mTetra, mTetraNeighbors;
+	MatrixXu8 mTetraOccupancy;
 };
\ No newline at end of file
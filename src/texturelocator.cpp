@@ -0,0 +1,206 @@
+#include "texturelocator.h"
+#include "parallel.h"
+
+#include <atomic>
+
+/* Upper bound on the grid resolution per axis */
+#define TEXTURE_GRID_MAX_RESOLUTION 16384
+
+void TexturePointLocator::build(const MatrixXu &F, const TetrahedronMesh &shell, float cellsPerFace) {
+	uint32_t faceCount = (uint32_t)F.cols();
+	if (shell.getTetrahedronCount() != 3 * faceCount)
+		throw std::runtime_error("TexturePointLocator::build(): the shell does not have three tetrahedra per face!");
+	if (faceCount > 0 && F.maxCoeff() >= shell.getVertexCount())
+		throw std::runtime_error("TexturePointLocator::build(): invalid vertex index in F!");
+
+	mShell = &shell;
+	mF = F;
+	const MatrixXf &UV = shell.UV();
+
+	/* UV bounds of the faces */
+	uint32_t blockCount = (faceCount + GRAIN_SIZE - 1) / GRAIN_SIZE;
+	std::vector<Vector2f> blockMin(blockCount), blockMax(blockCount);
+	parallel_for(0u, faceCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		Vector2f lower = Vector2f::Constant(std::numeric_limits<float>::infinity()), upper = -lower;
+		for (uint32_t f = begin; f < end; ++f) {
+			for (int i = 0; i < 3; ++i) {
+				Vector2f uv = UV.col(F(i, f)).head<2>();
+				lower = lower.cwiseMin(uv);
+				upper = upper.cwiseMax(uv);
+			}
+		}
+		blockMin[begin / GRAIN_SIZE] = lower;
+		blockMax[begin / GRAIN_SIZE] = upper;
+	});
+	Vector2f lower = Vector2f::Zero(), upper = Vector2f::Zero();
+	for (uint32_t block = 0; block < blockCount; ++block) {
+		lower = block == 0 ? blockMin[0] : lower.cwiseMin(blockMin[block]);
+		upper = block == 0 ? blockMax[0] : upper.cwiseMax(blockMax[block]);
+	}
+
+	/* Square cells, about cellsPerFace per face */
+	Vector2f extent = upper - lower;
+	float area = std::max(extent.x(), 1e-20f) * std::max(extent.y(), 1e-20f);
+	float cellSize = std::sqrt(area / std::max(1.0f, cellsPerFace * faceCount));
+	mOrigin = lower;
+	for (int i = 0; i < 2; ++i) {
+		mResolution[i] = extent[i] > 0.0f ? (uint32_t)std::min<float>(std::ceil(extent[i] / cellSize), TEXTURE_GRID_MAX_RESOLUTION) : 1u;
+		mResolution[i] = std::max(mResolution[i], 1u);
+		mInvCellSize[i] = extent[i] > 0.0f ? mResolution[i] / extent[i] : 0.0f;
+	}
+	uint32_t cellCount = getCellCount();
+
+	/* Cell range covered by the UV bounding box of each face */
+	auto cellRange = [&](uint32_t f, uint32_t range[4]) {
+		Vector2f faceMin = UV.col(F(0, f)).head<2>(), faceMax = faceMin;
+		for (int i = 1; i < 3; ++i) {
+			faceMin = faceMin.cwiseMin(UV.col(F(i, f)).head<2>());
+			faceMax = faceMax.cwiseMax(UV.col(F(i, f)).head<2>());
+		}
+		for (int i = 0; i < 2; ++i) {
+			range[i] = std::min((uint32_t)std::max(0.0f, (faceMin[i] - mOrigin[i]) * mInvCellSize[i]), mResolution[i] - 1);
+			range[2 + i] = std::min((uint32_t)std::max(0.0f, (faceMax[i] - mOrigin[i]) * mInvCellSize[i]), mResolution[i] - 1);
+		}
+	};
+
+	/* Counting sort of the (cell, face) pairs */
+	std::vector<std::atomic<uint32_t>> cursors(cellCount);
+	for (uint32_t c = 0; c < cellCount; ++c)
+		cursors[c].store(0, std::memory_order_relaxed);
+	parallel_for(0u, faceCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		uint32_t range[4];
+		for (uint32_t f = begin; f < end; ++f) {
+			cellRange(f, range);
+			for (uint32_t y = range[1]; y <= range[3]; ++y)
+				for (uint32_t x = range[0]; x <= range[2]; ++x)
+					cursors[y * mResolution[0] + x].fetch_add(1, std::memory_order_relaxed);
+		}
+	});
+	mCellOffsets.resize(cellCount + 1);
+	mCellOffsets[0] = 0;
+	for (uint32_t c = 0; c < cellCount; ++c) {
+		mCellOffsets[c + 1] = mCellOffsets[c] + cursors[c].load(std::memory_order_relaxed);
+		cursors[c].store(mCellOffsets[c], std::memory_order_relaxed);
+	}
+	mCellFaces.resize(mCellOffsets[cellCount]);
+	parallel_for(0u, faceCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		uint32_t range[4];
+		for (uint32_t f = begin; f < end; ++f) {
+			cellRange(f, range);
+			for (uint32_t y = range[1]; y <= range[3]; ++y)
+				for (uint32_t x = range[0]; x <= range[2]; ++x)
+					mCellFaces[cursors[y * mResolution[0] + x].fetch_add(1, std::memory_order_relaxed)] = f;
+		}
+	});
+
+	/* Face order within a cell depends on the thread schedule, sort for reproducible hit order */
+	parallel_for(0u, cellCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t c = begin; c < end; ++c)
+			std::sort(mCellFaces.begin() + mCellOffsets[c], mCellFaces.begin() + mCellOffsets[c + 1]);
+	});
+}
+
+bool TexturePointLocator::faceBarycentric(uint32_t f, const Vector2f &uv, Vector3f &barycentric) const {
+	const MatrixXf &UV = mShell->UV();
+	Vector2f a = UV.col(mF(0, f)).head<2>(), b = UV.col(mF(1, f)).head<2>(), c = UV.col(mF(2, f)).head<2>();
+	Vector2f ab = b - a, ac = c - a, ap = uv - a;
+	float det = ab.x() * ac.y() - ab.y() * ac.x();
+	if (det == 0.0f)
+		return false;
+	float invDet = 1.0f / det;
+	barycentric[1] = (ap.x() * ac.y() - ap.y() * ac.x()) * invDet;
+	barycentric[2] = (ab.x() * ap.y() - ab.y() * ap.x()) * invDet;
+	barycentric[0] = 1.0f - barycentric[1] - barycentric[2];
+	return barycentric.minCoeff() >= -TEXTURE_POINT_EPSILON;
+}
+
+uint32_t TexturePointLocator::locate(const Vector3f &uvw, std::vector<TexturePoint> &hits) const {
+	size_t first = hits.size();
+	if (mF.cols() == 0 || !(uvw.z() >= -TEXTURE_POINT_EPSILON && uvw.z() <= 1.0f + TEXTURE_POINT_EPSILON))
+		return 0;
+
+	uint32_t cell[2];
+	for (int i = 0; i < 2; ++i) {
+		float x = (uvw[i] - mOrigin[i]) * mInvCellSize[i];
+		if (!(x >= -TEXTURE_POINT_EPSILON * mInvCellSize[i] && x <= mResolution[i] + TEXTURE_POINT_EPSILON * mInvCellSize[i]))
+			return 0;
+		cell[i] = std::min((uint32_t)std::max(0.0f, x), mResolution[i] - 1);
+	}
+
+	const MatrixXu &T = mShell->T();
+	const MatrixXf &V = mShell->V(), &UV = mShell->UV();
+	uint32_t c = cell[1] * mResolution[0] + cell[0];
+	Vector3f faceWeights;
+	for (uint32_t k = mCellOffsets[c]; k < mCellOffsets[c + 1]; ++k) {
+		uint32_t f = mCellFaces[k];
+		if (!faceBarycentric(f, uvw.head<2>(), faceWeights))
+			continue;
+
+		/* The tetrahedron of the prism which contains uvw best */
+		TexturePoint hit;
+		float best = -std::numeric_limits<float>::infinity();
+		for (uint32_t t = 3 * f; t < 3 * f + 3; ++t) {
+			Vector3f d = UV.col(T(3, t));
+			Eigen::Matrix3f E;
+			for (int i = 0; i < 3; ++i)
+				E.col(i) = UV.col(T(i, t)) - d;
+			float det = E.determinant();
+			if (!(std::abs(det) > 0.0f))
+				continue;
+			Vector3f lambda = E.inverse() * (uvw - d);
+			Vector4f barycentric(lambda[0], lambda[1], lambda[2], 1.0f - lambda.sum());
+			if (barycentric.minCoeff() > best) {
+				best = barycentric.minCoeff();
+				hit.tetrahedron = t;
+				hit.barycentric = barycentric;
+			}
+		}
+		if (!(best >= -TEXTURE_POINT_EPSILON))
+			continue;
+
+		hit.face = f;
+		hit.position.setZero();
+		for (int i = 0; i < 4; ++i)
+			hit.position += hit.barycentric[i] * V.col(T(i, hit.tetrahedron));
+
+		/* Neighbours in the same chart map a point on their shared edge to the same position */
+		bool duplicate = false;
+		for (size_t i = first; i < hits.size() && !duplicate; ++i)
+			duplicate = (hits[i].position - hit.position).squaredNorm() <= 1e-12f * std::max(1.0f, hit.position.squaredNorm());
+		if (!duplicate)
+			hits.push_back(hit);
+	}
+	return (uint32_t)(hits.size() - first);
+}
+
+void TexturePointLocator::locate(const MatrixXf &uvw, std::vector<uint32_t> &offsets, std::vector<TexturePoint> &hits) const {
+	uint32_t pointCount = (uint32_t)uvw.cols();
+	uint32_t blockCount = (pointCount + GRAIN_SIZE - 1) / GRAIN_SIZE;
+	std::vector<std::vector<TexturePoint>> blockHits(blockCount);
+	offsets.resize(pointCount + 1);
+	offsets[0] = 0;
+
+	parallel_for(0u, pointCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		std::vector<TexturePoint> &local = blockHits[begin / GRAIN_SIZE];
+		for (uint32_t i = begin; i < end; ++i)
+			offsets[i + 1] = locate(uvw.col(i), local);
+	});
+
+	std::vector<size_t> blockOffsets(blockCount + 1, 0);
+	for (uint32_t block = 0; block < blockCount; ++block)
+		blockOffsets[block + 1] = blockOffsets[block] + blockHits[block].size();
+	for (uint32_t i = 0; i < pointCount; ++i)
+		offsets[i + 1] += offsets[i];
+
+	hits.resize(blockOffsets[blockCount]);
+	parallel_for(0u, blockCount, 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t block = begin; block < end; ++block) {
+			std::copy(blockHits[block].begin(), blockHits[block].end(), hits.begin() + blockOffsets[block]);
+			std::vector<TexturePoint>().swap(blockHits[block]);
+		}
+	});
+}
+
+size_t TexturePointLocator::memoryUsage() const {
+	return sizeof(uint32_t) * ((size_t)mF.size() + mCellOffsets.size() + mCellFaces.size());
+}
@@ -0,0 +1,65 @@
+/*
+	texturelocator.h: Mapping of texture space points (u, v, w) back into the shell
+
+	In texture space the prism over base face f is its UV triangle extruded to w in [0, 1], split into
+	the tetrahedra 3f, 3f + 1, 3f + 2 by the split patterns (numbering of constructTetrahedronMeshSimple()).
+	A point (u, v, w) is located by finding the UV triangles containing (u, v) through a uniform 2D
+	grid, then the tetrahedron of the prism containing (u, v, w). Its barycentric coordinates interpolate
+	the world positions of the tetrahedron's vertices.
+
+	UV charts may overlap (mirrored or repeated UVs), so a point can map to several places: all of them
+	are returned. Hits on an edge shared by two UV triangles map to the same world position and are
+	reported once.
+*/
+
+#pragma once
+
+#include "mycommon.h"
+#include "tetra.h"
+
+using nanogui::MatrixXu;
+using nanogui::MatrixXf;
+using nanogui::Vector2f;
+using nanogui::Vector3f;
+using Eigen::Vector4f;
+
+/* Points within this barycentric distance of a UV triangle resp. tetrahedron count as inside */
+#define TEXTURE_POINT_EPSILON 1e-5f
+
+struct TexturePoint {
+	uint32_t face;			// base face whose UV triangle contains (u, v)
+	uint32_t tetrahedron;	// tetrahedron of the prism over 'face' containing (u, v, w)
+	Vector4f barycentric;	// weights of the vertices T.col(tetrahedron)
+	Vector3f position;		// world space position
+};
+
+class TexturePointLocator {
+public:
+	TexturePointLocator() : mShell(nullptr) { }
+
+	/* Build the grid over the UV triangles of the base faces F of the shell; the shell is referenced, it has to
+	   outlive the locator. cellsPerFace sets the grid resolution relative to the face count. */
+	void build(const MatrixXu &F, const TetrahedronMesh &shell, float cellsPerFace = 1.0f);
+
+	/* Append all mappings of uvw to hits, returns their number */
+	uint32_t locate(const Vector3f &uvw, std::vector<TexturePoint> &hits) const;
+
+	/* Map the points (3 x N) in parallel, the hits of uvw.col(i) are hits[offsets[i]] .. hits[offsets[i + 1] - 1] */
+	void locate(const MatrixXf &uvw, std::vector<uint32_t> &offsets, std::vector<TexturePoint> &hits) const;
+
+	inline uint32_t getCellCount() const { return mResolution[0] * mResolution[1]; }
+
+	/* Bytes used by the grid */
+	size_t memoryUsage() const;
+
+private:
+	/* 2D barycentric coordinates of uv in face f, false if uv is outside or the UV triangle is degenerate */
+	bool faceBarycentric(uint32_t f, const Vector2f &uv, Vector3f &barycentric) const;
+
+	const TetrahedronMesh *mShell;
+	MatrixXu mF;
+	Vector2f mOrigin, mInvCellSize;
+	uint32_t mResolution[2];
+	std::vector<uint32_t> mCellOffsets;		// faces of cell c: mCellFaces[mCellOffsets[c] .. mCellOffsets[c + 1] - 1]
+	std::vector<uint32_t> mCellFaces;
+};
@@ -130,6 +130,30 @@ bool LoadObj(std::vector<shape_t> &shapes,       // [output]
 void LoadMtl(std::map<std::string, int> &material_map, // [output]
              std::vector<material_t> &materials,       // [output]
              std::istream &inStream);
+
+/// Caller-provided storage for the triangle mesh of LoadObj(MeshStorage &, ...)
+/// Indices are 3 per triangle, positions 3 and texcoords 2 floats per vertex.
+class MeshStorage {
+public:
+  MeshStorage() {}
+  virtual ~MeshStorage();
+
+  /// Called first, with the number of triangles of all shapes
+  virtual unsigned int *allocateIndices(size_t triangles) = 0;
+  /// Called once the indices are written. 'texcoords' is only allocated if
+  /// every vertex has a texcoord.
+  virtual void allocateVertices(size_t vertices, bool has_texcoords,
+                                float *&positions, float *&texcoords) = 0;
+};
+
+/// Loads the triangles of all shapes of an .obj file, in shape order, straight
+/// into 'storage', without building shape_t vectors. Vertices are shared within
+/// a shape exactly as by LoadObj() above, normals and materials are not read.
+/// 'num_shapes' is the number of shapes LoadObj() above would return.
+bool LoadObj(MeshStorage &storage,  // [output]
+             size_t &num_shapes,    // [output]
+             std::string &err,      // [output]
+             const char *filename);
 }
 
 #ifdef TINYOBJLOADER_IMPLEMENTATION
@@ -161,18 +185,84 @@ struct vertex_index {
   vertex_index(int vidx, int vtidx, int vnidx)
       : v_idx(vidx), vt_idx(vtidx), vn_idx(vnidx){}
 };
-// for std::map
-static inline bool operator<(const vertex_index &a, const vertex_index &b) {
-  if (a.v_idx != b.v_idx)
-    return (a.v_idx < b.v_idx);
-  if (a.vn_idx != b.vn_idx)
-    return (a.vn_idx < b.vn_idx);
-  if (a.vt_idx != b.vt_idx)
-    return (a.vt_idx < b.vt_idx);
-
-  return false;
+static inline bool operator==(const vertex_index &a, const vertex_index &b) {
+  return a.v_idx == b.v_idx && a.vt_idx == b.vt_idx && a.vn_idx == b.vn_idx;
 }
 
+// Open addressing (linear probing) hash table from vertex_index to the vertex
+// id in the current shape. clear() only bumps a generation counter, slots of
+// older generations count as empty, so flushing a face group is O(1).
+class VertexCache {
+public:
+  VertexCache() : count_(0), generation_(1) {}
+
+  // Insert key with 'value' and return true, or set 'value' to the id
+  // already stored for key and return false.
+  bool insert(const vertex_index &key, unsigned int &value) {
+    if (2 * (count_ + 1) > slots_.size())
+      grow();
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+      slot_t &slot = slots_[i];
+      if (slot.generation != generation_) {
+        slot.key = key;
+        slot.value = value;
+        slot.generation = generation_;
+        ++count_;
+        return true;
+      }
+      if (slot.key == key) {
+        value = slot.value;
+        return false;
+      }
+    }
+  }
+
+  void clear() {
+    count_ = 0;
+    if (++generation_ == 0) {
+      for (size_t i = 0; i < slots_.size(); i++)
+        slots_[i].generation = 0;
+      generation_ = 1;
+    }
+  }
+
+private:
+  struct slot_t {
+    vertex_index key;
+    unsigned int value;
+    unsigned int generation; // 0: never used
+    slot_t() : value(0), generation(0) {}
+  };
+
+  static size_t hash(const vertex_index &key) {
+    unsigned long long h = static_cast<unsigned int>(key.v_idx);
+    h = h * 0x9E3779B97F4A7C15ull + static_cast<unsigned int>(key.vt_idx);
+    h = h * 0x9E3779B97F4A7C15ull + static_cast<unsigned int>(key.vn_idx);
+    h *= 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(h ^ (h >> 32));
+  }
+
+  void grow() {
+    std::vector<slot_t> old;
+    old.swap(slots_);
+    slots_.resize(old.empty() ? 64 : 2 * old.size());
+    size_t mask = slots_.size() - 1;
+    for (size_t j = 0; j < old.size(); j++) {
+      if (old[j].generation != generation_)
+        continue;
+      size_t i = hash(old[j].key) & mask;
+      while (slots_[i].generation == generation_)
+        i = (i + 1) & mask;
+      slots_[i] = old[j];
+    }
+  }
+
+  std::vector<slot_t> slots_;
+  size_t count_;
+  unsigned int generation_;
+};
+
 struct obj_shape {
   std::vector<float> v;
   std::vector<float> vn;
@@ -414,17 +504,16 @@ static vertex_index parseTriple(const char *&token, int vsize, int vnsize,
 }
 
 static unsigned int
-updateVertex(std::map<vertex_index, unsigned int> &vertexCache,
+updateVertex(VertexCache &vertexCache,
              std::vector<float> &positions, std::vector<float> &normals,
              std::vector<float> &texcoords,
              const std::vector<float> &in_positions,
              const std::vector<float> &in_normals,
              const std::vector<float> &in_texcoords, const vertex_index &i) {
-  const std::map<vertex_index, unsigned int>::iterator it = vertexCache.find(i);
-
-  if (it != vertexCache.end()) {
+  unsigned int idx = static_cast<unsigned int>(positions.size() / 3);
+  if (!vertexCache.insert(i, idx)) {
     // found cache
-    return it->second;
+    return idx;
   }
 
   assert(in_positions.size() > static_cast<unsigned int>(3 * i.v_idx + 2));
@@ -444,9 +533,6 @@ updateVertex(std::map<vertex_index, unsigned int> &vertexCache,
     texcoords.push_back(in_texcoords[2 * static_cast<size_t>(i.vt_idx) + 1]);
   }
 
-  unsigned int idx = static_cast<unsigned int>(positions.size() / 3 - 1);
-  vertexCache[i] = idx;
-
   return idx;
 }
 
@@ -474,7 +560,7 @@ static void InitMaterial(material_t &material) {
 }
 
 static bool exportFaceGroupToShape(
-    shape_t &shape, std::map<vertex_index, unsigned int> vertexCache,
+    shape_t &shape, VertexCache &vertexCache,
     const std::vector<float> &in_positions,
     const std::vector<float> &in_normals,
     const std::vector<float> &in_texcoords,
@@ -525,6 +611,18 @@ static bool exportFaceGroupToShape(
   return true;
 }
 
+// Hand the shape over to 'shapes' without copying its mesh, 'shape' is left
+// empty.
+static void appendShape(std::vector<shape_t> &shapes, shape_t &shape) {
+  shapes.push_back(shape_t());
+  shapes.back().name.swap(shape.name);
+  shapes.back().mesh.positions.swap(shape.mesh.positions);
+  shapes.back().mesh.normals.swap(shape.mesh.normals);
+  shapes.back().mesh.texcoords.swap(shape.mesh.texcoords);
+  shapes.back().mesh.indices.swap(shape.mesh.indices);
+  shapes.back().mesh.material_ids.swap(shape.mesh.material_ids);
+}
+
 void LoadMtl(std::map<std::string, int> &material_map,
              std::vector<material_t> &materials,
              std::istream &inStream) {
@@ -815,7 +913,7 @@ bool LoadObj(std::vector<shape_t> &shapes, // [output]
 
   // material
   std::map<std::string, int> material_map;
-  std::map<vertex_index, unsigned int> vertexCache;
+  VertexCache vertexCache;
   int material = -1;
 
   shape_t shape;
@@ -919,7 +1017,7 @@ bool LoadObj(std::vector<shape_t> &shapes, // [output]
       bool ret = exportFaceGroupToShape(shape, vertexCache, v, vn, vt,
                                         faceGroup, material, name, true);
       if (ret) {
-          shapes.push_back(shape);
+        appendShape(shapes, shape);
       }
       shape = shape_t();
       faceGroup.clear();
@@ -963,7 +1061,7 @@ bool LoadObj(std::vector<shape_t> &shapes, // [output]
       bool ret = exportFaceGroupToShape(shape, vertexCache, v, vn, vt,
                                         faceGroup, material, name, true);
       if (ret) {
-        shapes.push_back(shape);
+        appendShape(shapes, shape);
       }
 
       shape = shape_t();
@@ -997,7 +1095,7 @@ bool LoadObj(std::vector<shape_t> &shapes, // [output]
       bool ret = exportFaceGroupToShape(shape, vertexCache, v, vn, vt,
                                         faceGroup, material, name, true);
       if (ret) {
-        shapes.push_back(shape);
+        appendShape(shapes, shape);
       }
 
       // material = -1;
@@ -1023,7 +1121,7 @@ bool LoadObj(std::vector<shape_t> &shapes, // [output]
   bool ret = exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup,
                                     material, name, true);
   if (ret) {
-    shapes.push_back(shape);
+    appendShape(shapes, shape);
   }
   faceGroup.clear(); // for safety
 
@@ -1031,6 +1129,137 @@ bool LoadObj(std::vector<shape_t> &shapes, // [output]
   return true;
 }
 
+MeshStorage::~MeshStorage() {}
+
+bool LoadObj(MeshStorage &storage, size_t &num_shapes, std::string &err,
+             const char *filename) {
+  num_shapes = 0;
+
+  std::ifstream ifs(filename);
+  if (!ifs) {
+    err += std::string("Cannot open file [") + filename + "]\n";
+    return false;
+  }
+
+  // All faces of the file, flat: corners, first corner of each face, first
+  // face of each face group (a shape of LoadObj() above)
+  std::vector<float> v;
+  std::vector<float> vt;
+  int vn_count = 0;
+  std::vector<vertex_index> corners;
+  std::vector<size_t> faces;
+  std::vector<size_t> groups;
+
+  int maxchars = 8192;             // Alloc enough size.
+  std::vector<char> buf(static_cast<size_t>(maxchars)); // Alloc enough size.
+  while (ifs.peek() != -1) {
+    ifs.getline(&buf[0], maxchars);
+
+    // Skip leading space. Trailing '\r' is skipped by parseTriple()
+    const char *token = &buf[0];
+    token += strspn(token, " \t");
+
+    if (token[0] == 'v' && isSpace((token[1]))) {
+      token += 2;
+      float x, y, z;
+      parseFloat3(x, y, z, token);
+      v.push_back(x);
+      v.push_back(y);
+      v.push_back(z);
+    } else if (token[0] == 'v' && token[1] == 'n' && isSpace((token[2]))) {
+      vn_count++;
+    } else if (token[0] == 'v' && token[1] == 't' && isSpace((token[2]))) {
+      token += 3;
+      float x, y;
+      parseFloat2(x, y, token);
+      vt.push_back(x);
+      vt.push_back(y);
+    } else if (token[0] == 'f' && isSpace((token[1]))) {
+      token += 2;
+      token += strspn(token, " \t");
+      if (groups.empty())
+        groups.push_back(0);
+      faces.push_back(corners.size());
+      while (!isNewLine(token[0])) {
+        corners.push_back(parseTriple(token, static_cast<int>(v.size() / 3),
+                                      vn_count,
+                                      static_cast<int>(vt.size() / 2)));
+        token += strspn(token, " \t\r");
+      }
+    } else if (((0 == strncmp(token, "usemtl", 6)) && isSpace((token[6]))) ||
+               ((token[0] == 'g' || token[0] == 'o') && isSpace((token[1])))) {
+      // Flush the face group as LoadObj() above does
+      if (!groups.empty() && groups.back() != faces.size())
+        groups.push_back(faces.size());
+    }
+  }
+  if (groups.empty() || groups.back() != faces.size())
+    groups.push_back(faces.size());
+  faces.push_back(corners.size());
+  num_shapes = groups.size() - 1;
+
+  // Polygon -> triangle fan conversion
+  size_t triangles = 0;
+  bool has_texcoords = true, any_texcoords = false;
+  for (size_t f = 0; f + 1 < faces.size(); f++) {
+    if (faces[f + 1] - faces[f] < 3)
+      continue; // no triangle, its corners make no vertices
+    triangles += faces[f + 1] - faces[f] - 2;
+    for (size_t c = faces[f]; c < faces[f + 1]; c++) {
+      has_texcoords &= corners[c].vt_idx >= 0;
+      any_texcoords |= corners[c].vt_idx >= 0;
+    }
+  }
+  if (any_texcoords && !has_texcoords)
+    err += std::string("not every vertex has texcoords, ignore texcoords of <") + filename + ">.\n";
+
+  // Shared vertices get their ids in order of first use, the cache is cleared
+  // for every shape
+  unsigned int *indices = storage.allocateIndices(triangles);
+  VertexCache vertexCache;
+  size_t vertices = 0;
+  for (size_t g = 0; g + 1 < groups.size(); g++) {
+    vertexCache.clear();
+    for (size_t f = groups[g]; f < groups[g + 1]; f++) {
+      const vertex_index *face = &corners[faces[f]];
+      for (size_t k = 2; k < faces[f + 1] - faces[f]; k++) {
+        const vertex_index *fan[3] = { &face[0], &face[k - 1], &face[k] };
+        for (int i = 0; i < 3; i++) {
+          unsigned int idx = static_cast<unsigned int>(vertices);
+          if (vertexCache.insert(*fan[i], idx)) {
+            if (++vertices > 0xFFFFFFFFull) {
+              err += std::string("Too many vertices in [") + filename + "]\n";
+              return false;
+            }
+          }
+          *indices++ = idx;
+        }
+      }
+    }
+  }
+
+  // Every vertex is written by each of its corners, with the same values
+  float *positions = NULL, *texcoords = NULL;
+  storage.allocateVertices(vertices, has_texcoords, positions, texcoords);
+  indices -= 3 * triangles;
+  for (size_t f = 0; f + 1 < faces.size(); f++) {
+    const vertex_index *face = &corners[faces[f]];
+    for (size_t k = 2; k < faces[f + 1] - faces[f]; k++) {
+      const vertex_index *fan[3] = { &face[0], &face[k - 1], &face[k] };
+      for (int i = 0; i < 3; i++) {
+        size_t idx = *indices++;
+        assert(v.size() > static_cast<unsigned int>(3 * fan[i]->v_idx + 2));
+        for (int c = 0; c < 3; c++)
+          positions[3 * idx + c] = v[3 * static_cast<size_t>(fan[i]->v_idx) + c];
+        if (has_texcoords)
+          for (int c = 0; c < 2; c++)
+            texcoords[2 * idx + c] = vt[2 * static_cast<size_t>(fan[i]->vt_idx) + c];
+      }
+    }
+  }
+  return true;
+}
+
 } // namespace
 
 
@@ -0,0 +1,160 @@
+#include "trianglebvh.h"
+#include "parallel.h"
+
+/* Closest point to p on the triangle (a, b, c) and its barycentric coordinates (Ericson, Real-Time Collision Detection 5.1.5) */
+static Vector3f closestPointOnTriangle(const Vector3f &p, const Vector3f &a, const Vector3f &b, const Vector3f &c, Vector3f &barycentric) {
+	Vector3f ab = b - a, ac = c - a, ap = p - a;
+	float d1 = ab.dot(ap), d2 = ac.dot(ap);
+	if (d1 <= 0.0f && d2 <= 0.0f) {
+		barycentric = Vector3f(1.0f, 0.0f, 0.0f);
+		return a;
+	}
+	Vector3f bp = p - b;
+	float d3 = ab.dot(bp), d4 = ac.dot(bp);
+	if (d3 >= 0.0f && d4 <= d3) {
+		barycentric = Vector3f(0.0f, 1.0f, 0.0f);
+		return b;
+	}
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		float v = d1 / (d1 - d3);
+		barycentric = Vector3f(1.0f - v, v, 0.0f);
+		return a + v * ab;
+	}
+	Vector3f cp = p - c;
+	float d5 = ab.dot(cp), d6 = ac.dot(cp);
+	if (d6 >= 0.0f && d5 <= d6) {
+		barycentric = Vector3f(0.0f, 0.0f, 1.0f);
+		return c;
+	}
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		float w = d2 / (d2 - d6);
+		barycentric = Vector3f(1.0f - w, 0.0f, w);
+		return a + w * ac;
+	}
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+		float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		barycentric = Vector3f(0.0f, 1.0f - w, w);
+		return b + w * (c - b);
+	}
+	float denom = 1.0f / (va + vb + vc);
+	float v = vb * denom, w = vc * denom;
+	barycentric = Vector3f(1.0f - v - w, v, w);
+	return a + v * ab + w * ac;
+}
+
+void TriangleBVH::build(const MatrixXu &F, const MatrixXf &V, uint32_t maxLeafSize) {
+	uint32_t faceCount = (uint32_t)F.cols();
+	if (faceCount > 0 && F.maxCoeff() >= V.cols())
+		throw std::runtime_error("TriangleBVH::build(): invalid vertex index in F!");
+
+	std::vector<AABB> bounds(faceCount);
+	parallel_for(0u, faceCount, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t f = begin; f < end; ++f) {
+			bool finite = true;
+			for (int i = 0; i < 3; ++i) {
+				Vector3f p = V.col(F(i, f));
+				finite = finite && std::isfinite(p.sum());
+				bounds[f].expandBy(p);
+			}
+			if (!finite)
+				bounds[f].clear();
+		}
+	});
+	mBVH.build(bounds, maxLeafSize);
+
+	const std::vector<uint32_t> &indices = mBVH.indices();
+	uint32_t count = (uint32_t)indices.size();
+	mTriangles.resize(9, count);
+	parallel_for(0u, count, GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i)
+			for (int j = 0; j < 3; ++j)
+				mTriangles.col(i).segment<3>(3 * j) = V.col(F(j, indices[i]));
+	});
+}
+
+void TriangleBVH::clear() {
+	mBVH.clear();
+	mTriangles.resize(9, 0);
+}
+
+inline bool TriangleBVH::intersectTriangle(uint32_t i, const Ray &ray, float maxt, float &t, float &u, float &v) const {
+	Vector3f a = vertex(i, 0), e1 = vertex(i, 1) - a, e2 = vertex(i, 2) - a;
+	Vector3f pvec = ray.d.cross(e2);
+	float det = e1.dot(pvec);
+	if (det == 0.0f)
+		return false;
+	float invDet = 1.0f / det;
+	Vector3f tvec = ray.o - a;
+	u = tvec.dot(pvec) * invDet;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+	Vector3f qvec = tvec.cross(e1);
+	v = ray.d.dot(qvec) * invDet;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+	t = e2.dot(qvec) * invDet;
+	return t >= ray.mint && t <= maxt;
+}
+
+bool TriangleBVH::rayIntersect(const Ray &ray, TriangleHit &hit) const {
+	const std::vector<uint32_t> &indices = mBVH.indices();
+	bool found = false;
+	float u = 0.0f, v = 0.0f, t;
+	mBVH.traverseRay(ray, ray.maxt, [&](uint32_t begin, uint32_t end, float &maxt) {
+		for (uint32_t i = begin; i < end; ++i) {
+			float tu, tv;
+			if (!intersectTriangle(i, ray, maxt, t, tu, tv))
+				continue;
+			maxt = t;
+			u = tu;
+			v = tv;
+			hit.face = indices[i];
+			hit.t = t;
+			hit.position = (1.0f - u - v) * vertex(i, 0) + u * vertex(i, 1) + v * vertex(i, 2);
+			found = true;
+		}
+		return false;
+	});
+	if (found)
+		hit.barycentric = Vector3f(1.0f - u - v, u, v);
+	return found;
+}
+
+bool TriangleBVH::rayIntersectAny(const Ray &ray) const {
+	return mBVH.traverseRay(ray, ray.maxt, [&](uint32_t begin, uint32_t end, float &maxt) {
+		float t, u, v;
+		for (uint32_t i = begin; i < end; ++i)
+			if (intersectTriangle(i, ray, maxt, t, u, v))
+				return true;
+		return false;
+	});
+}
+
+bool TriangleBVH::closestPoint(const Vector3f &p, TriangleHit &hit, float maxDistance) const {
+	const std::vector<uint32_t> &indices = mBVH.indices();
+	bool found = false;
+	mBVH.traverseNearest(p, maxDistance * maxDistance, [&](uint32_t begin, uint32_t end, float &maxDistance2) {
+		Vector3f barycentric;
+		for (uint32_t i = begin; i < end; ++i) {
+			Vector3f q = closestPointOnTriangle(p, vertex(i, 0), vertex(i, 1), vertex(i, 2), barycentric);
+			float distance2 = (q - p).squaredNorm();
+			if (distance2 > maxDistance2 || (found && distance2 == maxDistance2))
+				continue;
+			maxDistance2 = distance2;
+			hit.face = indices[i];
+			hit.barycentric = barycentric;
+			hit.position = q;
+			found = true;
+		}
+	});
+	if (found)
+		hit.t = (hit.position - p).norm();
+	return found;
+}
+
+size_t TriangleBVH::memoryUsage() const {
+	return mBVH.memoryUsage() + sizeof(float) * (size_t)mTriangles.size();
+}
@@ -0,0 +1,60 @@
+/*
+	trianglebvh.h: Ray and closest point queries against the triangles of a mesh
+
+	A BVH (src/bvh.h) over the faces F of a triangle mesh with vertices V. The vertex positions of
+	the triangles are copied in leaf order, so a query reads the triangles of a leaf from one
+	contiguous block instead of gathering them through F; this costs 36 bytes per face on top of
+	the 32 byte nodes and the index list.
+
+	Queries are const and can run concurrently from any number of threads.
+*/
+
+#pragma once
+
+#include "mycommon.h"
+#include "bvh.h"
+
+using nanogui::MatrixXu;
+using nanogui::MatrixXf;
+using nanogui::Vector3f;
+
+struct TriangleHit {
+	uint32_t face;
+	float t;				// ray distance resp. distance to the query point
+	Vector3f barycentric;	// weights of the vertices F.col(face)
+	Vector3f position;
+};
+
+class TriangleBVH {
+public:
+	TriangleBVH() { }
+
+	/* Build over the faces F (3 x N) of the vertices V (3 x M); faces with non-finite vertices are left out */
+	void build(const MatrixXu &F, const MatrixXf &V, uint32_t maxLeafSize = BVH_LEAF_SIZE);
+	void clear();
+
+	/* Closest intersection of the ray within [ray.mint, ray.maxt] */
+	bool rayIntersect(const Ray &ray, TriangleHit &hit) const;
+
+	/* Whether the ray hits any triangle within [ray.mint, ray.maxt], stops at the first hit found */
+	bool rayIntersectAny(const Ray &ray) const;
+
+	/* Closest point of the mesh to p within maxDistance */
+	bool closestPoint(const Vector3f &p, TriangleHit &hit, float maxDistance = std::numeric_limits<float>::infinity()) const;
+
+	inline uint32_t getFaceCount() const { return (uint32_t)mBVH.indices().size(); }
+	inline const BVH &bvh() const { return mBVH; }
+
+	/* Vertex positions of the face at leaf entry i of bvh().indices() */
+	inline Vector3f vertex(uint32_t i, int corner) const { return mTriangles.col(i).segment<3>(3 * corner); }
+
+	/* Bytes used by the BVH and the triangle copies */
+	size_t memoryUsage() const;
+
+private:
+	/* Moeller-Trumbore intersection with leaf entry i, t within [mint, maxt] */
+	inline bool intersectTriangle(uint32_t i, const Ray &ray, float maxt, float &t, float &u, float &v) const;
+
+	BVH mBVH;
+	MatrixXf mTriangles;	// 9 x N vertex positions in leaf order
+};
@@ -5,6 +5,11 @@
 #include "normal.h"
 #include "tangent.h"
 #include "shellbounds.h"
+#include "cornerkernel.h"
+#include "shellio.h"
+#include "selfintersection.h"
+#include "safeoffset.h"
+#include "heightmap.h"
 
 #include <iostream>
 #include <string>
@@ -13,7 +18,7 @@
 using std::cout;
 using std::endl;
 
-Viewer::Viewer() : Screen(Eigen::Vector2i(1024, 758), "Shell Maps Viewer") {
+Viewer::Viewer() : Screen(Eigen::Vector2i(1024, 758), "Shell Maps Viewer"), mOffsetIntersectionCount(0), mIntersectionsValid(false) {
 	/* ui */
 	Window *window = new Window(this, "Operation Panel");
 	window->setPosition(Eigen::Vector2i(15, 15));
@@ -85,6 +90,20 @@ Viewer::Viewer() : Screen(Eigen::Vector2i(1024, 758), "Shell Maps Viewer") {
 		setMeshOffset(offset);
 	});
 
+	mSafeOffsetBox = new CheckBox(window, "Clamp per vertex to a safe offset");
+
+	b = new Button(window, "Load height map");
+	b->setCallback([&] {
+		std::string fileName = file_dialog({ {"png", "PNG"}, {"jpg", "JPEG"}, {"tga", "TGA"}, {"hdr", "Radiance HDR"}, }, false);
+		if (fileName.size() > 0) {
+			loadHeightMap(fileName, mHeights);
+			mHeightMapBox->setEnabled(true);
+			mHeightMapBox->setChecked(true);
+		}
+	});
+	mHeightMapBox = new CheckBox(window, "Follow the height map");
+	mHeightMapBox->setEnabled(false);
+
 	// Generate offset mesh button
 	new Label(window, "generate offset mesh", "sans-bold");
 	b = new Button(window, "Generate");
@@ -93,6 +112,12 @@ Viewer::Viewer() : Screen(Eigen::Vector2i(1024, 758), "Shell Maps Viewer") {
 	});
 
 	new Label(window, "compute split pattern", "sans-bold");
+	mPatternSolver = SPLIT_PATTERN_SOLVER_BOUNDED_DFS;
+	ComboBox *solverBox = new ComboBox(window, { "DFS search", "Vertex order", "Bounded DFS search" });
+	solverBox->setSelectedIndex(mPatternSolver);
+	solverBox->setCallback([&](int index) {
+		mPatternSolver = static_cast<SPLIT_PATTERN_SOLVER>(index);
+	});
 	b = new Button(window, "Compute");
 	b->setCallback([&] {
 		computeSplittingPattern();
@@ -104,12 +129,32 @@ Viewer::Viewer() : Screen(Eigen::Vector2i(1024, 758), "Shell Maps Viewer") {
 		constructTetrahedronMesh();
 	});
 
+	b = new Button(window, "Occupancy mask");
+	b->setCallback([&] {
+		std::string fileName = file_dialog({ {"png", "PNG"}, {"txt", "Texture space boxes"}, }, false);
+		if (fileName.size() > 4 && fileName.compare(fileName.size() - 4, 4, ".txt") == 0) {
+			std::vector<AABB> boxes;
+			loadOccupancyBoxes(fileName, boxes);
+			mOccupancy.clear();
+			mOccupancy.setBoxes(boxes);
+		}
+		else if (fileName.size() > 0) {
+			MatrixXf bitmap;
+			loadHeightMap(fileName, bitmap);
+			mOccupancy.clear();
+			mOccupancy.setBitmap(bitmap);
+		}
+	});
+
 	/// TODO: add save shell and bounds panel
 	new Label(window, "save shell and bounding shape", "sans-bold");
 	b = new Button(window, "Save shell");
 	b->setCallback([&] {
-		string fileName = file_dialog({ {"dat", "..."}, }, true);
-		saveShellToMitsuba(fileName, mShell);
+		string fileName = file_dialog({ {"dat", "Mitsuba shell"}, {"shell", "Binary shell"}, }, true);
+		if (fileName.size() > 6 && fileName.compare(fileName.size() - 6, 6, ".shell") == 0)
+			saveShellBinary(fileName, mShell);
+		else
+			saveShellToMitsuba(fileName, mShell);
 	});
 
 	b = new Button(window, "Save bound");
@@ -133,6 +178,12 @@ Viewer::Viewer() : Screen(Eigen::Vector2i(1024, 758), "Shell Maps Viewer") {
 	mLayers[VertexLabel] = new CheckBox(window, "Vertex label", layerCB);
 	mLayers[OffsetMeshWireFrame] = new CheckBox(window, "Offset Mesh Wireframe", layerCB);
 	mLayers[EdgePatternLabel] = new CheckBox(window, "Split Pattern Label on Base Mesh", layerCB);
+	/* The detection takes seconds on large meshes, so it only runs while the layer is shown */
+	mLayers[SelfIntersections] = new CheckBox(window, "Offset Self-Intersections", [&](bool checked) {
+		if (checked && !mIntersectionsValid && mOffsetMesh.V().cols() > 0 && mOffsetMesh.V().cols() == mMesh.V().cols())
+			detectOffsetSelfIntersections();
+		repaint();
+	});
 
 	window = new Window(this, "Information");
 	window->setPosition(Vector2i(280, 15));
@@ -156,10 +207,15 @@ Viewer::Viewer() : Screen(Eigen::Vector2i(1024, 758), "Shell Maps Viewer") {
 		(const char *)shader_simple_vert,
 		(const char *)shader_simple_frag);
 
+	mIntersectionShader.init("simple_shader",
+		(const char *)shader_simple_vert,
+		(const char *)shader_simple_frag);
+
 }
 
 Viewer::~Viewer() {
 	mShader.free();
+	mIntersectionShader.free();
 }
 
 void Viewer::repaint() {
@@ -261,6 +317,21 @@ void Viewer::drawContents() {
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 	};
 	
+	/* Offset faces intersecting the offset surface in red, those only intersecting the base surface in orange */
+	drawFunctor[SelfIntersections] = [&](uint32_t offset, uint32_t count) {
+		mIntersectionShader.bind();
+		mIntersectionShader.setUniform("modelViewProj", Matrix4f(proj * view * model));
+		uint32_t offsetCount = std::min(mOffsetIntersectionCount, offset + count);
+		if (offset < offsetCount) {
+			mIntersectionShader.setUniform("vertexColor", Vector3f(1.0, 0.1, 0.1));
+			mIntersectionShader.drawIndexed(GL_TRIANGLES, offset, offsetCount - offset);
+		}
+		if (offsetCount < offset + count) {
+			mIntersectionShader.setUniform("vertexColor", Vector3f(1.0, 0.6, 0.1));
+			mIntersectionShader.drawIndexed(GL_TRIANGLES, std::max(offset, offsetCount), offset + count - std::max(offset, offsetCount));
+		}
+	};
+
 	drawFunctor[FaceLabel] = [&](uint32_t offset, uint32_t count) {
 		nvgBeginFrame(mNVGContext, mSize[0], mSize[1], mPixelRatio);
 		nvgFontSize(mNVGContext, 14.0f);
@@ -342,6 +413,7 @@ void Viewer::drawContents() {
 	drawAmount[FaceLabel] = mMesh.F().cols();
 	drawAmount[VertexLabel] = mMesh.V().cols();
 	drawAmount[EdgePatternLabel] = splitPattern.cols();
+	drawAmount[SelfIntersections] = (uint32_t)mIntersectingFaces.size();
 
 	bool checked[LayerCount];
 	for (int i = 0; i < LayerCount; ++i) {
@@ -351,6 +423,7 @@ void Viewer::drawContents() {
 	const int drawOrder[] = {
 		InputMeshWireFrame,
 		OffsetMeshWireFrame,
+		SelfIntersections,
 		FaceLabel,
 		VertexLabel,
 		EdgePatternLabel
@@ -434,11 +507,12 @@ void Viewer::loadInput(std::string & meshFileName) {
 void Viewer::updateMesh() {
 	MatrixXf N, DPDU, DPDV;
 
-	computeVertexNormals(inF, inV, N, true);
-	if (inUV.cols() > 0)
-		computeVertexTangents(inF, inV, inUV, DPDU, DPDV, true);
+	computeVertexAttributes(inF, inV, inUV, N, DPDU, DPDV, mMeshStats, true);
 
 	mMesh.free();
+	mIntersectingFaces.clear();
+	mOffsetIntersectionCount = 0;
+	mIntersectionsValid = false;
 	mMesh.setF(std::move(inF));
 	mMesh.setV(std::move(inV));
 	mMesh.setN(std::move(N));
@@ -452,7 +526,6 @@ void Viewer::updateMesh() {
 	mShader.uploadAttrib("position", mMesh.V());
 	mShader.uploadIndices(mMesh.F());
 
-	mMeshStats = computeMeshStats(mMesh.F(), mMesh.V());
 	mCamera.modelTranslation = -mMeshStats.mWeightedCenter.cast<float>();
 	mCamera.modelZoom = 3.0f / (mMeshStats.mAABB.max - mMeshStats.mAABB.min).cwiseAbs().maxCoeff();
 
@@ -463,43 +536,7 @@ void Viewer::updateMesh() {
 void Viewer::resizeUV() {
 	/* check if UV is between [0, 1] */
 	// TODO: it's better to compute tangents first and then resize uv coordinates.
-	if (inUV.cols() > 0) {
-		float uMin = 1000000.0, vMin = 1000000.0, uMax = -1000000, vMax = -1000000;
-
-		for (int v = 0; v < inUV.cols(); ++v) {
-			if (inUV(0, v) < uMin) uMin = inUV(0, v);
-			if (inUV(0, v) > uMax) uMax = inUV(0, v);
-			if (inUV(1, v) < vMin) vMin = inUV(1, v);
-			if (inUV(1, v) > vMax) vMax = inUV(1, v);
-		}
-
-		std::cout << "[u, v] is between (" << uMin << ", " << vMin << ") and (" << uMax << ", " << vMax << ").\n";
-		std::cout << "first v: " << inUV(0, 0) << ", " << inUV(1, 0) << endl;
-
-		if (uMin < 0.0 || uMax > 1.0 || vMin < 0.0 || vMax > 1.0) {
-			std::cout << "resizing u,v .." << std::endl;
-
-			float uR = uMax - uMin;
-			float vR = vMax - vMin;
-
-			float s = std::max(uR, vR);
-			inUV /= s;
-			float tu = uMin / s;
-			float tv = vMin / s;
-
-			inUV.row(0) -= MatrixXf::Constant(1, inUV.cols(), tu - 0.000001);
-			inUV.row(1) -= MatrixXf::Constant(1, inUV.cols(), tv - 0.000001);
-
-			std::cout << "after, first v: " << inUV(0, 0) << ", " << inUV(1, 0) << endl;
-
-			uMax /= s;
-			uMax -= (tu - 0.000001);
-			vMax /= s;
-			vMax -= (tv - 0.000001);
-
-			std::cout << "after resizing, uv is between (" << 0.0 << ", " << 0.0 << ") and (" << uMax << ", " << vMax << ").\n";
-		}
-	}
+	normalizeTexcoords(inUV);
 }
 
 void Viewer::setMeshOffset(double offset) {
@@ -525,7 +562,20 @@ void Viewer::generateOffsetMesh() {
 	float offset = (mOffset >= 0.0f ? mOffset : 0.0f);
 
 	//	generateOffsetSurface(mMesh.F(), mMesh.V(), oF, oV, offset);
-	generateOffsetSurface(mMesh.F(), mMesh.V(), mMesh.N(), oF, oV, offset);
+	bool safe = mSafeOffsetBox->checked(), heightMap = mHeightMapBox->checked() && mHeights.size() > 0;
+	if (safe || heightMap) {
+		VectorXf offsets, heightOffsets;
+		if (safe)
+			computeSafeOffsets(mMesh.F(), mMesh.V(), mMesh.N(), offset, offsets);
+		if (heightMap) {
+			computeHeightMapOffsets(mMesh.F(), mMesh.UV(), mHeights, offset, heightOffsets);
+			offsets = safe ? offsets.cwiseMin(heightOffsets) : heightOffsets;
+		}
+		generateOffsetSurface(mMesh.F(), mMesh.V(), mMesh.N(), oF, oV, offsets);
+	}
+	else {
+		generateOffsetSurface(mMesh.F(), mMesh.V(), mMesh.N(), oF, oV, offset);
+	}
 
 	mOffsetMesh.free();
 	mOffsetMesh.setF(std::move(oF));	// same with base mesh
@@ -537,13 +587,38 @@ void Viewer::generateOffsetMesh() {
 
 	// share indices
 	shareGLBuffers();
+
+	mIntersectingFaces.clear();
+	mOffsetIntersectionCount = 0;
+	mIntersectionsValid = false;
+	if (mLayers[SelfIntersections]->checked())
+		detectOffsetSelfIntersections();
+}
+
+void Viewer::detectOffsetSelfIntersections() {
+	detectSelfIntersections(mMesh.F(), mMesh.V(), mOffsetMesh.V(), mIntersectingFaces, mIntersectionFlags);
+	std::stable_partition(mIntersectingFaces.begin(), mIntersectingFaces.end(), [&](uint32_t f) {
+		return (mIntersectionFlags[f] & SELF_INTERSECTION_OFFSET) != 0;
+	});
+	mOffsetIntersectionCount = 0;
+	for (uint32_t f : mIntersectingFaces)
+		mOffsetIntersectionCount += (mIntersectionFlags[f] & SELF_INTERSECTION_OFFSET) ? 1 : 0;
+
+	MatrixXu intersectionF(3, mIntersectingFaces.size());
+	for (uint32_t i = 0; i < (uint32_t)mIntersectingFaces.size(); ++i)
+		intersectionF.col(i) = mMesh.F().col(mIntersectingFaces[i]);
+
+	mIntersectionShader.bind();
+	mIntersectionShader.uploadAttrib("position", mOffsetMesh.V());
+	mIntersectionShader.uploadIndices(intersectionF);
+	mIntersectionsValid = true;
 }
 
 void Viewer::computeSplittingPattern() {
-	computePrimsSplittingPattern(mMesh.F(), splitPattern);
+	computePrimsSplittingPattern(mMesh.F(), splitPattern, mPatternSolver);
 }
 
 void Viewer::constructTetrahedronMesh() {
 	constructTetrahedronMeshSimple(mMesh.F(), mMesh.V(), mOffsetMesh.V(),
-		mMesh.UV(), mMesh.N(), mMesh.DPDU(), mMesh.DPDV(), splitPattern, mShell);
+		mMesh.UV(), mMesh.N(), mMesh.DPDU(), mMesh.DPDV(), splitPattern, mOccupancy, mShell);
 }
\ No newline at end of file
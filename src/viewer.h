@@ -5,6 +5,7 @@
 #include "trimesh.h"
 #include "meshstats.h"
 #include "tetra.h"
+#include "shellmapshelper.h"
 
 using namespace nanogui;
 
@@ -33,6 +34,7 @@ protected:
 	void resizeUV();
 	void setMeshOffset(double offset);
 	void generateOffsetMesh();
+	void detectOffsetSelfIntersections();
 	void computeSplittingPattern();
 	void constructTetrahedronMesh();
 
@@ -62,12 +64,20 @@ protected:
 	MeshStats mMeshStats;
 	TriMesh mOffsetMesh;
 	double mOffset;
+	std::vector<uint32_t> mIntersectingFaces;	// faces with offset self-intersections, those intersecting the offset surface first
+	std::vector<uint8_t> mIntersectionFlags;
+	uint32_t mOffsetIntersectionCount;
+	bool mIntersectionsValid;	// mIntersectingFaces belong to the current offset mesh, detected only while the layer is shown
+	MatrixXf mHeights;		// height map over the UV domain, empty if none is loaded
 	MatrixXu splitPattern;
+	SPLIT_PATTERN_SOLVER mPatternSolver;
+	ShellOccupancy mOccupancy;	// empty unless a mask is loaded
 	TetrahedronMesh mShell;
 
 	/* OpenGL objects */
 	GLShader mShader;
 	GLShader mOffsetShader;
+	GLShader mIntersectionShader;
 
 	/* GUI-related */
 	enum Layers {
@@ -76,10 +86,13 @@ protected:
 		FaceLabel,
 		VertexLabel,
 		EdgePatternLabel,
+		SelfIntersections,
 		LayerCount
 	};
 
 	CheckBox *mLayers[LayerCount];
 	Slider *mOffsetSlider;
+	CheckBox *mSafeOffsetBox;
+	CheckBox *mHeightMapBox;
 	TextBox *mOffsetBox;
 };
\ No newline at end of file